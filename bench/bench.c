@@ -0,0 +1,534 @@
+/* End-to-end update latency benchmark, runs the daemon against a stand-in
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Each round seeds the cache with an old address for all hostnames and
+ * runs the daemon once, so it sees an address change at its first check
+ * and updates all names.  The latency of a round is measured by the
+ * stand-in server, from the checkip request to the response of the last
+ * update, i.e. one iteration of ddns_main_loop() without the startup.
+ *
+ * After the timed rounds, one more round is run with the daemon traced
+ * to count its system calls.  Tracing is Linux only, and may not be
+ * allowed in containers, in which case the column shows '-'.
+ *
+ * With -t the stand-in speaks HTTPS, with a certificate the daemon is
+ * told to trust, and sessions are saved in the cache directory, so all
+ * but the first round of each plugin can resume the TLS session.  The
+ * Full and Resumed columns are the TLS handshakes per round.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/ptrace.h>
+#endif
+
+#include "standin.h"
+
+#define DEFAULT_ROUNDS	20
+#define DEFAULT_ALIASES	"1,8,32"
+#define DEFAULT_INADYN	"../src/inadyn"
+#define OLD_ADDRESS	"192.0.2.1"
+#define ROUND_TIMEOUT	30	/* sec */
+
+struct plugin {
+	const char *name;
+	const char *section;	/* Config file section title */
+	const char *extra;	/* Additional settings for the section */
+};
+
+struct result {
+	double      latency;	/* msec */
+	int         conns;
+	int         full;	/* TLS handshakes */
+	int         resumed;
+	int         reqs;
+	long        maxrss;	/* KiB */
+	long        syscalls;
+};
+
+static const struct plugin plugins[] = {
+	{ "dyndns2",    "provider default@dyndns.org",         NULL },
+	{ "cloudflare", "provider default@cloudflare.com",     NULL },
+	{ "dnspod",     "provider default@dnspod.cn",          NULL },
+	{ "freedns",    "provider default@freedns.afraid.org", NULL },
+	{ "custom",     "custom bench",
+	  "    ddns-path      = \"/update?hostname=%h&myip=%i\"\n" },
+};
+
+static char *prognm = "inadyn-bench";
+static char *inadyn = DEFAULT_INADYN;
+static char  dir[]  = "/tmp/inadyn-bench.XXXXXX";
+static int   verbose;
+static int   tls;
+static int   sigpipe[2] = { -1, -1 };
+
+static void sigchld(int signo)
+{
+	int saved = errno;
+
+	/* A full pipe means the loop is already being woken up */
+	(void)signo;
+	if (write(sigpipe[1], "", 1) < 0)
+		errno = saved;
+}
+
+static int rm(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+
+	return remove(path);
+}
+
+static int cmp(const void *a, const void *b)
+{
+	const struct result *ra = a, *rb = b;
+
+	return (ra->latency > rb->latency) - (ra->latency < rb->latency);
+}
+
+/* Nearest-rank percentile, of results sorted by latency */
+static double percentile(struct result *res, int num, int pct)
+{
+	int rank = (pct * num + 99) / 100;
+
+	if (rank < 1)
+		rank = 1;
+
+	return res[rank - 1].latency;
+}
+
+static int write_conf(const struct plugin *p, int port, int num)
+{
+	char path[sizeof(dir) + 32];
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/inadyn.conf", dir);
+	fp = fopen(path, "w");
+	if (!fp)
+		return 1;
+
+	fprintf(fp, "# Generated by %s, %s with %d hostnames\n", prognm, p->name, num);
+	if (tls) {
+		/* The certificate is for localhost, resolved from /etc/hosts */
+		fprintf(fp, "ca-trust-file     = \"%s/standin.pem\"\n", dir);
+		fprintf(fp, "ssl-session-cache = true\n");
+	}
+	fprintf(fp, "%s {\n", p->section);
+	fprintf(fp, "    username       = bench\n");
+	fprintf(fp, "    password       = secret\n");
+	fprintf(fp, "    ssl            = %s\n", tls ? "true" : "false");
+	fprintf(fp, "    checkip-ssl    = %s\n", tls ? "true" : "false");
+	fprintf(fp, "    checkip-server = %s:%d\n", tls ? "localhost" : "127.0.0.1", port);
+	fprintf(fp, "    checkip-path   = /ip\n");
+	fprintf(fp, "    ddns-server    = %s:%d\n", tls ? "localhost" : "127.0.0.1", port);
+	fprintf(fp, "    hostname       = {");
+	for (i = 1; i <= num; i++)
+		fprintf(fp, "%s \"host%d.example.com\"", i > 1 ? "," : "", i);
+	fprintf(fp, " }\n");
+	if (p->extra)
+		fputs(p->extra, fp);
+	fprintf(fp, "}\n");
+
+	return fclose(fp);
+}
+
+/* The address the daemon last sent, so the next check sees a change */
+static int write_cache(int num)
+{
+	char path[sizeof(dir) + 64];
+	FILE *fp;
+	int i;
+
+	for (i = 1; i <= num; i++) {
+		snprintf(path, sizeof(path), "%s/host%d.example.com.cache", dir, i);
+		fp = fopen(path, "w");
+		if (!fp)
+			return 1;
+		fputs(OLD_ADDRESS, fp);
+		fclose(fp);
+	}
+
+	return 0;
+}
+
+static pid_t spawn(int trace)
+{
+	char conf[sizeof(dir) + 32];
+	pid_t pid;
+
+	snprintf(conf, sizeof(conf), "%s/inadyn.conf", dir);
+
+	pid = fork();
+	if (pid)
+		return pid;
+
+	if (!verbose) {
+		int fd = open("/dev/null", O_RDWR);
+
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+	}
+
+#ifdef __linux__
+	if (trace && ptrace(PTRACE_TRACEME, 0, NULL, NULL))
+		_exit(127);
+#endif
+	execl(inadyn, "inadyn", "-1n", "-l", verbose ? "debug" : "none", "-f", conf,
+	      "--cache-dir", dir, "--no-pidfile", NULL);
+	_exit(126);
+}
+
+/* Resume a traced daemon, counting syscall stops, entry and exit */
+static void resume(pid_t pid, int status, long *stops, int *started)
+{
+#ifdef __linux__
+	int sig = WSTOPSIG(status);
+
+	if (!*started) {
+		/* First stop is the SIGTRAP after exec */
+		ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+		*started = 1;
+		sig = 0;
+	} else if (sig == (SIGTRAP | 0x80)) {
+		(*stops)++;
+		sig = 0;
+	}
+
+	ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig);
+#else
+	(void)pid;
+	(void)status;
+	(void)stops;
+	(void)started;
+#endif
+}
+
+/* Run one update cycle, serving the daemon until it exits */
+static int round_run(standin_t *s, int trace, struct result *res)
+{
+	struct pollfd pfd[STANDIN_MAX_CONN + 2];
+	struct rusage ru;
+	long long deadline;
+	long stops = 0;
+	int status = 0, started = 0;
+	pid_t pid;
+
+	standin_reset(s);
+	pid = spawn(trace);
+	if (pid < 0)
+		return 1;
+
+	deadline = standin_now() + ROUND_TIMEOUT * 1000000LL;
+	while (1) {
+		pid_t rc;
+		int num;
+
+		pfd[0].fd = sigpipe[0];
+		pfd[0].events = POLLIN;
+		num = standin_pollfd(s, &pfd[1], STANDIN_MAX_CONN + 1);
+		if (poll(pfd, num + 1, 100) > 0) {
+			char buf[16];
+
+			if (pfd[0].revents & POLLIN) {
+				while (read(sigpipe[0], buf, sizeof(buf)) > 0)
+					;
+			}
+			standin_handle(s, &pfd[1], num);
+		}
+
+		while ((rc = wait4(pid, &status, WNOHANG, &ru)) == pid) {
+			if (!WIFSTOPPED(status))
+				goto done;
+			resume(pid, status, &stops, &started);
+		}
+		if (rc < 0)
+			return 1;
+
+		if (standin_now() > deadline) {
+			fprintf(stderr, "%s: timed out waiting for %s\n", prognm, inadyn);
+			kill(pid, SIGKILL);
+			waitpid(pid, &status, 0);
+			return 1;
+		}
+	}
+done:
+	if (trace && !started)
+		return 1;	/* Tracing not allowed */
+	if (!WIFEXITED(status) || WEXITSTATUS(status) || !s->stats.updates) {
+		fprintf(stderr, "%s: update failed, exit status %d, %d updates, %d bad requests\n",
+			prognm, WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+			s->stats.updates, s->stats.errors);
+		return 1;
+	}
+
+	res->latency  = (s->stats.last - s->stats.first) / 1000.0;
+	res->conns    = s->stats.conns;
+	res->full     = s->stats.full;
+	res->resumed  = s->stats.resumed;
+	res->reqs     = s->stats.reqs;
+	res->maxrss   = ru.ru_maxrss;
+	res->syscalls = (stops + 1) / 2;
+
+	return 0;
+}
+
+static int bench(standin_t *s, const struct plugin *p, int num, int rounds)
+{
+	struct result *res, traced;
+	double conns = 0, full = 0, resumed = 0, reqs = 0;
+	char path[sizeof(dir) + 64];
+	char hs[2][16] = { "-", "-" };
+	long maxrss = 0;
+	char syscalls[16] = "-";
+	int i;
+
+	res = calloc(rounds, sizeof(*res));
+	if (!res)
+		return 1;
+
+	s->num_hosts = num;
+	if (write_conf(p, s->port, num))
+		goto fail;
+
+	/* Start each plugin with a full handshake */
+	snprintf(path, sizeof(path), "%s/localhost:%d.session", dir, s->port);
+	remove(path);
+
+	for (i = 0; i < rounds; i++) {
+		if (write_cache(num) || round_run(s, 0, &res[i]))
+			goto fail;
+
+		conns   += res[i].conns;
+		full    += res[i].full;
+		resumed += res[i].resumed;
+		reqs    += res[i].reqs;
+		if (res[i].maxrss > maxrss)
+			maxrss = res[i].maxrss;
+	}
+
+	if (!write_cache(num) && !round_run(s, 1, &traced))
+		snprintf(syscalls, sizeof(syscalls), "%ld", traced.syscalls);
+
+	if (tls) {
+		snprintf(hs[0], sizeof(hs[0]), "%.1f", full / rounds);
+		snprintf(hs[1], sizeof(hs[1]), "%.1f", resumed / rounds);
+	}
+
+	qsort(res, rounds, sizeof(*res), cmp);
+	printf("%-12s %6d %6d %9.2f %9.2f %9.1f %9s %9s %9.1f %9s %9ld\n", p->name, num, rounds,
+	       percentile(res, rounds, 50), percentile(res, rounds, 99),
+	       conns / rounds, hs[0], hs[1], reqs / rounds, syscalls, maxrss);
+	fflush(stdout);
+	free(res);
+
+	return 0;
+fail:
+	printf("%-12s %6d %6s %9s\n", p->name, num, "-", "FAILED");
+	free(res);
+
+	return 1;
+}
+
+static int serve(standin_t *s)
+{
+	struct pollfd pfd[STANDIN_MAX_CONN + 1];
+
+	printf("Stand-in server listening on 127.0.0.1:%d\n", s->port);
+	if (s->tls)
+		printf("HTTPS only, for localhost, trust %s/standin.pem\n", dir);
+	fflush(stdout);
+
+	while (1) {
+		int num;
+
+		num = standin_pollfd(s, pfd, STANDIN_MAX_CONN + 1);
+		if (poll(pfd, num, -1) > 0)
+			standin_handle(s, pfd, num);
+	}
+
+	return 0;
+}
+
+static int usage(int code)
+{
+	fprintf(stderr, "Usage:\n %s [-hstv] [-a NUM[,NUM]] [-n ROUNDS] [-p PORT] [-x PATH] [PLUGIN ...]\n\n"
+		" -a NUM[,NUM]  Number of hostnames to update per round, default: %s\n"
+		" -h            Show summary of command line options and exit\n"
+		" -n ROUNDS     Rounds per plugin and number of hostnames, default: %d\n"
+		" -p PORT       Port for the stand-in server, default: any free port\n"
+		" -s            Only run the stand-in server, e.g. for manual tests\n"
+		" -t            Use HTTPS, count full and resumed TLS handshakes\n"
+		" -v            Verbose, show requests and output from the daemon\n"
+		" -x PATH       Daemon to benchmark, default: %s\n\n"
+		"Plugins: dyndns2, cloudflare, dnspod, freedns, custom, default: all\n",
+		prognm, DEFAULT_ALIASES, DEFAULT_ROUNDS, DEFAULT_INADYN);
+
+	return code;
+}
+
+int main(int argc, char *argv[])
+{
+	char *aliases = DEFAULT_ALIASES, *list, *tok;
+	int rounds = DEFAULT_ROUNDS, port = 0, only_serve = 0;
+	struct sigaction sa;
+	standin_t s;
+	size_t i;
+	int c, rc = 0;
+
+	while ((c = getopt(argc, argv, "a:hn:p:stvx:")) != EOF) {
+		switch (c) {
+		case 'a':
+			aliases = optarg;
+			break;
+
+		case 'h':
+			return usage(0);
+
+		case 'n':
+			rounds = atoi(optarg);
+			if (rounds < 1)
+				return usage(1);
+			break;
+
+		case 'p':
+			port = atoi(optarg);
+			break;
+
+		case 's':
+			only_serve = 1;
+			break;
+
+		case 't':
+			tls = 1;
+			break;
+
+		case 'v':
+			verbose = 1;
+			break;
+
+		case 'x':
+			inadyn = optarg;
+			break;
+
+		default:
+			return usage(1);
+		}
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.verbose = verbose;
+	s.num_hosts = atoi(aliases);
+	if (standin_init(&s, port)) {
+		fprintf(stderr, "%s: failed starting stand-in server: %s\n", prognm, strerror(errno));
+		return 1;
+	}
+
+	if (!only_serve && access(inadyn, X_OK)) {
+		fprintf(stderr, "%s: cannot run %s: %s\n", prognm, inadyn, strerror(errno));
+		return 1;
+	}
+
+	/* The stand-in alone only needs a directory for its certificate */
+	if (pipe(sigpipe) || ((!only_serve || tls) && !mkdtemp(dir))) {
+		fprintf(stderr, "%s: %s\n", prognm, strerror(errno));
+		return 1;
+	}
+
+	if (tls) {
+		char cafile[sizeof(dir) + 32];
+
+		snprintf(cafile, sizeof(cafile), "%s/standin.pem", dir);
+		if (standin_tls(&s, cafile)) {
+			fprintf(stderr, "%s: failed setting up HTTPS, built without it?\n", prognm);
+			nftw(dir, rm, 8, FTW_DEPTH | FTW_PHYS);
+			return 1;
+		}
+	}
+
+	if (only_serve)
+		return serve(&s);
+	fcntl(sigpipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(sigpipe[1], F_SETFL, O_NONBLOCK);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchld;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGCHLD, &sa, NULL);
+
+	printf("%-12s %6s %6s %9s %9s %9s %9s %9s %9s %9s %9s\n", "Plugin", "Names", "Rounds",
+	       "p50 ms", "p99 ms", "Conns", "Full", "Resumed", "Requests", "Syscalls", "RSS KiB");
+
+	for (i = 0; i < sizeof(plugins) / sizeof(plugins[0]); i++) {
+		const struct plugin *p = &plugins[i];
+
+		if (optind < argc) {
+			int j;
+
+			for (j = optind; j < argc; j++) {
+				if (!strcmp(argv[j], p->name))
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+
+		list = strdup(aliases);
+		if (!list)
+			break;
+		for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+			int num = atoi(tok);
+
+			if (num < 1)
+				continue;
+			rc |= bench(&s, p, num, rounds);
+		}
+		free(list);
+	}
+
+	nftw(dir, rm, 8, FTW_DEPTH | FTW_PHYS);
+	standin_exit(&s);
+
+	return rc;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
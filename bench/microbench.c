@@ -0,0 +1,607 @@
+/* Microbenchmarks of the parsing and encoding primitives, and plugins
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Each benchmark runs its function in a loop, growing the number of
+ * iterations until the loop takes at least the minimum time, and then
+ * reports ns/op and allocations/op.  Allocations are counted by linking
+ * with --wrap for malloc(), calloc(), realloc() and strdup(), so only
+ * those made by our own code are counted, not those inside libc.
+ *
+ * The inputs are what the daemon sees on every check or update: checkip
+ * pages, dyndns2 responses for a batch of hostnames, and Cloudflare JSON
+ * listings.  HTTP responses are copied into the receive buffer for each
+ * iteration, like http_recv() would, since parsing modifies them.
+ *
+ * The plugin_update benchmarks run a whole update of one hostname, from
+ * setup() to response(), with the stand-in of inadyn-bench as server,
+ * over the mock transport instead of sockets.  Counters of the mock are
+ * reported per update too, e.g. to see that connections are reused.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "ddns.h"
+#include "base64.h"
+#include "cache.h"
+#include "json.h"
+#include "md5.h"
+#include "mock.h"
+#include "sha1.h"
+#include "standin.h"
+
+#define DEFAULT_TIME	500	/* msec per benchmark */
+#define RSP_SIZE	65536
+#define SEGMENT_SIZE	512	/* Typical size of each read, for incremental parsing */
+
+/* Normally set up by main.c and the .conf file */
+int   allow_ipv6        = 1;
+int   verify_addr       = 1;
+int   secure_ssl        = 1;
+int   broken_rtc        = 0;
+int   ssl_session_cache = 0;
+char *ca_trust_file     = NULL;
+char *cache_dir         = NULL;
+char *prognm            = "microbench";
+
+struct bench {
+	const char *name;
+	void      (*fn)(void *arg);
+	void       *arg;
+};
+
+struct response {
+	char       *data;
+	size_t      len;
+	size_t      segment;	/* Feed in pieces this big, 0: all at once */
+};
+
+/* Provider with one hostname, like conf.c sets it up */
+struct update {
+	const char   *plugin;
+	ddns_info_t   info;
+	ddns_alias_t  alias;
+};
+
+static long allocs;
+static volatile long sink;
+
+static char checkip_page[] =
+	"<html><head><title>Current IP Check</title></head>"
+	"<body>Current IP Address: 198.51.100.7</body></html>\r\n";
+static char checkip_page6[] =
+	"<html><head><title>Current IP Check</title></head>"
+	"<body>Current IP Address: 2001:db8:85a3::8a2e:370:7334</body></html>\r\n";
+static char checkip_plain[] = "198.51.100.7";
+static char *checkip_large;	/* Status page, many numbers before the address */
+
+static char *dyndns_rsp, *dyndns_chunked_rsp, *checkip_rsp, *listing_rsp;
+static char *listing;		/* Cloudflare dns_records listing, JSON */
+static json_t listing_doc;
+static char  zone[] =
+	"{\"result\":[{\"id\":\"023e105f4ecef8ad9ca31a8372d0c353\",\"name\":\"example.com\","
+	"\"status\":\"active\",\"paused\":false,\"type\":\"full\"}],"
+	"\"result_info\":{\"page\":1,\"per_page\":20,\"count\":1,\"total_count\":1},"
+	"\"success\":true,\"errors\":[],\"messages\":[]}";
+
+static ddns_t    ctx;
+static standin_t standin = { .address = "198.51.100.7", .domain = "example.com", .num_hosts = 100 };
+
+static struct update updates[] = {
+	{ .plugin = "default@dyndns.org"          },
+	{ .plugin = "default@cloudflare.com"      },
+	{ .plugin = "default@dnspod.cn"           },
+	{ .plugin = "default@freedns.afraid.org"  },
+};
+
+/* Only the cache data of plugins is used, not the address cache */
+ddns_info_t *conf_info_iterator(int first)
+{
+	return NULL;
+}
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+	allocs++;
+	return __real_strdup(s);
+}
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Like sprintf() to a growing buffer, inputs are built once at start */
+static char *append(char *buf, const char *fmt, ...)
+{
+	size_t len = buf ? strlen(buf) : 0;
+	va_list ap;
+	char *ptr;
+	int num;
+
+	va_start(ap, fmt);
+	num = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	ptr = __real_realloc(buf, len + num + 1);
+	if (!ptr) {
+		perror("realloc");
+		exit(1);
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(ptr + len, num + 1, fmt, ap);
+	va_end(ap);
+
+	return ptr;
+}
+
+static char *http_response(const char *type, const char *body)
+{
+	return append(NULL,
+		      "HTTP/1.1 200 OK\r\n"
+		      "Date: Sat, 22 Feb 2020 12:00:00 GMT\r\n"
+		      "Content-Type: %s\r\n"
+		      "Content-Length: %zu\r\n"
+		      "Connection: keep-alive\r\n"
+		      "Cache-Control: no-cache\r\n"
+		      "Server: nginx\r\n\r\n%s", type, strlen(body), body);
+}
+
+static void setup(void)
+{
+	char *body = NULL, *chunked = NULL;
+	size_t pos, len;
+	int i;
+
+	for (i = 0; i < 40; i++)
+		checkip_large = append(checkip_large, "<tr><td>node%d.example.net</td><td>v2.6.%d</td>"
+				       "<td>2020-02-22 12:%02d:%02d.%03d</td><td>99.%d%%</td></tr>\n",
+				       i, i, i, i, i * 7, i);
+	checkip_large = append(checkip_large, "<p>Your IP address is 198.51.100.7</p>\n");
+
+	/* dyndns2 batch update of 64 hostnames, one result line each */
+	for (i = 0; i < 64; i++)
+		body = append(body, "good 198.51.100.7\n");
+	dyndns_rsp = http_response("text/plain", body);
+
+	dyndns_chunked_rsp = append(NULL,
+				    "HTTP/1.1 200 OK\r\n"
+				    "Content-Type: text/plain\r\n"
+				    "Transfer-Encoding: chunked\r\n\r\n");
+	len = strlen(body);
+	for (pos = 0; pos < len; pos += 100) {
+		int num = len - pos > 100 ? 100 : len - pos;
+
+		chunked = append(chunked, "%x\r\n%.*s\r\n", num, num, body + pos);
+	}
+	dyndns_chunked_rsp = append(dyndns_chunked_rsp, "%s0\r\n\r\n", chunked);
+	free(chunked);
+	free(body);
+
+	checkip_rsp = http_response("text/html", checkip_page);
+
+	/* Cloudflare listing of 100 dns_records, about 40 kiB */
+	listing = append(NULL, "{\"result\":[");
+	for (i = 0; i < 100; i++)
+		listing = append(listing, "%s{\"id\":\"%032x\",\"type\":\"A\",\"name\":\"host%d.example.com\","
+				 "\"content\":\"198.51.100.%d\",\"proxiable\":true,\"proxied\":false,"
+				 "\"ttl\":1,\"locked\":false,\"zone_id\":\"023e105f4ecef8ad9ca31a8372d0c353\","
+				 "\"zone_name\":\"example.com\",\"modified_on\":\"2020-02-22T12:00:00.000000Z\","
+				 "\"created_on\":\"2020-02-22T12:00:00.000000Z\","
+				 "\"meta\":{\"auto_added\":false,\"managed_by_apps\":false,"
+				 "\"managed_by_argo_tunnel\":false,\"source\":\"primary\"}}",
+				 i ? "," : "", i * 2654435761u, i, i % 254 + 1);
+	listing = append(listing, "],\"result_info\":{\"page\":1,\"per_page\":100,\"count\":100,"
+			 "\"total_count\":100,\"total_pages\":1},\"success\":true,\"errors\":[],\"messages\":[]}");
+	listing_rsp = http_response("application/json", listing);
+	json_parse(&listing_doc, listing);
+}
+
+static void bench_ipv4(void *arg)
+{
+	char address[MAX_ADDRESS_LEN];
+
+	sink += parse_address(arg, AF_INET, address, sizeof(address));
+}
+
+static void bench_ipv6(void *arg)
+{
+	char address[MAX_ADDRESS_LEN];
+
+	sink += parse_address(arg, AF_INET6, address, sizeof(address));
+}
+
+/* What checkip does, IPv6 preferred */
+static void bench_any(void *arg)
+{
+	char address[MAX_ADDRESS_LEN];
+
+	sink += parse_address(arg, AF_UNSPEC, address, sizeof(address));
+}
+
+/* What http_exchange() does with the data from each http_recv() */
+static void bench_http(void *arg)
+{
+	static char buf[RSP_SIZE];
+	struct response *r = arg;
+	http_trans_t trans;
+	size_t pos = 0;
+
+	memset(&trans, 0, sizeof(trans));
+	trans.rsp = buf;
+	trans.max_rsp_len = sizeof(buf) - 1;
+	http_parse_init(&trans);
+
+	while (pos < r->len) {
+		size_t num = r->len - pos;
+
+		if (r->segment && num > r->segment)
+			num = r->segment;
+
+		memcpy(trans.rsp + trans.rsp_len, r->data + pos, num);
+		trans.rsp_len += num;
+		trans.rsp[trans.rsp_len] = 0;
+		pos += num;
+
+		if (http_parse(&trans))
+			break;
+	}
+	http_response_parse(&trans);
+
+	sink += trans.status + trans.rsp_len;
+}
+
+static void bench_base64(void *arg)
+{
+	unsigned char buf[256];
+	size_t len = sizeof(buf);
+
+	base64_encode(buf, &len, arg, strlen(arg));
+	sink += len;
+}
+
+static void bench_md5(void *arg)
+{
+	unsigned char digest[16];
+
+	md5(arg, strlen(arg), digest);
+	sink += digest[0];
+}
+
+static void bench_sha1(void *arg)
+{
+	unsigned char digest[20];
+
+	sha1(arg, strlen(arg), digest);
+	sink += digest[0];
+}
+
+static void bench_jsmn(void *arg)
+{
+	static jsmntok_t tokens[4096];
+	jsmn_parser parser;
+
+	jsmn_init(&parser);
+	sink += jsmn_parse(&parser, arg, strlen(arg), tokens, 4096);
+}
+
+/* Token arena reused between runs, like in the plugins */
+static void bench_json(void *arg)
+{
+	static json_t doc;
+
+	sink += json_parse(&doc, arg);
+}
+
+/* Path query on the parsed Cloudflare listing */
+static void bench_json_get(void *arg)
+{
+	sink += json_get(&listing_doc, NULL, arg) != NULL;
+}
+
+/* The mock transport hands each request to the stand-in */
+static int serve(char *req, int req_len, char *rsp, int rsp_max, void *arg)
+{
+	return standin_serve(arg, req, rsp, rsp_max);
+}
+
+/* What ddns.c does to update an alias, one at a time */
+static void bench_update(void *arg)
+{
+	static char rsp[DDNS_HTTP_RESPONSE_BUFFER_SIZE];
+	struct update *u = arg;
+	ddns_info_t *info = &u->info;
+	http_trans_t trans;
+	http_t client;
+	int rc = 0, len;
+
+	if (info->system->setup)
+		rc = info->system->setup(&ctx, info, &u->alias);
+	if (rc == RC_DDNS_RSP_UNCHANGED)
+		return;
+	if (rc)
+		goto fail;
+
+	len = info->system->request(&ctx, info, &u->alias);
+	if (len <= 0 || (size_t)len >= ctx.request_buflen) {
+		rc = RC_BUFFER_OVERFLOW;
+		goto fail;
+	}
+
+	memset(&trans, 0, sizeof(trans));
+	trans.req         = ctx.request_buf;
+	trans.req_len     = len;
+	trans.rsp         = rsp;
+	trans.max_rsp_len = sizeof(rsp) - 1;
+
+	client = info->server;
+	client.ssl_enabled = info->ssl_enabled;
+	rc = http_init(&client, "Sending IP# update to DDNS server");
+	if (!rc) {
+		rc = http_transaction(&client, &trans);
+		http_exit(&client);
+	}
+	if (!rc)
+		rc = info->system->response(&trans, info, &u->alias);
+	if (!rc) {
+		sink += trans.status;
+		return;
+	}
+fail:
+	fprintf(stderr, "Failed update with %s: %s\n", u->plugin, error_str(rc));
+	exit(1);
+}
+
+static void update_init(struct update *u)
+{
+	ddns_info_t *info = &u->info;
+
+	info->system = plugin_find(u->plugin, 0);
+	if (!info->system) {
+		fprintf(stderr, "No plugin %s\n", u->plugin);
+		exit(1);
+	}
+
+	strlcpy(info->creds.username, "bench", sizeof(info->creds.username));
+	strlcpy(info->creds.password, "s3cr3t", sizeof(info->creds.password));
+	info->user_agent = DDNS_USER_AGENT;
+	info->timeout    = DDNS_DEFAULT_TIMEOUT;
+
+	strlcpy(info->server_name.name, info->system->server_name, sizeof(info->server_name.name));
+	strlcpy(info->server_url, info->system->server_url, sizeof(info->server_url));
+	info->server_name.port = HTTP_DEFAULT_PORT;
+
+	http_construct(&info->server);
+	http_set_port(&info->server, info->server_name.port);
+	http_set_remote_name(&info->server, info->server_name.name);
+
+	snprintf(u->alias.name, sizeof(u->alias.name), "host1.%s", standin.domain);
+	strlcpy(u->alias.address, standin.address, sizeof(u->alias.address));
+	info->alias       = &u->alias;
+	info->alias_count = 1;
+}
+
+/* Private cache dir for record ids, and an HTTP server in memory */
+static void update_setup(void)
+{
+	static char dir[] = "/tmp/microbench.XXXXXX";
+	size_t i;
+
+	cache_dir = mkdtemp(dir);
+	if (!cache_dir) {
+		perror("mkdtemp");
+		exit(1);
+	}
+
+	ctx.request_buflen = DDNS_HTTP_REQUEST_BUFFER_SIZE;
+	ctx.request_buf    = malloc(ctx.request_buflen);
+	ctx.work_buflen    = DDNS_HTTP_RESPONSE_BUFFER_SIZE;
+	ctx.work_buf       = malloc(ctx.work_buflen);
+	if (!ctx.request_buf || !ctx.work_buf) {
+		perror("malloc");
+		exit(1);
+	}
+	ctx.check = 1;
+
+	mock_set_handler(serve, &standin);
+	http_set_transport(&mock_transport);
+
+	for (i = 0; i < NELEMS(updates); i++)
+		update_init(&updates[i]);
+}
+
+static void update_cleanup(void)
+{
+	size_t i;
+
+	http_pool_flush();
+	for (i = 0; i < NELEMS(updates); i++)
+		remove_cache_data(updates[i].alias.name, "cloudflare");
+	rmdir(cache_dir);
+}
+
+static void run(const struct bench *b, long long min)
+{
+	long long start, elapsed;
+	long long iter = 1, i;
+
+	while (1) {
+		allocs = 0;
+		memset(&mock_transport.stats, 0, sizeof(mock_transport.stats));
+		start = now();
+		for (i = 0; i < iter; i++)
+			b->fn(b->arg);
+		elapsed = now() - start;
+
+		if (elapsed >= min || iter >= (1LL << 40))
+			break;
+
+		/* Aim for the minimum time directly, once we have a fair estimate */
+		if (elapsed > min / 100)
+			iter = (long long)((double)iter * min * 1.2 / elapsed) + 1;
+		else
+			iter *= 10;
+	}
+
+	printf("%-44s %12lld %12.1f %10.2f\n", b->name, iter,
+	       (double)elapsed / iter, (double)allocs / iter);
+	if (mock_transport.stats.sends) {
+		http_stats_t *st = &mock_transport.stats;
+
+		printf("  mock: %.2f opens, %.2f sends, %.2f recvs, %.0f bytes sent, %.0f bytes received per op\n",
+		       (double)st->opens / iter, (double)st->sends / iter, (double)st->recvs / iter,
+		       (double)st->bytes_sent / iter, (double)st->bytes_recv / iter);
+	}
+	fflush(stdout);
+}
+
+static int usage(int code)
+{
+	fprintf(stderr, "Usage:\n microbench [-h] [-t MSEC] [FILTER ...]\n\n"
+		" -h        Show summary of command line options and exit\n"
+		" -t MSEC   Minimum run time of each benchmark, default: %d\n\n"
+		"Only benchmarks with any FILTER in their name are run, default: all\n",
+		DEFAULT_TIME);
+
+	return code;
+}
+
+int main(int argc, char *argv[])
+{
+	struct response checkip, dyndns, dyndns_chunked, listing_seg, listing_all;
+	long long min = DEFAULT_TIME * 1000000LL;
+	char creds[] = "john.doe@example.com:s3cr3t-Passw0rd-0123456789";
+	char freedns[] = "john.doe@example.com|s3cr3t-Passw0rd-0123456789";
+	size_t i;
+	int c;
+
+	while ((c = getopt(argc, argv, "ht:")) != EOF) {
+		switch (c) {
+		case 'h':
+			return usage(0);
+
+		case 't':
+			min = atol(optarg) * 1000000LL;
+			break;
+
+		default:
+			return usage(1);
+		}
+	}
+
+	setup();
+	update_setup();
+	checkip        = (struct response){ checkip_rsp,        strlen(checkip_rsp),        0 };
+	dyndns         = (struct response){ dyndns_rsp,         strlen(dyndns_rsp),         0 };
+	dyndns_chunked = (struct response){ dyndns_chunked_rsp, strlen(dyndns_chunked_rsp), SEGMENT_SIZE };
+	listing_all    = (struct response){ listing_rsp,        strlen(listing_rsp),        0 };
+	listing_seg    = (struct response){ listing_rsp,        strlen(listing_rsp),        SEGMENT_SIZE };
+
+	const struct bench benches[] = {
+		{ "parse_address/ipv4/checkip-page",      bench_ipv4,   checkip_page   },
+		{ "parse_address/ipv4/plain",             bench_ipv4,   checkip_plain  },
+		{ "parse_address/ipv4/status-page-2k",    bench_ipv4,   checkip_large  },
+		{ "parse_address/ipv6/checkip-page",      bench_ipv6,   checkip_page6  },
+		{ "parse_address/ipv6/ipv4-page-miss",    bench_ipv6,   checkip_page   },
+		{ "parse_address/ipv6/status-page-2k",    bench_ipv6,   checkip_large  },
+		{ "parse_address/any/checkip-page",       bench_any,    checkip_page   },
+		{ "parse_address/any/status-page-2k",     bench_any,    checkip_large  },
+		{ "http_response_parse/checkip",          bench_http,   &checkip       },
+		{ "http_response_parse/dyndns2-64",       bench_http,   &dyndns        },
+		{ "http_response_parse/dyndns2-64-chunked", bench_http, &dyndns_chunked },
+		{ "http_response_parse/cloudflare-100",   bench_http,   &listing_all   },
+		{ "http_response_parse/cloudflare-100-seg", bench_http, &listing_seg   },
+		{ "base64_encode/credentials",            bench_base64, creds          },
+		{ "md5/credentials",                      bench_md5,    creds          },
+		{ "sha1/freedns-credentials",             bench_sha1,   freedns        },
+		{ "jsmn_parse/cloudflare-zone",           bench_jsmn,   zone           },
+		{ "jsmn_parse/cloudflare-100",            bench_jsmn,   listing        },
+		{ "json_parse/cloudflare-zone",           bench_json,   zone           },
+		{ "json_parse/cloudflare-100",            bench_json,   listing        },
+		{ "json_get/cloudflare-100/success",      bench_json_get, "success"    },
+		{ "json_get/cloudflare-100/result[0].id", bench_json_get, "result[0].id" },
+		{ "json_get/cloudflare-100/result[99].id", bench_json_get, "result[99].id" },
+		{ "plugin_update/dyndns",                 bench_update, &updates[0]    },
+		{ "plugin_update/cloudflare",             bench_update, &updates[1]    },
+		{ "plugin_update/dnspod",                 bench_update, &updates[2]    },
+		{ "plugin_update/freedns",                bench_update, &updates[3]    },
+	};
+
+	printf("%-44s %12s %12s %10s\n", "Benchmark", "Iterations", "ns/op", "allocs/op");
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (optind < argc) {
+			int j;
+
+			for (j = optind; j < argc; j++) {
+				if (strstr(benches[i].name, argv[j]))
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+
+		run(&benches[i], min);
+	}
+	update_cleanup();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
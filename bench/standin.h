@@ -0,0 +1,110 @@
+/* Local stand-in for checkip and DDNS provider servers
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INADYN_STANDIN_H_
+#define INADYN_STANDIN_H_
+
+#include <poll.h>
+#include <stddef.h>
+#include "config.h"
+#include "queue.h"		/* BSD sys/queue.h API */
+
+#if defined(CONFIG_OPENSSL)
+#include <openssl/ssl.h>
+#elif defined(CONFIG_GNUTLS)
+#include <gnutls/gnutls.h>
+#endif
+
+#define STANDIN_MAX_CONN	64
+#define STANDIN_BUF_SIZE	16384
+#define STANDIN_RSP_SIZE	65536
+
+/* Counters for one round, reset with standin_reset() */
+typedef struct {
+	long long           first;	/* usec, first request */
+	long long           last;	/* usec, last update response sent */
+	int                 conns;	/* accepted connections, i.e. handshakes */
+	int                 full;	/* full TLS handshakes */
+	int                 resumed;	/* abbreviated TLS handshakes */
+	int                 reqs;
+	int                 updates;	/* update requests, a batch counts once */
+	int                 errors;	/* requests we could not make sense of */
+} standin_stats_t;
+
+typedef struct standin_conn {
+	LIST_ENTRY(standin_conn) link;
+
+	int                 sd;
+	short               events;	/* for poll(), POLLOUT in a TLS handshake */
+#ifdef ENABLE_SSL
+	int                 handshake;	/* TLS handshake done */
+#ifdef CONFIG_OPENSSL
+	SSL                *ssl;
+#else
+	gnutls_session_t    ssl;
+#endif
+#endif
+	size_t              len;
+	char                buf[STANDIN_BUF_SIZE];
+} standin_conn_t;
+
+typedef struct {
+	int                 sd;
+	unsigned short      port;
+	int                 verbose;
+	int                 tls;	/* All connections are HTTPS */
+
+#ifdef ENABLE_SSL
+#ifdef CONFIG_OPENSSL
+	SSL_CTX            *ctx;
+#else
+	gnutls_certificate_credentials_t cred;
+	gnutls_datum_t      ticket;	/* Session ticket key */
+#endif
+#endif
+
+	const char         *address;	/* Reported by checkip, and expected */
+	const char         *domain;	/* Zone of all hostnames */
+	int                 num_hosts;	/* host1.domain .. hostN.domain */
+
+	standin_stats_t     stats;
+	LIST_HEAD(, standin_conn) conns;
+} standin_t;
+
+int       standin_init   (standin_t *s, unsigned short port);
+void      standin_exit   (standin_t *s);
+void      standin_reset  (standin_t *s);
+int       standin_tls    (standin_t *s, const char *cafile);
+
+int       standin_pollfd (standin_t *s, struct pollfd *pfd, int max);
+void      standin_handle (standin_t *s, struct pollfd *pfd, int num);
+int       standin_serve  (standin_t *s, char *req, char *rsp, size_t len);
+
+long long standin_now    (void);
+
+#endif /* INADYN_STANDIN_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -30,6 +30,10 @@ char *cache_file       (char *name, char *buf, size_t len);
 int   read_cache_file  (ddns_t *ctx);
 int   write_cache_file (ddns_alias_t *alias);
 
+int   read_cache_data  (const char *name, const char *ext, char *data, size_t len);
+int   write_cache_data (const char *name, const char *ext, const char *data);
+void  remove_cache_data(const char *name, const char *ext);
+
 #endif /* INADYN_CACHE_H_ */
 
 /**
@@ -28,6 +28,7 @@
 #include "compat.h"
 #include "os.h"
 #include "error.h"
+#include "event.h"
 #include "http.h"
 #include "log.h"
 #include "plugin.h"
@@ -56,12 +57,11 @@
 #define DDNS_MAX_PERIOD                   (10 * 24 * 3600)        /* 10 days in sec */
 #define DDNS_ERROR_UPDATE_PERIOD          600     /* 10 min */
 #define DDNS_FORCED_UPDATE_PERIOD         (30 * 24 * 3600)        /* 30 days in sec */
-#define DDNS_DEFAULT_CMD_CHECK_PERIOD     1       /* sec */
 #define DDNS_DEFAULT_ITERATIONS           0       /* Forever */
+#define DDNS_DEFAULT_PARALLEL_UPDATES     1       /* One update at a time */
+#define DDNS_DEFAULT_TIMEOUT              10      /* sec, per HTTP(S) transaction */
 #define DDNS_HTTP_RESPONSE_BUFFER_SIZE	  (BUFSIZ < 8192 ? 8192 : BUFSIZ) /* at least 8 Kib */
 #define DDNS_HTTP_REQUEST_BUFFER_SIZE     2500    /* Bytes */
-#define DDNS_MAX_ALIAS_NUMBER             50      /* maximum number of aliases per server that can be maintained */
-#define DDNS_MAX_SERVER_NUMBER            5       /* maximum number of servers that can be maintained */
 
 /* SSL support status in plugin definition */
 #define DDNS_CHECKIP_SSL_UNSUPPORTED     -1       /* HTTPS not supported by checkip-server (default) */
@@ -88,6 +88,7 @@ typedef enum {
 	CMD_RESTART,
 	CMD_FORCED_UPDATE,
 	CMD_CHECK_NOW,
+	CMD_ADDR_CHANGED,
 } ddns_cmd_t;
 
 typedef struct {
@@ -145,8 +146,8 @@ typedef struct di {
 	tcp_proxy_type_t proxy_type;
 	ddns_name_t    proxy_name;
 
-	/* Your aliases/names to update */
-	ddns_alias_t   alias[DDNS_MAX_ALIAS_NUMBER];
+	/* Your aliases/names to update, allocated to fit all hostnames */
+	ddns_alias_t  *alias;
 	size_t         alias_count;
 
 	/* Use wildcard, *.foo.bar */
@@ -162,6 +163,28 @@ typedef struct di {
 	/* Does the provider support SSL? */
 	int            ssl_enabled;
 	int            append_myip; /* For custom setups! */
+
+	/*
+	 * Per provider schedule, periods default to the global settings.
+	 * The timer is set to the earliest of the next periodic check and
+	 * the next forced update of any of the aliases.
+	 */
+	int            period;
+	int            error_period;
+	int            forced_update_period;
+	int            timeout;	/* sec, deadline of each HTTP(S) transaction */
+	int            force_addr_update;
+	int            num_iterations;
+	int            due;
+	event_timer_t  timer;
+
+	/* Being checked, and outcome of any updates in flight */
+	int            checking;
+	int            rc;
+
+	/* Consecutive temporary errors, and any Retry-After from server */
+	int            retries;
+	int            retry_after;
 } ddns_info_t;
 
 /* Client context */
@@ -169,19 +192,18 @@ typedef struct {
 	char          *cfgfile;
 
 	ddns_cmd_t     cmd;
-	int            update_period; /* time between 2 updates */
 	int            normal_update_period_sec;
 	int            error_update_period_sec;
 	int            forced_update_period_sec;
 	int            forced_update_fake_addr;
-	int            cmd_check_period; /*time to wait for a command */
 	int            total_iterations;
-	int            num_iterations;
+	int            parallel_updates;
+	int            timeout_sec;
 	int            initialized;
 	int            change_persona;
-	int            force_addr_update;
 	int            use_proxy;
 	int            abort;
+	unsigned int   check;	/* Sequence number of current check of providers */
 
 	http_trans_t   http_transaction;
 
@@ -197,6 +219,7 @@ extern int force;
 extern int ignore_errors;
 extern int startup_delay;
 extern int allow_ipv6;
+extern int use_netlink;
 extern int verify_addr;
 extern char *ident;
 extern char *prognm;
@@ -212,9 +235,16 @@ extern gid_t gid;
 
 int ddns_main_loop (ddns_t *ctx);
 
+int is_address_valid   (int family, const char *host);
+int parse_address      (const char *buffer, int family, char *address, size_t len);
+int same_address       (const char *a, const char *b);
+
 int common_request (ddns_t       *ctx,   ddns_info_t *info, ddns_alias_t *alias);
 int common_response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias);
 
+int common_batch_request (ddns_t       *ctx,   ddns_info_t *info, ddns_alias_t **alias, size_t num);
+int common_batch_response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t **alias, size_t num, int *result);
+
 #endif /* DDNS_H_ */
 
 /**
@@ -0,0 +1,61 @@
+/* Interface for the non-blocking DNS resolver and its cache
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INADYN_DNS_H_
+#define INADYN_DNS_H_
+
+#include "os.h"
+
+#define DNS_MAX_ADDRS		8	/* Max addresses kept per name */
+#define DNS_CACHE_MAX		64	/* Max names kept in cache */
+
+typedef union {
+	struct sockaddr     sa;
+	struct sockaddr_in  sin;
+	struct sockaddr_in6 sin6;
+} dns_addr_t;
+
+typedef struct {
+	int         count;
+	dns_addr_t  addr[DNS_MAX_ADDRS];
+} dns_result_t;
+
+/* Called when a lookup started with dns_lookup() is done, or has failed */
+typedef void (*dns_cb_t)(int rc, void *arg);
+
+int       dns_lookup  (const char *name, int family, dns_result_t *res, dns_cb_t cb, void *arg);
+int       dns_resolve (const char *name, int family, dns_result_t *res, int timeout);
+void      dns_cancel  (dns_result_t *res);
+
+socklen_t dns_addrlen (dns_addr_t *addr);
+void      dns_setport (dns_addr_t *addr, int port);
+
+void      dns_flush   (void);
+void      dns_exit    (void);
+
+#endif /* INADYN_DNS_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -29,6 +29,9 @@
 #define RC_OUT_OF_MEMORY                3
 #define RC_BUFFER_OVERFLOW              4
 #define RC_PIDFILE_EXISTS_ALREADY       5
+#define RC_WANT_READ                    6
+#define RC_WANT_WRITE                   7
+#define RC_WANT_RESOLVE                 8
 
 #define RC_TCP_SOCKET_CREATE_ERROR      10
 #define RC_TCP_BAD_PARAMETER            11
@@ -55,6 +58,7 @@
 #define RC_DDNS_RSP_NOTOK               48
 #define RC_DDNS_RSP_RETRY_LATER         49
 #define RC_DDNS_RSP_AUTH_FAIL           50
+#define RC_DDNS_RSP_UNCHANGED           51
 
 #define RC_OS_INVALID_IP_ADDRESS        61
 #define RC_OS_FORK_FAILURE              62
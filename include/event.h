@@ -0,0 +1,60 @@
+/* Interface for the poll() based event loop
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INADYN_EVENT_H_
+#define INADYN_EVENT_H_
+
+#include <poll.h>
+
+typedef void (*event_cb_t)(int sd, int revents, void *arg);
+
+typedef struct event_timer event_timer_t;
+typedef void (*event_timer_cb_t)(event_timer_t *timer, void *arg);
+
+struct event_timer {
+	long long         deadline;	/* Expires at this event_now() */
+	size_t            pos;		/* Index in timer heap, 0: idle */
+	event_timer_cb_t  cb;
+	void             *arg;
+};
+
+int       event_add  (int sd, int events, event_cb_t cb, void *arg);
+int       event_mod  (int sd, int events);
+int       event_del  (int sd);
+
+void      event_timer_init (event_timer_t *timer, event_timer_cb_t cb, void *arg);
+int       event_timer_set  (event_timer_t *timer, long long msec);
+void      event_timer_del  (event_timer_t *timer);
+
+int       event_poll (int msec);
+void      event_exit (void);
+
+long long event_now  (void);
+int       event_msec (long long deadline);
+
+#endif /* INADYN_EVENT_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -36,6 +36,7 @@
 #endif
 
 #include "error.h"
+#include "event.h"
 #include "os.h"
 #include "tcp.h"
 
@@ -43,21 +44,48 @@
 #define	HTTP_DEFAULT_PORT	80
 #define	HTTPS_DEFAULT_PORT	443
 
+#define HTTP_KEEPALIVE_TIMEOUT	300	/* sec, max idle time in connection pool */
+#define HTTP_POOL_MAX		8	/* Max number of idle connections kept */
+#define HTTP_MAX_HEADERS	32	/* Max response headers indexed */
+
+typedef enum {
+	HTTP_IDLE = 0,
+	HTTP_RESOLVE,
+	HTTP_CONNECT,
+	HTTP_HANDSHAKE,
+	HTTP_SEND,
+	HTTP_RECV,
+} http_state_t;
+
+/* Incremental response parser, see http_parse() */
+typedef enum {
+	HTTP_PARSE_STATUS = 0,
+	HTTP_PARSE_HEADERS,
+	HTTP_PARSE_BODY,
+	HTTP_PARSE_CHUNK_SIZE,
+	HTTP_PARSE_CHUNK_DATA,
+	HTTP_PARSE_CHUNK_END,
+	HTTP_PARSE_TRAILER,
+	HTTP_PARSE_DONE,
+} http_parse_state_t;
+
 typedef struct {
-	tcp_sock_t tcp;
+	int   name;		/* Offset of name in rsp */
+	int   name_len;
+	int   value;		/* Offset of value, leading whitespace skipped */
+} http_header_t;
 
-	int        ssl_enabled;
-#ifdef ENABLE_SSL
-#ifdef CONFIG_OPENSSL
-	SSL       *ssl;
-	SSL_CTX   *ssl_ctx;
-#else
-	gnutls_session_t ssl;
-#endif
-#endif
+typedef struct {
+	http_parse_state_t state;
+	int   pos;		/* Parsed up to this offset in rsp */
+	int   body;		/* Offset of body in rsp */
+	int   body_len;		/* Chunks joined */
+	long  remain;		/* Left of body or chunk, -1: until server closes */
+	int   chunked;
 
-	int        initialized;
-} http_t;
+	int            num;
+	http_header_t  hdr[HTTP_MAX_HEADERS];
+} http_parser_t;
 
 typedef struct {
 	char *req;
@@ -71,16 +99,101 @@ typedef struct {
 
 	int   status;
 	char  status_desc[256];
+	int   retry_after;	/* sec, from Retry-After header, or 0 */
+
+	http_parser_t parser;
 } http_trans_t;
 
+typedef struct http_client http_t;
+
+/* Counters per transport, e.g. for benchmarks */
+typedef struct {
+	unsigned long       opens;
+	unsigned long       sends;
+	unsigned long       recvs;
+	unsigned long long  bytes_sent;
+	unsigned long long  bytes_recv;
+} http_stats_t;
+
+/*
+ * Transport of HTTP transactions, picked at runtime: plain TCP, TLS or
+ * the in-memory mock.  Send and receive are non-blocking, they return
+ * RC_WANT_READ or RC_WANT_WRITE to be called again when the socket is
+ * ready.  A receive of zero bytes means the server closed.
+ */
+typedef struct {
+	const char   *name;
+
+	/* Connect, NULL: TCP to remote host and port, see tcp.c */
+	int         (*open)     (http_t *client);
+
+	/* Set up session on connected socket, NULL: none, see handshake */
+	int         (*start)    (http_t *client);
+	int         (*handshake)(http_t *client);
+
+	int         (*send)     (http_t *client, const char *buf, int len, int *sent);
+	int         (*recv)     (http_t *client,       char *buf, int len, int *recv_len);
+	int         (*close)    (http_t *client);
+
+	http_stats_t  stats;
+} http_transport_t;
+
+extern http_transport_t http_tcp_transport;
+
+/* Called when a transaction started with http_start() is done, or has failed */
+typedef void (*http_cb_t)(http_t *client, http_trans_t *trans, int rc, void *arg);
+
+struct http_client {
+	tcp_sock_t tcp;
+
+	int        ssl_enabled;
+	http_transport_t *transport;
+	void      *priv;	/* Transport private data */
+#ifdef ENABLE_SSL
+#ifdef CONFIG_OPENSSL
+	SSL       *ssl;
+#else
+	gnutls_session_t ssl;
+#endif
+#endif
+
+	int        initialized;
+
+	/* Connection from pool, and if it can be returned to pool */
+	int        reused;
+	int        keepalive;	/* sec, 0: close connection */
+
+	/* Blocking transaction, see http_init(), must be done by event_now() */
+	long long  deadline;
+
+	/* Non-blocking transaction, see http_start() */
+	http_state_t   state;
+	http_trans_t  *trans;
+	int            sent;
+	char          *msg;
+	http_cb_t      cb;
+	void          *arg;
+	event_timer_t  timer;
+};
+
 int http_construct          (http_t *client);
 int http_destruct           (http_t *client, int num);
 
 int http_init               (http_t *client, char *msg);
 int http_exit               (http_t *client);
 
+void http_pool_flush        (void);
+void http_set_transport     (http_transport_t *transport);
+
 int http_transaction        (http_t *client, http_trans_t *trans);
+int http_start              (http_t *client, http_trans_t *trans, char *msg, http_cb_t cb, void *arg);
 int http_status_valid       (int status);
+const char *http_header     (http_trans_t *trans, const char *name);
+
+/* Incremental response parser, fed by http_transaction() and http_start() */
+void http_parse_init        (http_trans_t *trans);
+int  http_parse             (http_trans_t *trans);
+void http_response_parse    (http_trans_t *trans);
 
 int http_set_port           (http_t *client, int  porg);
 int http_get_port           (http_t *client, int *port);
@@ -23,10 +23,32 @@
 #define INADYN_JSON_H_
 
 #define JSMN_HEADER
+#define JSMN_PARENT_LINKS	/* Must match src/jsmn.c */
 #include "jsmn.h"
 
-int parse_json(const char *json, jsmntok_t *out_tokens[]);
+/*
+ * Parsed document.  The token arena is kept between calls to
+ * json_parse(), and only grows, so parsing allocates nothing once it
+ * has seen the largest response.  Tokens point into the parsed text,
+ * which must be kept around while the document is used.
+ */
+typedef struct {
+	const char *js;
+	jsmntok_t  *tok;
+	int         num;	/* Tokens in last document */
+	int         max;	/* Size of arena */
+} json_t;
+
+int        json_parse (json_t *doc, const char *js);
+void       json_free  (json_t *doc);
+
+jsmntok_t *json_get   (json_t *doc, const jsmntok_t *from, const char *path);
+jsmntok_t *json_first (json_t *doc, const jsmntok_t *tok);
+jsmntok_t *json_next  (json_t *doc, const jsmntok_t *tok);
+
 int jsoneq(const char *json, const jsmntok_t *tok, const char *s);
 int json_bool(const char *json, const jsmntok_t *token, int *out_value);
+int json_long(const char *json, const jsmntok_t *token, long *out_value);
+int json_copy(const char *json, const jsmntok_t *token, char *dest, size_t len);
 
 #endif
@@ -0,0 +1,47 @@
+/* In-memory loopback transport, for benchmarks
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INADYN_MOCK_H_
+#define INADYN_MOCK_H_
+
+#include "http.h"
+
+#define MOCK_BUF_SIZE		65536	/* Max request and response */
+
+/*
+ * Called with each complete request, NUL terminated, which it may
+ * modify, writes the response to @rsp.  Returns the length of the
+ * response, or -1 on error.
+ */
+typedef int (*mock_cb_t)(char *req, int req_len, char *rsp, int rsp_max, void *arg);
+
+extern http_transport_t mock_transport;
+
+void mock_set_handler(mock_cb_t cb, void *arg);
+
+#endif /* INADYN_MOCK_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -24,10 +24,11 @@
 #ifndef INADYN_PLUGIN_H_
 #define INADYN_PLUGIN_H_
 
+#include <sys/types.h>
 #include "queue.h"		/* BSD sys/queue.h API */
 
 #define GENERIC_HTTP_REQUEST                                      	\
-	"GET %s HTTP/1.0\r\n"						\
+	"GET %s HTTP/1.1\r\n"						\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n\r\n"
 
@@ -37,11 +38,19 @@
 #define PLUGIN_ITERATOR(x, tmp) TAILQ_FOREACH_SAFE(x, &plugins, link, tmp)
 
 /* Types used for DNS system specific configuration */
-/* Function to prepare DNS system specific server requests */
+/*
+ * Function to prepare DNS system specific server requests.  May return
+ * RC_DDNS_RSP_UNCHANGED if the record was read and already holds the
+ * address, the update is then skipped and counted as successful.
+ */
 typedef int (*setup_fn_t) (void* this, void* info, void* alias);
 typedef int (*req_fn_t) (void *this, void *info, void *alias);
 typedef int (*rsp_fn_t) (void *this, void *info, void *alias);
 
+/* Optional, update several hostnames in one request, @alias is an array of @num */
+typedef int (*batch_req_fn_t) (void *this, void *info, void *alias, size_t num);
+typedef int (*batch_rsp_fn_t) (void *this, void *info, void *alias, size_t num, int *result);
+
 typedef struct ddns_system {
 	TAILQ_ENTRY(ddns_system) link; /* BSD sys/queue.h linked list node. */
 
@@ -51,6 +60,11 @@ typedef struct ddns_system {
 	req_fn_t       request;
 	rsp_fn_t       response;
 
+	/* Max hostnames per batch_request(), result of each in batch_response() */
+	batch_req_fn_t batch_request;
+	batch_rsp_fn_t batch_response;
+	const size_t   batch;
+
 	const int      nousername;    /* Provider does not require username='' */
 
 	const char    *checkip_name;
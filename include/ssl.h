@@ -33,25 +33,26 @@ extern char *ca_trust_file;
 extern int secure_ssl;
 extern int broken_rtc;
 
+/* Resumable TLS sessions are saved to cache dir, user can enable in .conf file */
+extern int ssl_session_cache;
+
 #ifdef ENABLE_SSL
 int     ssl_init(void);
 void    ssl_exit(void);
 
-int     ssl_open(http_t *client, char *msg);
-int     ssl_close(http_t *client);
+/* Shared TLS context, reloaded on SIGHUP or when ca-trust-file changes */
+int     ssl_changed(void);
+void    ssl_reload(void);
 
-int     ssl_send(http_t *client, const char *buf, int     len);
-int     ssl_recv(http_t *client,       char *buf, int buf_len, int *recv_len);
+/* HTTPS transport, see http_transport_t */
+extern http_transport_t ssl_transport;
 
 #else
 #define ssl_init()  0
 #define ssl_exit()
 
-#define ssl_open(client, msg)                    tcp_init(&client->tcp, msg)
-#define ssl_close(client)                        tcp_exit(&client->tcp)
-
-#define ssl_send(client, buf, len)               tcp_send(&client->tcp, buf, len)
-#define ssl_recv(client, buf, buf_len, recv_len) tcp_recv(&client->tcp, buf, buf_len, recv_len)
+#define ssl_changed() 0
+#define ssl_reload()
 
 #endif /* ENABLE_SSL */
 #endif /* INADYN_SSL_H_ */
@@ -24,11 +24,13 @@
 #define INADYN_TCP_H_
 
 #include "os.h"
+#include "dns.h"
 #include "error.h"
+#include "event.h"
 
 #define TCP_DEFAULT_TIMEOUT		5000	/* msec */
 #define TCP_SOCKET_MAX_PORT		65535
-#define TCP_DEFAULT_READ_CHUNK_SIZE	100
+#define TCP_ATTEMPT_DELAY		250	/* msec, RFC 8305 */
 
 typedef enum {
 	NO_PROXY = 0,
@@ -39,6 +41,9 @@ typedef enum {
 	PROXY_HTTP_CONNECT, /* SSL only. */
 } tcp_proxy_type_t;
 
+/* Called when tcp_connect() is done, or has failed */
+typedef void (*tcp_cb_t)(int rc, void *arg);
+
 typedef struct {
 	int                 initialized;
 
@@ -51,16 +56,31 @@ typedef struct {
 	tcp_proxy_type_t    proxy_type;
 	const char         *proxy_host;
 	unsigned short      proxy_port;
+
+	/* Addresses of remote host, and connection attempts in flight */
+	dns_result_t        res;
+	int                 sd[DNS_MAX_ADDRS];
+	int                 next;
+	int                 tries;
+	long long           stagger;	/* Start next attempt, if not connected */
+	event_timer_t       timer;
+
+	char               *msg;
+	tcp_cb_t            cb;
+	void               *arg;
 } tcp_sock_t;
 
 int tcp_construct          (tcp_sock_t *tcp);
 int tcp_destruct           (tcp_sock_t *tcp);
 
-int tcp_init               (tcp_sock_t *tcp, char *msg);
+int tcp_init               (tcp_sock_t *tcp, char *msg, long long deadline);
 int tcp_exit               (tcp_sock_t *tcp);
 
-int tcp_send               (tcp_sock_t *tcp, const char *buf, int len);
-int tcp_recv               (tcp_sock_t *tcp,       char *buf, int len, int *recv_len);
+int tcp_resolve            (tcp_sock_t *tcp, dns_cb_t cb, void *arg);
+int tcp_connect            (tcp_sock_t *tcp, char *msg, tcp_cb_t cb, void *arg);
+
+int tcp_write              (tcp_sock_t *tcp, const char *buf, int len, int *sent);
+int tcp_read               (tcp_sock_t *tcp,       char *buf, int len, int *recv_len);
 
 int tcp_set_port           (tcp_sock_t *tcp, int  port);
 int tcp_get_port           (tcp_sock_t *tcp, int *port);
@@ -7,7 +7,7 @@
 indent --linux-style --line-length112 --dont-format-comments \
 -T size_t -T sigset_t -T timeval_t -T pid_t -T pthread_t \
 -T time_t -T uint32_t -T uint16_t -T uint8_t -T socklen_t \
--T ddns_t -T ddns_user_t -T ddns_creds_t -T ddns_info_t -T ddns_sysinfo_t \
+-T ddns_t -T dns_addr_t -T dns_cb_t -T dns_result_t -T tcp_cb_t -T event_cb_t -T event_timer_t -T event_timer_cb_t -T ddns_user_t -T ddns_creds_t -T ddns_info_t -T ddns_sysinfo_t \
 -T ddns_cmd_t -T ddns_system_t -T ddns_server_name_t -T ddns_alias_t \
--T http_client_t -T http_trans_t -T tcp_sock_t \
+-T batch_req_fn_t -T batch_rsp_fn_t -T http_t -T http_stats_t -T http_transport_t -T mock_cb_t -T http_cb_t -T http_state_t -T http_client_t -T http_trans_t -T http_parse_state_t -T http_header_t -T http_parser_t -T tcp_sock_t -T standin_t -T standin_conn_t -T standin_stats_t -T json_t \
 $*
@@ -28,7 +28,7 @@
 	"system=dyndns&"						\
 	"hostname=%s&"							\
 	"myip=%s "							\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"Authorization: Basic %s\r\n"					\
 	"User-Agent: %s\r\n\r\n"
@@ -19,29 +19,38 @@
  * Boston, MA  02110-1301, USA.
  */
 
+#include <ctype.h>
+#include <strings.h>
+
 #include "plugin.h"
+#include "cache.h"
 #include "json.h"
 
-#define CHECK(fn)       { rc = (fn); if (rc) goto cleanup; }
-
 #define API_HOST "api.cloudflare.com"
 #define API_URL "/client/v4"
 
-static const char *CLOUDFLARE_ZONE_ID_REQUEST = "GET " API_URL "/zones?name=%s HTTP/1.0\r\n"	\
+static const char *CLOUDFLARE_ZONE_ID_REQUEST = "GET " API_URL "/zones?name=%s HTTP/1.1\r\n"	\
 	"Host: " API_HOST "\r\n"		\
 	"User-Agent: %s\r\n"			\
 	"Accept: */*\r\n"				\
 	"Authorization: Bearer %s\r\n"	\
 	"Content-Type: application/json\r\n\r\n";
 	
-static const char *CLOUDFLARE_HOSTNAME_ID_REQUEST	= "GET " API_URL "/zones/%s/dns_records?type=%s&name=%s HTTP/1.0\r\n"	\
+static const char *CLOUDFLARE_HOSTNAME_ID_REQUEST	= "GET " API_URL "/zones/%s/dns_records?type=%s&name=%s HTTP/1.1\r\n"	\
 	"Host: " API_HOST "\r\n"		\
 	"User-Agent: %s\r\n"			\
 	"Accept: */*\r\n"				\
 	"Authorization: Bearer %s\r\n"	\
 	"Content-Type: application/json\r\n\r\n";
 	
-static const char *CLOUDFLARE_HOSTNAME_CREATE_REQUEST	= "POST " API_URL "/zones/%s/dns_records HTTP/1.0\r\n"	\
+static const char *CLOUDFLARE_LIST_REQUEST	= "GET " API_URL "/zones/%s/dns_records?per_page=%d&page=%d HTTP/1.1\r\n"	\
+	"Host: " API_HOST "\r\n"		\
+	"User-Agent: %s\r\n"			\
+	"Accept: */*\r\n"				\
+	"Authorization: Bearer %s\r\n"	\
+	"Content-Type: application/json\r\n\r\n";
+
+static const char *CLOUDFLARE_HOSTNAME_CREATE_REQUEST	= "POST " API_URL "/zones/%s/dns_records HTTP/1.1\r\n"	\
 	"Host: " API_HOST "\r\n"		\
 	"User-Agent: %s\r\n"			\
 	"Accept: */*\r\n"				\
@@ -50,7 +59,7 @@ static const char *CLOUDFLARE_HOSTNAME_CREATE_REQUEST	= "POST " API_URL "/zones/
 	"Content-Length: %zd\r\n\r\n" \
 	"%s";
 
-static const char *CLOUDFLARE_HOSTNAME_UPDATE_REQUEST	= "PUT " API_URL "/zones/%s/dns_records/%s HTTP/1.0\r\n"	\
+static const char *CLOUDFLARE_HOSTNAME_UPDATE_REQUEST	= "PUT " API_URL "/zones/%s/dns_records/%s HTTP/1.1\r\n"	\
 	"Host: " API_HOST "\r\n"		\
 	"User-Agent: %s\r\n"			\
 	"Accept: */*\r\n"				\
@@ -85,17 +94,62 @@ static ddns_system_t plugin = {
 };
 
 /*
- * filled by the setup() callback and handed to ddns_info_t
- * for use later in the request() callback .
+ * Zone and record id of each hostname, looked up by the setup() callback
+ * only the first time, then kept, also across restarts in the cache dir.
+ * Looked up again if the record type changes, or the PUT gets a 404.
+ * Hashed by name, with many hostnames setup() is called for each.
  */
 #define MAX_NAME 64
 #define MAX_ID (32 + 1)
+#define CACHE_EXT "cloudflare"
+#define NUM_BUCKETS 64
 
 struct cfdata {
+	LIST_ENTRY(cfdata) link;
+
+	char name[SERVER_NAME_LEN];
+	char type[5];			/* Record type of hostname_id */
 	char zone_id[MAX_ID];
 	char hostname_id[MAX_ID];
 };
 
+static LIST_HEAD(, cfdata) cfdata_hash[NUM_BUCKETS];
+
+/*
+ * Zone id and an index of all A and AAAA records in the zone, fetched
+ * with one paginated listing the first time any hostname in the zone
+ * misses the cache above, so N hostnames cost one lookup, not N.  The
+ * index is kept up to date with our own changes, and is listed again
+ * if a create fails or an update gets a 404.  The listed content may
+ * change behind our back, so it is only trusted in the same check.
+ */
+#define LIST_PER_PAGE 100
+#define LIST_BUF_SIZE 131072
+
+struct cfrecord {
+	LIST_ENTRY(cfrecord) link;
+
+	char type[5];
+	char id[MAX_ID];
+	char content[MAX_ADDRESS_LEN];
+	char name[];
+};
+
+struct cfzone {
+	LIST_ENTRY(cfzone) link;
+
+	char name[MAX_NAME];
+	char id[MAX_ID];
+	int  listed;			/* 1: index complete, -1: too large, use lookups */
+	unsigned int check;		/* ctx->check when listed, for content */
+	LIST_HEAD(, cfrecord) records[NUM_BUCKETS];
+};
+
+static LIST_HEAD(, cfzone) cfzone_list = LIST_HEAD_INITIALIZER(cfzone_list);
+
+/* Token arena, reused for every response */
+static json_t doc;
+
 static int check_response_code(int status)
 {
 	switch (status)
@@ -124,137 +178,111 @@ static int check_response_code(int status)
 	}
 }
 
-static int check_success(const char *json, const jsmntok_t tokens[], const int num_tokens)
+static int check_success(json_t *doc)
 {
-	for (int i = 1; i < num_tokens; i++) {
-		int set;
-
-		if (jsoneq(json, tokens + i, KEY_SUCCESS) != 0)
-			continue;
+	jsmntok_t *tok;
+	int set;
 
-		if (i < num_tokens - 1 && json_bool(json, tokens + i + 1, &set) == 0)
-			return set ? 0 : -1;
-				
+	tok = json_get(doc, NULL, KEY_SUCCESS);
+	if (!tok || json_bool(doc->js, tok, &set))
 		return -1;
-	}
-	
-	return -1;
+
+	return set ? 0 : -1;
 }
 
-static int check_success_only(const char *json)
+/* Value of key in the first result, e.g. "id" => result[0].id */
+static int get_result_value(const char *key, char *dest, size_t dest_size)
 {
-	jsmntok_t *tokens;
-	int num_tokens;
-	int result;
-	
-	num_tokens = parse_json(json, &tokens);	
-	if (num_tokens == -1)
-		return -1;
-
-	result = check_success(json, tokens, num_tokens);
-	free(tokens);
+	jsmntok_t *result, *tok;
 
-	return result;
-}
+	result = json_get(&doc, NULL, "result");
+	if (result && result->type == JSMN_ARRAY)
+		result = json_get(&doc, result, "[0]");
 
-static int get_result_value(const char *json, const char *key, jsmntok_t *out_result)
-{
-	jsmntok_t *tokens;
-	int num_tokens;
-	
-	num_tokens = parse_json(json, &tokens);
-	if (num_tokens < 0)
+	tok = result ? json_get(&doc, result, key) : NULL;
+	if (!tok) {
+		logit(LOG_INFO, "Could not find key '%s'.", key);
 		return -1;
-	
-	if (tokens[0].type != JSMN_OBJECT) {
-		logit(LOG_ERR, "JSON response contained no objects.");
-		goto cleanup;
 	}
-	
-	if (check_success(json, tokens, num_tokens) == -1) {
-		logit(LOG_ERR, "Request was unsuccessful.");
-		goto cleanup;
-	}
-	
-	for (int i = 1; i < num_tokens; i++) {
-		if (jsoneq(json, tokens + i, key) != 0)
-			continue;
-
-		if (i < num_tokens - 1) {
-			*out_result = tokens[i+1];
-			free(tokens);
-			return 0;
-		}
-	}
-	
-	logit(LOG_INFO, "Could not find key '%s'.", key);
 
-cleanup:
-	free(tokens);
-	return -1;
-}
-
-static int json_copy_value(char *dest, size_t dest_size, const char *json, const jsmntok_t *token)
-{
-	size_t length;
-
-	if (token->type != JSMN_STRING)
-		return -1;
-	
-	length = token->end - token->start + 1;
-	if (length > dest_size)
+	if (tok->type != JSMN_STRING || json_copy(doc.js, tok, dest, dest_size)) {
+		logit(LOG_ERR, "Id did not fit into buffer.");
 		return -2;
-	
-	strlcpy(dest, json + token->start, length);
+	}
 
 	return 0;
 }
 
-static int get_id(char *dest, size_t dest_size, const ddns_info_t *info, char *request, size_t request_len)
+/* Send API request, the response is parsed into doc, which refers to buf */
+static int api_get(const ddns_info_t *info, char *what, char *request, size_t request_len,
+		   char *buf, size_t buf_len)
 {
-	const size_t  RESP_BUFFER_SIZE = 4096;
-	const char   *body;
 	http_trans_t  trans;
-	jsmntok_t     id;
 	http_t        client;
-	char         *response_buf;
-	int           rc = RC_OK;
-
-	response_buf = calloc(RESP_BUFFER_SIZE, sizeof(char));
-	if (!response_buf)
-		return RC_OUT_OF_MEMORY;
+	int           rc;
 
-	CHECK(http_construct(&client));
+	rc = http_construct(&client);
+	if (rc)
+		return rc;
 
 	http_set_port(&client, info->server_name.port);
 	http_set_remote_name(&client, info->server_name.name);
+	http_set_remote_timeout(&client, info->timeout * 1000);
 
 	client.ssl_enabled = info->ssl_enabled;
-	CHECK(http_init(&client, "Id query"));
+	rc = http_init(&client, what);
+	if (rc)
+		return rc;
 
 	trans.req = request;
 	trans.req_len = request_len;
-	trans.rsp = response_buf;
-	trans.max_rsp_len = RESP_BUFFER_SIZE - 1; /* Save place for a \0 at the end */
+	trans.rsp = buf;
+	trans.max_rsp_len = buf_len - 1; /* Save place for a \0 at the end */
 
 	logit(LOG_DEBUG, "Request:\n%s", request);
-	CHECK(http_transaction(&client, &trans));
+	rc = http_transaction(&client, &trans);
 
 	http_exit(&client);
 	http_destruct(&client, 1);
+	if (rc)
+		return rc;
 
 	logit(LOG_DEBUG, "Response:\n%s", trans.rsp);
-	CHECK(check_response_code(trans.status));
+	rc = check_response_code(trans.status);
+	if (rc)
+		return rc;
 
-	body = trans.rsp_body;
-	if (get_result_value(body, "id", &id) < 0) {
-		rc = RC_DDNS_RSP_NOHOST;
-		goto cleanup;
+	if (json_parse(&doc, trans.rsp_body) < 0 || doc.tok[0].type != JSMN_OBJECT) {
+		logit(LOG_ERR, "JSON response contained no objects.");
+		return RC_DDNS_RSP_NOTOK;
 	}
 
-	if (json_copy_value(dest, dest_size, body, &id) < 0) {
-		logit(LOG_ERR, "Id did not fit into buffer.");
-		rc = RC_BUFFER_OVERFLOW;
+	if (check_success(&doc) == -1) {
+		logit(LOG_ERR, "Request was unsuccessful.");
+		return RC_DDNS_RSP_NOTOK;
+	}
+
+	return 0;
+}
+
+static int get_id(char *dest, size_t dest_size, const ddns_info_t *info, char *request, size_t request_len)
+{
+	const size_t  RESP_BUFFER_SIZE = 4096;
+	char         *response_buf;
+	int           rc;
+
+	response_buf = calloc(RESP_BUFFER_SIZE, sizeof(char));
+	if (!response_buf)
+		return RC_OUT_OF_MEMORY;
+
+	rc = api_get(info, "Id query", request, request_len, response_buf, RESP_BUFFER_SIZE);
+	if (rc)
+		goto cleanup;
+
+	rc = get_result_value("id", dest, dest_size);
+	if (rc) {
+		rc = rc == -2 ? RC_BUFFER_OVERFLOW : RC_DDNS_RSP_NOHOST;
+		goto cleanup;
 	}
 	logit(LOG_DEBUG, "ID value: %s", dest);
 
@@ -291,64 +319,387 @@ static const char* get_record_type(const char *address)
 	return IPV4_RECORD_TYPE;
 }
 
+static unsigned int bucket(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + tolower((unsigned char)*name++);
+
+	return hash % NUM_BUCKETS;
+}
+
+static struct cfdata *find_data(const char *name)
+{
+	struct cfdata *data;
+
+	LIST_FOREACH(data, &cfdata_hash[bucket(name)], link) {
+		if (!strcmp(data->name, name))
+			return data;
+	}
+
+	return NULL;
+}
+
+static void save_data(struct cfdata *data)
+{
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "%s %s %s", data->type, data->zone_id, data->hostname_id);
+	write_cache_data(data->name, CACHE_EXT, buf);
+}
+
+static void forget_data(struct cfdata *data)
+{
+	data->type[0] = 0;
+	data->zone_id[0] = 0;
+	data->hostname_id[0] = 0;
+	remove_cache_data(data->name, CACHE_EXT);
+}
+
+/* Ids from a previous run are in the cache dir: TYPE ZONE_ID RECORD_ID */
+static struct cfdata *get_data(const char *name)
+{
+	struct cfdata *data;
+	char buf[128];
+
+	data = find_data(name);
+	if (data)
+		return data;
+
+	data = calloc(1, sizeof(*data));
+	if (!data)
+		return NULL;
+
+	strlcpy(data->name, name, sizeof(data->name));
+	if (!read_cache_data(name, CACHE_EXT, buf, sizeof(buf)) &&
+	    sscanf(buf, "%4s %32s %32s", data->type, data->zone_id, data->hostname_id) != 3)
+		forget_data(data);
+	LIST_INSERT_HEAD(&cfdata_hash[bucket(name)], data, link);
+
+	return data;
+}
+
+static struct cfrecord *find_record(struct cfzone *zone, const char *name, const char *type)
+{
+	struct cfrecord *rec;
+
+	LIST_FOREACH(rec, &zone->records[bucket(name)], link) {
+		if (!strcasecmp(rec->name, name) && !strcmp(rec->type, type))
+			return rec;
+	}
+
+	return NULL;
+}
+
+static int add_record(struct cfzone *zone, const char *name, const char *type,
+		      const char *id, const char *content)
+{
+	struct cfrecord *rec;
+
+	rec = find_record(zone, name, type);
+	if (!rec) {
+		size_t len = strlen(name) + 1;
+
+		rec = calloc(1, sizeof(*rec) + len);
+		if (!rec)
+			return -1;
+
+		memcpy(rec->name, name, len);
+		strlcpy(rec->type, type, sizeof(rec->type));
+		LIST_INSERT_HEAD(&zone->records[bucket(name)], rec, link);
+	}
+
+	strlcpy(rec->id, id, sizeof(rec->id));
+	strlcpy(rec->content, content, sizeof(rec->content));
+
+	return 0;
+}
+
+static void flush_records(struct cfzone *zone)
+{
+	struct cfrecord *rec, *tmp;
+	int i;
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		LIST_FOREACH_SAFE(rec, &zone->records[i], link, tmp) {
+			LIST_REMOVE(rec, link);
+			free(rec);
+		}
+	}
+	zone->listed = 0;
+}
+
+static struct cfzone *find_zone(const char *name, const char *id)
+{
+	struct cfzone *zone;
+
+	LIST_FOREACH(zone, &cfzone_list, link) {
+		if (name && !strcasecmp(zone->name, name))
+			return zone;
+		if (id && id[0] && !strcmp(zone->id, id))
+			return zone;
+	}
+
+	return NULL;
+}
+
+static struct cfzone *get_zone_data(const char *name)
+{
+	struct cfzone *zone;
+
+	zone = find_zone(name, NULL);
+	if (zone)
+		return zone;
+
+	zone = calloc(1, sizeof(*zone));
+	if (!zone)
+		return NULL;
+
+	strlcpy(zone->name, name, sizeof(zone->name));
+	LIST_INSERT_HEAD(&cfzone_list, zone, link);
+
+	return zone;
+}
+
+/* Zone lookup is needed again, e.g., after a 404 or a failed create */
+static void stale_zone(const char *zone_id)
+{
+	struct cfzone *zone;
+
+	zone = find_zone(NULL, zone_id);
+	if (zone)
+		flush_records(zone);
+}
+
+/*
+ * Hostnames in the zone, of this conf entry, without a record id yet.
+ * Only ids already loaded are checked, hostnames not yet set up are
+ * counted as pending rather than reading their cache file here.
+ */
+static long num_pending(const ddns_info_t *info, const char *zone_name, const char *hostname)
+{
+	char name[MAX_NAME];
+	struct cfdata *data;
+	long num = 0;
+	size_t i;
+
+	for (i = 0; i < info->alias_count; i++) {
+		get_zone(name, sizeof(name), info->alias[i].name);
+		if (strcasecmp(name, zone_name))
+			continue;
+
+		data = find_data(info->alias[i].name);
+		if (!strcmp(info->alias[i].name, hostname) || !data || !data->hostname_id[0])
+			num++;
+	}
+
+	return num;
+}
+
+static int get_string(const jsmntok_t *obj, const char *key, char *dest, size_t len)
+{
+	jsmntok_t *tok;
+
+	tok = json_get(&doc, obj, key);
+	if (!tok || tok->type != JSMN_STRING)
+		return -1;
+
+	return json_copy(doc.js, tok, dest, len);
+}
+
+/*
+ * Index all A and AAAA records of a zone, one page at a time.  Zones
+ * with more pages than the hostnames we need to look up are cheaper
+ * to query one hostname at a time, the index is then left unused.
+ */
+static int list_records(ddns_t *ctx, const ddns_info_t *info, struct cfzone *zone, long max_pages)
+{
+	char type[5], id[MAX_ID], name[SERVER_NAME_LEN], content[MAX_ADDRESS_LEN];
+	jsmntok_t *result, *rec, *tok;
+	long page = 1, pages = 1;
+	int rc = RC_OK, num = 0;
+	size_t len;
+	char *buf;
+
+	buf = malloc(LIST_BUF_SIZE);
+	if (!buf)
+		return RC_OUT_OF_MEMORY;
+
+	flush_records(zone);
+	while (page <= pages) {
+		len = snprintf(ctx->request_buf, ctx->request_buflen,
+			       CLOUDFLARE_LIST_REQUEST,
+			       zone->id,
+			       LIST_PER_PAGE,
+			       (int)page,
+			       info->user_agent,
+			       info->creds.password);
+		if (len >= ctx->request_buflen) {
+			rc = RC_BUFFER_OVERFLOW;
+			break;
+		}
+
+		rc = api_get(info, "Zone listing", ctx->request_buf, len, buf, LIST_BUF_SIZE);
+		if (rc)
+			break;
+
+		result = json_get(&doc, NULL, "result");
+		if (!result || result->type != JSMN_ARRAY) {
+			rc = RC_DDNS_RSP_NOTOK;
+			break;
+		}
+
+		for (rec = json_first(&doc, result); rec; rec = json_next(&doc, rec)) {
+			if (get_string(rec, "type", type, sizeof(type)) ||
+			    (strcmp(type, IPV4_RECORD_TYPE) && strcmp(type, IPV6_RECORD_TYPE)))
+				continue;
+
+			if (get_string(rec, "name", name, sizeof(name)) ||
+			    get_string(rec, "id", id, sizeof(id)) ||
+			    get_string(rec, "content", content, sizeof(content)))
+				continue;
+
+			if (add_record(zone, name, type, id, content)) {
+				rc = RC_OUT_OF_MEMORY;
+				break;
+			}
+			num++;
+		}
+		if (rc)
+			break;
+
+		/* Without total_pages, a full page means there may be more */
+		tok = json_get(&doc, NULL, "result_info.total_pages");
+		if (!tok || json_long(doc.js, tok, &pages))
+			pages = result->size >= LIST_PER_PAGE ? page + 1 : page;
+
+		if (page == 1 && pages > max_pages) {
+			logit(LOG_DEBUG, "Cloudflare Zone: '%s' has %ld pages of records, "
+			      "looking up hostnames one by one.", zone->name, pages);
+			flush_records(zone);
+			zone->listed = -1;
+			goto done;
+		}
+		page++;
+	}
+
+	if (rc) {
+		logit(LOG_WARNING, "Failed listing records of zone '%s', "
+		      "looking up hostnames one by one.", zone->name);
+		flush_records(zone);
+		zone->listed = -1;
+	} else {
+		logit(LOG_DEBUG, "Cloudflare Zone: '%s' %d A/AAAA records listed in %ld requests",
+		      zone->name, num, pages);
+		zone->listed = 1;
+		zone->check = ctx->check;
+	}
+done:
+	free(buf);
+
+	return rc;
+}
+
 static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *hostname)
 {
 	const char *record_type;
+	struct cfrecord *rec;
 	struct cfdata *data;
+	struct cfzone *zone;
 	size_t len;
 	char zone_name[MAX_NAME];
+	char content[MAX_ADDRESS_LEN] = "";
 	int rc = RC_OK;
 
-	data = calloc(1, sizeof(struct cfdata));
+	data = get_data(hostname->name);
 	if (!data)
 		return RC_OUT_OF_MEMORY;
 
-	if (info->data)
-		free(info->data);
-	info->data = data;
-
-	get_zone(zone_name, sizeof(zone_name), hostname->name);
 	record_type = get_record_type(hostname->address);
+	if (data->zone_id[0] && data->hostname_id[0] && !strcmp(data->type, record_type)) {
+		logit(LOG_DEBUG, "Cloudflare Host: '%s' Id: %s (cached)", hostname->name, data->hostname_id);
+		return 0;
+	}
 
+	get_zone(zone_name, sizeof(zone_name), hostname->name);
 	logit(LOG_DEBUG, "User: %s Zone: %s", info->creds.username, zone_name);
 
-	len = snprintf(ctx->request_buf, ctx->request_buflen,
-		       CLOUDFLARE_ZONE_ID_REQUEST,
-		       zone_name,
-		       info->user_agent,
-		       info->creds.password);
+	zone = get_zone_data(zone_name);
+	if (!zone)
+		return RC_OUT_OF_MEMORY;
 
-	if (len >= ctx->request_buflen) {
-		logit(LOG_ERR, "Request for zone '%s' did not fit into buffer.", zone_name);
-		return RC_BUFFER_OVERFLOW;
-	}
+	if (!zone->id[0] && data->zone_id[0])
+		strlcpy(zone->id, data->zone_id, sizeof(zone->id));
 
-	rc = get_id(data->zone_id, MAX_ID, info, ctx->request_buf, len);
-	if (rc != RC_OK) {
-		logit(LOG_ERR, "Zone '%s' not found.", zone_name);
-		return rc;
+	if (!zone->id[0]) {
+		len = snprintf(ctx->request_buf, ctx->request_buflen,
+			       CLOUDFLARE_ZONE_ID_REQUEST,
+			       zone_name,
+			       info->user_agent,
+			       info->creds.password);
+
+		if (len >= ctx->request_buflen) {
+			logit(LOG_ERR, "Request for zone '%s' did not fit into buffer.", zone_name);
+			return RC_BUFFER_OVERFLOW;
+		}
+
+		rc = get_id(zone->id, MAX_ID, info, ctx->request_buf, len);
+		if (rc != RC_OK) {
+			logit(LOG_ERR, "Zone '%s' not found.", zone_name);
+			zone->id[0] = 0;
+			return rc;
+		}
 	}
-	
-	logit(LOG_DEBUG, "Cloudflare Zone: '%s' Id: %s", zone_name, data->zone_id);
-
-	len = snprintf(ctx->request_buf, ctx->request_buflen,
-		       CLOUDFLARE_HOSTNAME_ID_REQUEST,
-		       data->zone_id,
-		       record_type,
-		       hostname->name,
-		       info->user_agent,
-		       info->creds.password);
-	if (len >= ctx->request_buflen) {
-		logit(LOG_ERR, "Request for zone '%s', id %s did not fit into buffer.",
-		      zone_name, data->zone_id);
-		return RC_BUFFER_OVERFLOW;
+
+	logit(LOG_DEBUG, "Cloudflare Zone: '%s' Id: %s", zone_name, zone->id);
+	strlcpy(data->zone_id, zone->id, sizeof(data->zone_id));
+	strlcpy(data->type, record_type, sizeof(data->type));
+
+	if (!zone->listed)
+		list_records(ctx, info, zone, num_pending(info, zone_name, hostname->name));
+
+	if (zone->listed == 1) {
+		rec = find_record(zone, hostname->name, record_type);
+		if (rec) {
+			strlcpy(data->hostname_id, rec->id, sizeof(data->hostname_id));
+			if (zone->check == ctx->check)
+				strlcpy(content, rec->content, sizeof(content));
+		} else
+			rc = RC_DDNS_RSP_NOHOST;
+	} else {
+		len = snprintf(ctx->request_buf, ctx->request_buflen,
+			       CLOUDFLARE_HOSTNAME_ID_REQUEST,
+			       zone->id,
+			       record_type,
+			       hostname->name,
+			       info->user_agent,
+			       info->creds.password);
+		if (len >= ctx->request_buflen) {
+			logit(LOG_ERR, "Request for zone '%s', id %s did not fit into buffer.",
+			      zone_name, zone->id);
+			return RC_BUFFER_OVERFLOW;
+		}
+
+		rc = get_id(data->hostname_id, MAX_ID, info, ctx->request_buf, len);
+		if (rc == RC_OK && get_result_value("content", content, sizeof(content)))
+			content[0] = 0;
 	}
 
-	rc = get_id(data->hostname_id, MAX_ID, info, ctx->request_buf, ctx->request_buflen);
-	if (rc == RC_OK)
+	if (rc == RC_OK) {
 		logit(LOG_DEBUG, "Cloudflare Host: '%s' Id: %s", hostname->name, data->hostname_id);
-	else
-		logit(LOG_INFO, "Hostname '%s' not found.", hostname->name);
+		save_data(data);
+		if (same_address(content, hostname->address))
+			rc = RC_DDNS_RSP_UNCHANGED;
+	} else if (rc == RC_DDNS_RSP_NOHOST) {
+		logit(LOG_INFO, "Hostname '%s' not found, creating it.", hostname->name);
+		data->hostname_id[0] = 0;
+		rc = RC_OK;
+	} else {
+		forget_data(data);
+		flush_records(zone);
+		zone->id[0] = 0;
+	}
 
 	return rc;
 }
@@ -356,10 +707,14 @@ static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *hostname)
 static int request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *hostname)
 {
 	const char *record_type;
-	struct cfdata *data = (struct cfdata *)info->data;
+	struct cfdata *data;
 	size_t content_len;
 	char json_data[256];
 
+	data = find_data(hostname->name);
+	if (!data)
+		return -1;
+
 	record_type = get_record_type(hostname->address);
 	content_len = snprintf(json_data, sizeof(json_data),
 			       CLOUDFLARE_UPDATE_JSON_FORMAT,
@@ -367,7 +722,7 @@ static int request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *hostname)
 			       hostname->name,
 			       hostname->address);
 
-	if (strlen(data->hostname_id) == 0)
+	if (!data->hostname_id[0])
 		return snprintf(ctx->request_buf, ctx->request_buflen,
 			CLOUDFLARE_HOSTNAME_CREATE_REQUEST,
 			data->zone_id,
@@ -386,14 +741,45 @@ static int request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *hostname)
 
 static int response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *hostname)
 {
+	struct cfdata *data;
+	struct cfzone *zone;
+	jsmntok_t *tok;
 	int rc;
 
 	(void)info;
-	(void)hostname;
+
+	data = find_data(hostname->name);
+	if (!data)
+		return RC_DDNS_RSP_NOTOK;
+
+	if (trans->status == 404) {
+		logit(LOG_WARNING, "HTTP 404: Record for '%s' is gone, looking it up again.", hostname->name);
+		stale_zone(data->zone_id);
+		forget_data(data);
+		return RC_DDNS_RSP_RETRY_LATER;
+	}
 
 	rc = check_response_code(trans->status);
-	if (rc == RC_OK && check_success_only(trans->rsp_body) < 0)
+	if (rc == RC_OK && (json_parse(&doc, trans->rsp_body) < 0 || check_success(&doc) < 0))
 		rc = RC_DDNS_RSP_NOTOK;
+	if (rc) {
+		/* Possibly created behind our back, list the zone again */
+		if (!data->hostname_id[0])
+			stale_zone(data->zone_id);
+		return rc;
+	}
+
+	/* New record created, remember its id */
+	if (!data->hostname_id[0]) {
+		tok = json_get(&doc, NULL, "result.id");
+		if (tok && tok->type == JSMN_STRING &&
+		    !json_copy(doc.js, tok, data->hostname_id, sizeof(data->hostname_id)))
+			save_data(data);
+	}
+
+	zone = find_zone(NULL, data->zone_id);
+	if (zone && zone->listed == 1 && data->hostname_id[0])
+		add_record(zone, hostname->name, data->type, data->hostname_id, hostname->address);
 
 	return rc;
 }
@@ -405,7 +791,25 @@ PLUGIN_INIT(plugin_init)
 
 PLUGIN_EXIT(plugin_exit)
 {
+	struct cfdata *data, *tmp;
+	struct cfzone *zone, *next;
+	int i;
+
 	plugin_unregister(&plugin);
+	json_free(&doc);
+
+	LIST_FOREACH_SAFE(zone, &cfzone_list, link, next) {
+		flush_records(zone);
+		LIST_REMOVE(zone, link);
+		free(zone);
+	}
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		LIST_FOREACH_SAFE(data, &cfdata_hash[i], link, tmp) {
+			LIST_REMOVE(data, link);
+			free(data);
+		}
+	}
 }
 
 /**
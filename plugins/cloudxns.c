@@ -24,11 +24,12 @@
 
 #include "md5.h"
 #include "plugin.h"
+#include "json.h"
 
 /* cloudxns.net specific update request format */
 #define CLOUDXNS_UPDATE_IP_REQUEST		\
 	"PUT %s/%u "				\
-	"HTTP/1.0\r\n"				\
+	"HTTP/1.1\r\n"				\
 	"Host: %s\r\n"				\
 	"User-Agent: %s\r\n"			\
 	"API-KEY: %s\r\n"			\
@@ -37,7 +38,7 @@
 	"Content-Length: %zu\r\n\r\n"		\
 	"%s"
 #define CLOUDXNS_GET_REQUEST			\
-	"GET %s HTTP/1.0\r\n"			\
+	"GET %s HTTP/1.1\r\n"			\
 	"Host: %s\r\n"				\
 	"User-Agent: %s\r\n"			\
 	"API-KEY: %s\r\n"			\
@@ -84,6 +85,24 @@ static ddns_system_t plugin = {
 	.server_url   = "/api2/record"
 };
 
+/* Token arena, reused for every response */
+static json_t doc;
+
+/* List of domains or records, in "data" */
+static jsmntok_t *get_data(const char *response)
+{
+	jsmntok_t *data;
+
+	if (json_parse(&doc, response) < 0)
+		return NULL;
+
+	data = json_get(&doc, NULL, "data");
+	if (!data || data->type != JSMN_ARRAY)
+		return NULL;
+
+	return data;
+}
+
 /* http://stackoverflow.com/a/744822 TODO: Move to a separate file */
 static int string_endswith(const char *str, const char *suffix)
 {
@@ -158,6 +177,7 @@ static int http_send(struct http *http, char *msg, char *fmt, ...)
 
 	http_set_port(&client, info->server_name.port);
 	http_set_remote_name(&client, info->server_name.name);
+	http_set_remote_timeout(&client, info->timeout * 1000);
 	client.ssl_enabled = info->ssl_enabled;
 
 	rc = http_init(&client, msg);
@@ -186,7 +206,8 @@ static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 	struct cx    *cx;
 	char          str[MD5_DIGEST_BYTES * 2 + 1];
 	char          buffer[256], domain[256], prefix[SERVER_NAME_LEN];
-	char          *tmp, *item;
+	char          value[MAX_ADDRESS_LEN];
+	jsmntok_t    *data, *item, *tok;
 	size_t        hostlen, domainlen;
 	int           rc = 0;
 
@@ -226,24 +247,25 @@ static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 	 *    }]
 	 * }
 	 */
-	tmp = strchr(http.response, '[');
-	if (!tmp) {
+	data = get_data(http.response);
+	if (!data) {
 		rc = RC_DDNS_INVALID_OPTION;
 		goto err;
 	}
 
-	for (item = tmp; item; item = strstr(item, ",{")) {
-		unsigned int id;
-		int num;
-
-		item++;
-		num = sscanf(item, "{\"id\":\"%u\",\"domain\":\"%255[^\"]", &id, domain);
-		if (num == 2 && *domain) {
-			domain[strlen(domain) - 1] = 0;  /* Remove trailing dot */
-			if (string_endswith(alias->name, domain)) {
-				cx->domain_id = id;
-				break;
-			}
+	for (item = json_first(&doc, data); item; item = json_next(&doc, item)) {
+		jsmntok_t *name, *id;
+		long val;
+
+		name = json_get(&doc, item, "domain");
+		id   = json_get(&doc, item, "id");
+		if (!name || !id || json_copy(doc.js, name, domain, sizeof(domain)) || !*domain)
+			continue;
+
+		domain[strlen(domain) - 1] = 0;  /* Remove trailing dot */
+		if (string_endswith(alias->name, domain) && !json_long(doc.js, id, &val)) {
+			cx->domain_id = val;
+			break;
 		}
 	}
 
@@ -270,8 +292,8 @@ static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 		goto err;
 	}
 
-	tmp = strchr(http.response, '[');
-	if (!tmp) {
+	data = get_data(http.response);
+	if (!data) {
 		rc = RC_DDNS_INVALID_OPTION;
 		goto err;
 	}
@@ -284,22 +306,25 @@ static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 	} else {
 		size_t num = hostlen - domainlen - 1;
 
-		if (num <= sizeof(prefix))
-			strlcpy(prefix, alias->name, num);
+		if (num >= sizeof(prefix)) {
+			rc = RC_BUFFER_OVERFLOW;
+			goto err;
+		}
+		strlcpy(prefix, alias->name, num + 1);
 	}
 	
-	for (item = tmp; item; item = strstr(item, ",{")) {
-		unsigned int id;
-		char _prefix[64];
-		int num;
-
-		item++;
-		num = sscanf(item, "{\"record_id\":\"%u\",\"host_id\":\"%*d\",\"host\":\"%63[^\"]", &id, _prefix);
-		if (num == 2 && *_prefix) {
-			if (string_compare(prefix, _prefix)) {
-				cx->record_id = id;
-				break;
-			}
+	for (item = json_first(&doc, data); item; item = json_next(&doc, item)) {
+		jsmntok_t *host, *id;
+		long val;
+
+		host = json_get(&doc, item, "host");
+		id   = json_get(&doc, item, "record_id");
+		if (!host || !id || jsoneq(doc.js, host, prefix))
+			continue;
+
+		if (!json_long(doc.js, id, &val)) {
+			cx->record_id = val;
+			break;
 		}
 	}
 
@@ -310,6 +335,10 @@ static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 	}
 	logit(LOG_DEBUG, "CloudXNS Record: '%s' ID: %u", prefix, cx->record_id);
 
+	tok = json_get(&doc, item, "value");
+	if (tok && !json_copy(doc.js, tok, value, sizeof(value)) && same_address(value, alias->address))
+		return RC_DDNS_RSP_UNCHANGED;
+
 	cx->len = snprintf(cx->body, sizeof(cx->body),
 			   CLOUDXNS_UPDATE_PARAM_BODY,
 			   cx->domain_id, prefix, alias->address);
@@ -357,16 +386,20 @@ static int request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
  *   }
  * }
  *
- * We search our own IP address in response and that's enough.
+ * The record should now have our address.
  */
 static int response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias)
 {
-	char *resp = trans->rsp_body;
+	jsmntok_t *tok;
 
 	(void)info;
 	DO(http_status_valid(trans->status));
 
-	if (strstr(resp, alias->address))
+	if (json_parse(&doc, trans->rsp_body) < 0)
+		return RC_DDNS_RSP_NOTOK;
+
+	tok = json_get(&doc, NULL, "data.value");
+	if (tok && !jsoneq(doc.js, tok, alias->address))
 		return 0;
 
 	return RC_DDNS_RSP_NOTOK;
@@ -380,6 +413,7 @@ PLUGIN_INIT(plugin_init)
 PLUGIN_EXIT(plugin_exit)
 {
 	plugin_unregister(&plugin);
+	json_free(&doc);
 }
 
 /**
@@ -34,7 +34,7 @@
 	"hostname=%s&"							\
 	"myip=%s"							\
 	"%s "      							\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"Authorization: Basic %s\r\n"					\
 	"User-Agent: %s\r\n\r\n"
@@ -60,19 +60,9 @@ int common_request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 			info->user_agent);
 }
 
-/*
- * DynDNS response validator -- common to many other DDNS providers as well
- *  'good' or 'nochg' are the good answers,
- */
-int common_response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias)
+/* Result of one hostname, 'good' or 'nochg' are the good answers */
+static int common_result(const char *body)
 {
-	char *body = trans->rsp_body;
-
-	(void)info;
-	(void)alias;
-
-	DO(http_status_valid(trans->status));
-
 	if (strstr(body, "good") || strstr(body, "nochg"))
 		return 0;
 
@@ -89,6 +79,101 @@ int common_response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias)
 	return RC_DDNS_RSP_NOTOK;
 }
 
+/*
+ * DynDNS response validator -- common to many other DDNS providers as well
+ *  'good' or 'nochg' are the good answers,
+ */
+int common_response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias)
+{
+	(void)info;
+	(void)alias;
+
+	DO(http_status_valid(trans->status));
+
+	return common_result(trans->rsp_body);
+}
+
+/*
+ * DynDNS batch request composer, the dyndns2 protocol takes a comma
+ * separated list of hostnames, all updated to the same address.
+ */
+int common_batch_request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t **alias, size_t num)
+{
+	char wildcard[20] = "";
+	char *hostnames;
+	size_t i, len = 0;
+	int rc;
+
+	for (i = 0; i < num; i++)
+		len += strlen(alias[i]->name) + 1;
+
+	hostnames = calloc(1, len);
+	if (!hostnames)
+		return -1;
+
+	for (i = 0; i < num; i++) {
+		if (i)
+			strlcat(hostnames, ",", len);
+		strlcat(hostnames, alias[i]->name, len);
+	}
+
+	if (info->wildcard)
+		strlcpy(wildcard, "&wildcard=ON", sizeof(wildcard));
+
+	rc = snprintf(ctx->request_buf, ctx->request_buflen,
+		      DYNDNS_UPDATE_IP_HTTP_REQUEST,
+		      info->server_url,
+		      hostnames,
+		      alias[0]->address,
+		      wildcard,
+		      info->server_name.name,
+		      info->creds.encoded_password,
+		      info->user_agent);
+	free(hostnames);
+
+	return rc;
+}
+
+/*
+ * DynDNS batch response validator, one result line per hostname, in
+ * the order of the request.  Errors concerning all of them, e.g.
+ * 'badauth', are only sent once.  The result of each hostname is
+ * stored in @result.
+ */
+int common_batch_response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t **alias, size_t num, int *result)
+{
+	char *body, *line, *ptr = NULL;
+	size_t i = 0;
+	int rc;
+
+	(void)info;
+	(void)alias;
+
+	rc = http_status_valid(trans->status);
+	if (rc)
+		goto done;
+
+	body = strdup(trans->rsp_body);
+	if (!body) {
+		rc = RC_OUT_OF_MEMORY;
+		goto done;
+	}
+
+	for (line = strtok_r(body, "\r\n", &ptr); line && i < num; line = strtok_r(NULL, "\r\n", &ptr))
+		result[i++] = common_result(line);
+	free(body);
+
+	if (i == 1)
+		rc = result[0];
+	else
+		rc = RC_DDNS_RSP_NOTOK;
+done:
+	while (i < num)
+		result[i++] = rc;
+
+	return 0;
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
@@ -27,7 +27,7 @@
 	"pwd=%s&"							\
 	"host=%s"							\
 	" "								\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n\r\n"
 
@@ -32,7 +32,7 @@
 	"password=%s&"							\
 	"ipaddr=%s&"							\
 	"updatetimeout=0 "						\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n\r\n"
 
@@ -19,11 +19,15 @@
  * Boston, MA  02110-1301, USA.
  */
 
+#include <ctype.h>
+#include <strings.h>
+
 #include "plugin.h"
+#include "json.h"
 
 /* dnspod.cn specific update request format */
 #define DNSPOD_API_REQUEST						\
-	"POST /%s HTTP/1.0\r\n"						\
+	"POST /%s HTTP/1.1\r\n"						\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n"						\
 	"Content-Length: %zu\r\n"					\
@@ -49,41 +53,130 @@ static ddns_system_t plugin = {
 	.server_url   = ""
 };
 
-static int fetch_record_id(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias, char *domain, char *prefix)
+/* Token arena, reused for every response */
+static json_t doc;
+
+/*
+ * Record id of each hostname.  One Record.List of the domain fills in
+ * the ids of all hostnames in it, kept until an update fails.  Hashed
+ * by name, every listed record is looked up.
+ */
+#define LIST_LENGTH   300
+#define LIST_BUF_SIZE 131072
+#define NUM_BUCKETS   64
+
+struct dprecord {
+	LIST_ENTRY(dprecord) link;
+
+	char name[SERVER_NAME_LEN];
+	char type[5];			/* Record type of id */
+	long id;
+	char value[MAX_ADDRESS_LEN];	/* As listed, checked once by setup() */
+	unsigned int check;		/* ctx->check when listed, for value */
+};
+
+static LIST_HEAD(, dprecord) dprecords[NUM_BUCKETS];
+
+static const char *get_type(const char *address)
+{
+	return strchr(address, ':') ? "AAAA" : "A";
+}
+
+/* www.example.com => example.com and www, example.com => example.com and @ */
+static int split_name(const char *name, char *domain, char *prefix, size_t len)
+{
+	const char *tmp;
+
+	tmp = strchr(name, '.');
+	if (!tmp)
+		return -1;
+
+	if (tmp[1] != 0 && strchr(tmp + 1, '.') != NULL) {
+		if ((size_t)(tmp - name) >= len)
+			return -1;
+		strlcpy(domain, tmp + 1, len);
+		strlcpy(prefix, name, tmp - name + 1);
+	} else {
+		strlcpy(domain, name, len);
+		strlcpy(prefix, "@", len);
+	}
+
+	return 0;
+}
+
+static unsigned int bucket(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + tolower((unsigned char)*name++);
+
+	return hash % NUM_BUCKETS;
+}
+
+static struct dprecord *find_record(const char *name)
+{
+	struct dprecord *rec;
+
+	LIST_FOREACH(rec, &dprecords[bucket(name)], link) {
+		if (!strcasecmp(rec->name, name))
+			return rec;
+	}
+
+	return NULL;
+}
+
+static struct dprecord *get_record(const char *name)
+{
+	struct dprecord *rec;
+
+	rec = find_record(name);
+	if (rec)
+		return rec;
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return NULL;
+
+	strlcpy(rec->name, name, sizeof(rec->name));
+	LIST_INSERT_HEAD(&dprecords[bucket(name)], rec, link);
+
+	return rec;
+}
+
+static int list_page(ddns_t *ctx, ddns_info_t *info, const char *domain, long offset,
+		     char *buf, size_t len)
 {
 	http_trans_t trans;
 	http_t client;
-	char *tmp;
 	char buffer[256];
-	int record_id = 0;
-	int rc, len;
-
-	(void)alias;
+	int rc, n;
 
 	/* login_token=API_ID,API_TOKEN */
-	len = snprintf(buffer, sizeof(buffer),
-		       "login_token=%s%%2C%s&format=json&domain=%s&length=1&sub_domain=%s",
-		       info->creds.username, info->creds.password, domain, prefix);
-	if (len >= (int)sizeof(buffer))
-		return -RC_BUFFER_OVERFLOW;
+	n = snprintf(buffer, sizeof(buffer),
+		     "login_token=%s%%2C%s&format=json&domain=%s&offset=%ld&length=%d",
+		     info->creds.username, info->creds.password, domain, offset, LIST_LENGTH);
+	if (n >= (int)sizeof(buffer))
+		return RC_BUFFER_OVERFLOW;
 
 	trans.req_len     = snprintf(ctx->request_buf, ctx->request_buflen, DNSPOD_API_REQUEST, "Record.List",
 				     info->server_name.name, info->user_agent, strlen(buffer), buffer);
 	trans.req         = ctx->request_buf;
-	trans.rsp         = ctx->work_buf;
-	trans.max_rsp_len = ctx->work_buflen - 1; /* Save place for a \0 at the end */
+	trans.rsp         = buf;
+	trans.max_rsp_len = len - 1; /* Save place for a \0 at the end */
 
 	rc = http_construct(&client);
 	if (rc)
-		return -rc;
+		return rc;
 
 	http_set_port(&client, info->server_name.port);
 	http_set_remote_name(&client, info->server_name.name);
+	http_set_remote_timeout(&client, info->timeout * 1000);
 	client.ssl_enabled = info->ssl_enabled;
 
 	rc = http_init(&client, "Sending record list query");
 	if (rc)
-		return -rc;
+		return rc;
 
 	rc = http_transaction(&client, &trans);
 	logit(LOG_DEBUG, "=> %s", trans.rsp_body);
@@ -92,50 +185,148 @@ static int fetch_record_id(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias,
 
 	if (rc || (rc = http_status_valid(trans.status))) {
 		logit(LOG_WARNING, "Failed fetching record ID, rc: %d", rc);
-		return -rc;
+		return rc;
 	}
 
-	/*
-	 * Example: with added whitespace and line breaks for clarity
-	 *{
-	 *    "status": {"code": "1", "message": "Action completed successful", "created_at": "2017-06-28 14:36:28"},
-	 *    "domain": {
-	 *        "id": "59753949",
-	 *        "name": "example.org",
-	 *        "punycode": "example.org",
-	 *        "grade": "DP_Free",
-	 *        "owner": "example@example.org",
-	 *        "ext_status": "dnserror",
-	 *        "ttl": 600,
-	 *        "min_ttl": 600,
-	 *        "dnspod_ns": ["f1g1ns1.dnspod.net", "f1g1ns2.dnspod.net"],
-	 *        "status": "enable"
-	 *    },
-	 *    "info": {"sub_domains": "3", "record_total": "3"},
-	 *    "records": [{
-	 *        "id": "306419640",
-	 *        "ttl": "600",
-	 *        "value": "1.2.3.4",
-	 *        "enabled": "1",
-	 *        "status": "enabled",
-	 *        "updated_on": "2017-06-28 12:28:01",
-	 *        "name": "@",
-	 *        "line": "\u9ed8\u8ba4",
-	 *        "line_id": "0",
-	 *        "type": "A",
-	 *        "weight": null,
-	 *        "monitor_status": "",
-	 *        "remark": "",
-	 *        "use_aqb": "no",
-	 *        "mx": "0"
-	 *    }]
-	 *}
-	 */
-	tmp = strstr(trans.rsp_body, "[{");
-	if (tmp && 1 == sscanf(tmp, "[{\"id\":\"%d\"", &record_id))
-		return record_id;
+	if (json_parse(&doc, trans.rsp_body) < 0)
+		return RC_DDNS_INVALID_OPTION;
 
-	return -RC_DDNS_INVALID_OPTION;
+	return 0;
+}
+
+/*
+ * Example: with added whitespace and line breaks for clarity
+ *{
+ *    "status": {"code": "1", "message": "Action completed successful", "created_at": "2017-06-28 14:36:28"},
+ *    "domain": {
+ *        "id": "59753949",
+ *        "name": "example.org",
+ *        "punycode": "example.org",
+ *        "grade": "DP_Free",
+ *        "owner": "example@example.org",
+ *        "ext_status": "dnserror",
+ *        "ttl": 600,
+ *        "min_ttl": 600,
+ *        "dnspod_ns": ["f1g1ns1.dnspod.net", "f1g1ns2.dnspod.net"],
+ *        "status": "enable"
+ *    },
+ *    "info": {"sub_domains": "3", "record_total": "3"},
+ *    "records": [{
+ *        "id": "306419640",
+ *        "ttl": "600",
+ *        "value": "1.2.3.4",
+ *        "enabled": "1",
+ *        "status": "enabled",
+ *        "updated_on": "2017-06-28 12:28:01",
+ *        "name": "@",
+ *        "line": "\u9ed8\u8ba4",
+ *        "line_id": "0",
+ *        "type": "A",
+ *        "weight": null,
+ *        "monitor_status": "",
+ *        "remark": "",
+ *        "use_aqb": "no",
+ *        "mx": "0"
+ *    }]
+ *}
+ */
+static int list_records(ddns_t *ctx, ddns_info_t *info, const char *domain)
+{
+	char name[SERVER_NAME_LEN], prefix[SERVER_NAME_LEN], type[5];
+	jsmntok_t *records, *item, *tok;
+	struct dprecord *rec;
+	long offset = 0, total = 0;
+	size_t i;
+	char *buf;
+	int rc = 0, num = 0;
+
+	/* Ids of all hostnames in the domain are found again below */
+	for (i = 0; i < info->alias_count; i++) {
+		ddns_alias_t *alias = &info->alias[i];
+
+		if (split_name(alias->name, name, prefix, sizeof(name)) || strcasecmp(name, domain))
+			continue;
+
+		rec = get_record(alias->name);
+		if (!rec)
+			return RC_OUT_OF_MEMORY;
+
+		rec->id = 0;
+		rec->value[0] = 0;
+		strlcpy(rec->type, get_type(alias->address), sizeof(rec->type));
+	}
+
+	buf = malloc(LIST_BUF_SIZE);
+	if (!buf)
+		return RC_OUT_OF_MEMORY;
+
+	do {
+		rc = list_page(ctx, info, domain, offset, buf, LIST_BUF_SIZE);
+		if (rc)
+			break;
+
+		/* Code 10 is an empty records list */
+		tok = json_get(&doc, NULL, "status.code");
+		if (tok && !jsoneq(doc.js, tok, "10"))
+			break;
+		if (!tok || jsoneq(doc.js, tok, "1")) {
+			tok = json_get(&doc, NULL, "status.message");
+			if (tok && tok->type == JSMN_STRING)
+				logit(LOG_WARNING, "DNSPod: %.*s", tok->end - tok->start, doc.js + tok->start);
+			rc = RC_DDNS_RSP_NOTOK;
+			break;
+		}
+
+		records = json_get(&doc, NULL, "records");
+		if (!records || records->type != JSMN_ARRAY) {
+			rc = RC_DDNS_INVALID_OPTION;
+			break;
+		}
+
+		num = 0;
+		for (item = json_first(&doc, records); item; item = json_next(&doc, item)) {
+			jsmntok_t *id;
+			long val;
+
+			num++;
+			tok = json_get(&doc, item, "name");
+			if (!tok || json_copy(doc.js, tok, prefix, sizeof(prefix)))
+				continue;
+
+			if (!strcmp(prefix, "@"))
+				strlcpy(name, domain, sizeof(name));
+			else if (snprintf(name, sizeof(name), "%s.%s", prefix, domain) >= (int)sizeof(name))
+				continue;	/* Too long to be one of ours */
+
+			/* First record of the type, like Record.List of a sub_domain */
+			rec = find_record(name);
+			if (!rec || rec->id)
+				continue;
+
+			tok = json_get(&doc, item, "type");
+			if (!tok || json_copy(doc.js, tok, type, sizeof(type)) || strcmp(type, rec->type))
+				continue;
+
+			id = json_get(&doc, item, "id");
+			if (!id || json_long(doc.js, id, &val) || val <= 0)
+				continue;
+
+			rec->id = val;
+			rec->check = ctx->check;
+			tok = json_get(&doc, item, "value");
+			if (!tok || json_copy(doc.js, tok, rec->value, sizeof(rec->value)))
+				rec->value[0] = 0;
+		}
+
+		tok = json_get(&doc, NULL, "info.record_total");
+		if (!tok || json_long(doc.js, tok, &total))
+			total = 0;
+		offset += num;
+	} while (num == LIST_LENGTH && offset < total);
+
+	free(buf);
+
+	return rc;
 }
 
 /*
@@ -144,39 +335,44 @@ static int fetch_record_id(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias,
  */
 static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 {
-	char *tmp;
+	struct dprecord *rec;
 	char buffer[SERVER_NAME_LEN], domain[SERVER_NAME_LEN], prefix[SERVER_NAME_LEN];
-	int record_id;
-	int len;
+	int len, rc;
 
-	strlcpy(buffer, alias->name, sizeof(buffer));
-	tmp = strchr(buffer, '.');
-	if (!tmp)
+	if (split_name(alias->name, domain, prefix, sizeof(domain)))
 		return RC_DDNS_INVALID_OPTION;
 
-	if (tmp[1] != 0 && strchr(tmp + 1, '.') != NULL) {
-		*tmp++ = 0;
-		strlcpy(domain, tmp, sizeof(domain));
-		strlcpy(prefix, buffer, sizeof(prefix));
-	} else {
-		strlcpy(domain, alias->name, sizeof(domain));
-		strlcpy(prefix, "@", sizeof(prefix));
+	rec = get_record(alias->name);
+	if (!rec)
+		return RC_OUT_OF_MEMORY;
+
+	if (!rec->id || strcmp(rec->type, get_type(alias->address))) {
+		rc = list_records(ctx, info, domain);
+		if (rc)
+			return rc;
 	}
 
-	record_id = fetch_record_id(ctx, info, alias, domain, prefix);
-	if (record_id <= 0) {
+	if (!rec->id) {
 		logit(LOG_ERR, "Record '%s' not found in records list!", prefix);
-		if (record_id < 0)
-			return -record_id;
-
 		return RC_DDNS_INVALID_OPTION;
 	}
 
-	logit(LOG_DEBUG, "DNSPod Record: '%s' ID: %u", prefix, record_id);
+	logit(LOG_DEBUG, "DNSPod Record: '%s' ID: %ld", prefix, rec->id);
+
+	/*
+	 * Value as just listed, skip update if already set.  The record
+	 * may have changed since an earlier check, so not trusted then.
+	 */
+	if (rec->value[0] && rec->check == ctx->check && same_address(rec->value, alias->address)) {
+		rec->value[0] = 0;
+		return RC_DDNS_RSP_UNCHANGED;
+	}
+	rec->value[0] = 0;
+
 	len = snprintf(buffer, sizeof(buffer),
-		       "login_token=%s%%2C%s&format=json&domain=%s&record_id=%d&record_line=%s&value=%s",
+		       "login_token=%s%%2C%s&format=json&domain=%s&record_id=%ld&record_line=%s&value=%s",
 		       info->creds.username, info->creds.password,
-		       domain, record_id, "%E9%BB%98%E8%AE%A4", alias->address);
+		       domain, rec->id, "%E9%BB%98%E8%AE%A4", alias->address);
 	if (len >= (int)sizeof(buffer))
 		return RC_BUFFER_OVERFLOW;
 
@@ -220,21 +416,34 @@ static int request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
  *    }
  *}
  *
- * We search our own IP address in response and that's enough.
+ * The record should now have our address.
  */
 static int response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias)
 {
-	char *resp = trans->rsp_body;
+	struct dprecord *rec;
+	jsmntok_t *tok;
+	int rc;
 
 	(void)info;
-	(void)alias;
 
-	DO(http_status_valid(trans->status));
+	rc = http_status_valid(trans->status);
+	if (!rc) {
+		if (json_parse(&doc, trans->rsp_body) < 0)
+			rc = RC_DDNS_RSP_NOTOK;
+		else {
+			tok = json_get(&doc, NULL, "record.value");
+			if (tok && !jsoneq(doc.js, tok, alias->address))
+				return 0;
+			rc = RC_DDNS_RSP_NOTOK;
+		}
+	}
 
-	if (strstr(resp, alias->address))
-		return 0;
+	/* E.g. record deleted, list the domain again at next update */
+	rec = find_record(alias->name);
+	if (rec && rc != RC_DDNS_RSP_RETRY_LATER)
+		rec->id = 0;
 
-	return RC_DDNS_RSP_NOTOK;
+	return rc;
 }
 
 PLUGIN_INIT(plugin_init)
@@ -244,7 +453,18 @@ PLUGIN_INIT(plugin_init)
 
 PLUGIN_EXIT(plugin_exit)
 {
+	struct dprecord *rec, *tmp;
+	int i;
+
 	plugin_unregister(&plugin);
+	json_free(&doc);
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		LIST_FOREACH_SAFE(rec, &dprecords[i], link, tmp) {
+			LIST_REMOVE(rec, link);
+			free(rec);
+		}
+	}
 }
 
 /**
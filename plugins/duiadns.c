@@ -27,7 +27,7 @@
 	"host=%s&"							\
 	"password=%s&"							\
 	"ip4=%s "							\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n"
 
@@ -35,15 +35,25 @@
 
 #include "plugin.h"
 
+/* Max number of hostnames in one dyndns2 update request */
+#define DYNDNS_BATCH 20
+
 static int request  (ddns_t       *ctx,   ddns_info_t *info, ddns_alias_t *alias);
 static int response (http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias);
 
+static int batch_request  (ddns_t       *ctx,   ddns_info_t *info, ddns_alias_t **alias, size_t num);
+static int batch_response (http_trans_t *trans, ddns_info_t *info, ddns_alias_t **alias, size_t num, int *result);
+
 static ddns_system_t dyndns = {
 	.name         = "default@dyndns.org",
 
 	.request      = (req_fn_t)request,
 	.response     = (rsp_fn_t)response,
 
+	.batch_request  = (batch_req_fn_t)batch_request,
+	.batch_response = (batch_rsp_fn_t)batch_response,
+	.batch          = DYNDNS_BATCH,
+
 	.checkip_name = DYNDNS_MY_IP_SERVER,
 	.checkip_url  = DYNDNS_MY_CHECKIP_URL,
 	.checkip_ssl  = DYNDNS_MY_IP_SSL,
@@ -86,6 +96,10 @@ static ddns_system_t no_ip = {
 	.request      = (req_fn_t)request,
 	.response     = (rsp_fn_t)response,
 
+	.batch_request  = (batch_req_fn_t)batch_request,
+	.batch_response = (batch_rsp_fn_t)batch_response,
+	.batch          = DYNDNS_BATCH,
+
 	.checkip_name = "ip1.dynupdate.no-ip.com",
 	.checkip_url  = "/",
 	.checkip_ssl  = DYNDNS_MY_IP_SSL,
@@ -100,6 +114,10 @@ static ddns_system_t noip = {
 	.request      = (req_fn_t)request,
 	.response     = (rsp_fn_t)response,
 
+	.batch_request  = (batch_req_fn_t)batch_request,
+	.batch_response = (batch_rsp_fn_t)batch_response,
+	.batch          = DYNDNS_BATCH,
+
 	.checkip_name = "ip1.dynupdate.noip.com",
 	.checkip_url  = "/",
 	.checkip_ssl  = DYNDNS_MY_IP_SSL,
@@ -240,6 +258,16 @@ static int response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias)
 	return common_response(trans, info, alias);
 }
 
+static int batch_request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t **alias, size_t num)
+{
+	return common_batch_request(ctx, info, alias, num);
+}
+
+static int batch_response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t **alias, size_t num, int *result)
+{
+	return common_batch_response(trans, info, alias, num, result);
+}
+
 PLUGIN_INIT(plugin_init)
 {
 	plugin_register(&dyndns);
@@ -28,7 +28,7 @@
 	"hostname=%s&"							\
 	"token=%s"							\
 	" "								\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n\r\n"
 
@@ -29,7 +29,7 @@
 	"GET %s?"							\
 	"%s&"								\
 	"address=%s "							\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n\r\n"
 #define SHA1_DIGEST_BYTES 20
@@ -52,14 +52,100 @@ static ddns_system_t plugin = {
 	.server_url   = "/dynamic/update.php"
 };
 
-static char *fetch_keys(ddns_t *ctx, ddns_info_t *info)
+/*
+ * Update keys of all hostnames in the account, fetched once and kept in
+ * info->data, as one allocation: the table, then the strings.  Fetched
+ * again if the credentials change, a hostname is missing, or an update
+ * fails with anything but a temporary error.  At most once per check,
+ * hostnames missing from the account do not cause a fetch each.
+ */
+struct fdkey {
+	const char *host;
+	const char *hash;		/* Query string of the update URL */
+};
+
+struct fdkeys {
+	char         digest[SHA1_DIGEST_BYTES * 2 + 1]; /* Of username|password */
+	unsigned int check;				/* ctx->check when fetched */
+	size_t       num;
+	struct fdkey key[];
+};
+
+static void get_digest(ddns_info_t *info, char *digeststr)
 {
 	unsigned char digestbuf[SHA1_DIGEST_BYTES] = { 0 };
-	char          digeststr[SHA1_DIGEST_BYTES * 2 + 1];
-	http_trans_t  trans;
-	http_t        client;
 	char          buffer[384];
-	int           i, rc;
+	int           i;
+
+	/* SHA1 hash of username and password */
+	snprintf(buffer, sizeof(buffer), "%s|%s",
+		 info->creds.username, info->creds.password);
+	sha1((unsigned char *)buffer, strlen(buffer), digestbuf);
+	for (i = 0; i < SHA1_DIGEST_BYTES; i++)
+		sprintf(&digeststr[i * 2], "%02x", digestbuf[i]);
+}
+
+/*
+ * One "host|address|update URL" per line.  Counts entries in @num, and
+ * bytes of their strings in @len, and fills in @keys when given.
+ */
+static void scan_keys(const char *buf, struct fdkeys *keys, size_t *num, size_t *len)
+{
+	const char *line, *end, *sep, *url, *hash;
+	char *str = keys ? (char *)&keys->key[keys->num] : NULL;
+	size_t i = 0, n = 0;
+
+	for (line = buf; *line; line = end + (*end != 0)) {
+		size_t hostlen, hashlen;
+
+		end = line + strcspn(line, "\r\n");
+		sep = memchr(line, '|', end - line);
+		if (!sep || sep == line)
+			continue;
+		hostlen = sep - line;
+
+		url = memchr(sep + 1, '|', end - sep - 1);
+		if (!url)
+			continue;
+		url++;
+
+		sep = memchr(url, '|', end - url);
+		if (!sep)
+			sep = end;
+
+		hash = memchr(url, '?', sep - url);
+		if (!hash)
+			continue;
+		hash++;
+		hashlen = sep - hash;
+
+		if (keys) {
+			keys->key[i].host = str;
+			memcpy(str, line, hostlen);
+			str[hostlen] = 0;
+			str += hostlen + 1;
+
+			keys->key[i].hash = str;
+			memcpy(str, hash, hashlen);
+			str[hashlen] = 0;
+			str += hashlen + 1;
+		}
+		n += hostlen + 1 + hashlen + 1;
+		i++;
+	}
+
+	*num = i;
+	*len = n;
+}
+
+static struct fdkeys *fetch_keys(ddns_t *ctx, ddns_info_t *info, const char *digeststr)
+{
+	struct fdkeys *keys;
+	http_trans_t   trans;
+	http_t         client;
+	char           buffer[384];
+	size_t         num, len;
+	int            rc;
 
 	rc = (http_construct(&client));
 	if (rc)
@@ -67,19 +153,13 @@ static char *fetch_keys(ddns_t *ctx, ddns_info_t *info)
 
 	http_set_port(&client, info->server_name.port);
 	http_set_remote_name(&client, info->server_name.name);
+	http_set_remote_timeout(&client, info->timeout * 1000);
 
 	client.ssl_enabled = info->ssl_enabled;
 	rc = http_init(&client, "Fetching account API key");
 	if (rc)
 		return NULL;
 
-	/* SHA1 hash of username and password */
-	snprintf(buffer, sizeof(buffer), "%s|%s",
-		 info->creds.username, info->creds.password);
-	sha1((unsigned char *)buffer, strlen(buffer), digestbuf);
-	for (i = 0; i < SHA1_DIGEST_BYTES; i++)
-		sprintf(&digeststr[i * 2], "%02x", digestbuf[i]);
-
 	snprintf(buffer, sizeof(buffer), "/api/?action=getdyndns&v=2&sha=%s", digeststr);
 	trans.req_len     = snprintf(ctx->request_buf, ctx->request_buflen, GENERIC_HTTP_REQUEST,
 				     buffer, info->server_name.name, info->user_agent);
@@ -97,56 +177,97 @@ static char *fetch_keys(ddns_t *ctx, ddns_info_t *info)
 		return NULL;
 	}
 
-	return strdup(trans.rsp_body);
+	scan_keys(trans.rsp_body, NULL, &num, &len);
+	if (!num)
+		return NULL;
+
+	keys = malloc(sizeof(*keys) + num * sizeof(keys->key[0]) + len);
+	if (!keys)
+		return NULL;
+
+	strlcpy(keys->digest, digeststr, sizeof(keys->digest));
+	keys->check = ctx->check;
+	keys->num = num;
+	scan_keys(trans.rsp_body, keys, &num, &len);
+	logit(LOG_DEBUG, "FreeDNS: %zu API keys in account", num);
+
+	return keys;
+}
+
+static const char *find_key(ddns_info_t *info, const char *name)
+{
+	struct fdkeys *keys = (struct fdkeys *)info->data;
+	size_t i;
+
+	if (!keys)
+		return NULL;
+
+	for (i = 0; i < keys->num; i++) {
+		if (!strcmp(keys->key[i].host, name))
+			return keys->key[i].hash;
+	}
+
+	return NULL;
+}
+
+static void drop_keys(ddns_info_t *info)
+{
+	free(info->data);
+	info->data = NULL;
 }
 
 /* FreeDNS requires an API key, the following code fetches yours */
 static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 {
-	char         *hash = NULL;
 #ifndef ENABLE_SIMULATION
-	char          host[256], updateurl[256];
-	char         *buf, *tmp, *line;
+	struct fdkeys *keys = (struct fdkeys *)info->data;
+	char           digeststr[SHA1_DIGEST_BYTES * 2 + 1];
 
-	tmp = buf = fetch_keys(ctx, info);
-	if (!buf) {
-		logit(LOG_INFO, "Cannot find you FreeDNS account API keys");
-		return RC_ERROR;
+	get_digest(info, digeststr);
+	if (keys && strcmp(keys->digest, digeststr)) {
+		logit(LOG_DEBUG, "FreeDNS credentials changed, fetching API keys again.");
+		drop_keys(info);
 	}
 
-	for (line = strsep(&tmp, "\n"); line; line = strsep(&tmp, "\n")) {
-		int num;
-
-		num = sscanf(line, "%255[^|\r\n]|%*[^|\r\n]|%255[^|\r\n]", host, updateurl);
-		if (*line && num == 2 && !strcmp(host, alias->name)) {
-			hash = strstr(updateurl, "?");
-			break;
+again:
+	if (!info->data) {
+		info->data = fetch_keys(ctx, info, digeststr);
+		if (!info->data) {
+			logit(LOG_INFO, "Cannot find you FreeDNS account API keys");
+			return RC_ERROR;
 		}
 	}
-	free(buf);
 
-	if (!hash) {
-		logit(LOG_INFO, "Cannot find your DNS name in the list of API keys");
-		return 1;
+	if (!find_key(info, alias->name)) {
+		keys = (struct fdkeys *)info->data;
+		if (keys->check != ctx->check) {
+			drop_keys(info);
+			goto again;
+		}
+
+		logit(LOG_INFO, "Cannot find %s in the list of API keys", alias->name);
+		return RC_DDNS_RSP_NOHOST;
 	}
-	hash++;
 #else
-	hash = "<NIL>";
+	(void)ctx;
+	(void)info;
+	(void)alias;
 #endif /* ENABLE_SIMULATION */
 
-	if (info->data)
-		free(info->data);
-	info->data = strdup(hash);
-
 	return 0;
 }
 
 static int request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 {
-	char *hash = (char *)info->data;
+#ifndef ENABLE_SIMULATION
+	const char *hash = find_key(info, alias->name);
 
+	/* Checked by setup(), keys are only dropped by response() */
 	if (!hash)
-		return 0;
+		return -1;
+#else
+	const char *hash = "<NIL>";
+#endif
 
 	return snprintf(ctx->request_buf, ctx->request_buflen,
 			FREEDNS_UPDATE_IP_REQUEST,
@@ -167,16 +288,17 @@ static int request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 static int response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias)
 {
 	char *resp = trans->rsp_body;
+	int rc;
 
-	(void)info;
-	(void)alias;
-
-	DO(http_status_valid(trans->status));
-
-	if (strstr(resp, alias->address))
+	rc = http_status_valid(trans->status);
+	if (!rc && strstr(resp, alias->address))
 		return 0;
 
-	return RC_DDNS_RSP_NOTOK;
+	/* Stale or revoked key, e.g. record deleted, fetch keys again */
+	if (rc != RC_DDNS_RSP_RETRY_LATER)
+		drop_keys(info);
+
+	return rc ? rc : RC_DDNS_RSP_NOTOK;
 }
 
 PLUGIN_INIT(plugin_init)
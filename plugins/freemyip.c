@@ -29,7 +29,7 @@
 	"GET %s?"						\
 	"token=%s&"						\
 	"domain=%s "						\
-	"HTTP/1.0\r\n"						\
+	"HTTP/1.1\r\n"						\
 	"Host: %s\r\n"						\
 	"User-Agent: %s\r\n\r\n"
 
@@ -34,7 +34,7 @@
  */
 #define GENERIC_BASIC_AUTH_UPDATE_IP_REQUEST				\
 	"GET %s%s "							\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"Authorization: Basic %s\r\n"					\
 	"User-Agent: %s\r\n\r\n"
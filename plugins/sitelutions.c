@@ -30,7 +30,7 @@
 	"pass=%s&"							\
 	"id=%s&"							\
 	"ip=%s "							\
-	"HTTP/1.0\r\n"							\
+	"HTTP/1.1\r\n"							\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n\r\n"
 
@@ -40,15 +40,15 @@
 	"Content-Type: application/x-www-form-urlencoded\r\n\r\n"	\
 	"%s"
 
-/* XXX: please increase if not enough */
-#define TOKENS_EXPECTED		4096
-
 struct yandex {
 	char url[512];
 	int  len;
 	int  record_id;
 };
 
+/* Token arena, reused for every response */
+static json_t doc;
+
 static int setup    (ddns_t       *ctx,   ddns_info_t *info, ddns_alias_t *alias);
 static int request  (ddns_t       *ctx,   ddns_info_t *info, ddns_alias_t *alias);
 static int response (http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias);
@@ -68,185 +68,60 @@ static ddns_system_t plugin = {
 	.server_url   = "/dynamic/update.php"
 };
 
-/* FIXME: remove and use parse_json() instead */
-static jsmntok_t *get_tokens(const char *response, int *n)
+static int parse(const char *response)
 {
-	jsmn_parser *p;
-	jsmntok_t   *t;
-	int	     r;
-
-	p = malloc(sizeof(*p));
-	if (!p) {
-		logit(LOG_ERR, "Not enough memory");
-		return NULL;
-	}
-
-	t = malloc(sizeof(*t) * TOKENS_EXPECTED);
-	if (!t) {
-		logit(LOG_ERR, "Not enough memory");
-		free(p);
-		return NULL;
-	}
-
-	jsmn_init(p);
-	r = jsmn_parse(p, response, strlen(response), t, TOKENS_EXPECTED);
-	free(p);
-	*n = r;
-
-	if (r < 0) {
-		logit(LOG_ERR, "Failed to parse JSON");
-		free(t);
-		return NULL;
-	}
+	if (json_parse(&doc, response) < 0)
+		return -1;
 
-	if ((r < 1) || (t[0].type != JSMN_OBJECT)) {
+	if (doc.tok[0].type != JSMN_OBJECT) {
 		logit(LOG_ERR, "JSON object expected");
-		free(t);
-		return NULL;
+		return -1;
 	}
 
-	return t;
+	return 0;
 }
 
-static int success(const char *response)
+static int success(void)
 {
-	jsmntok_t *t;
-	int	   n, i;
-	int	   rc = 0;
+	jsmntok_t *tok;
 
-	t = get_tokens(response, &n);
-	if (!t)
-		return 0;
+	tok = json_get(&doc, NULL, "success");
 
-	for (i = 1; i < n - 1; i++) {
-		jsmntok_t *tok = &t[i];
+	return tok && !jsoneq(doc.js, tok, "ok");
+}
 
-		if (jsoneq(response, tok, "success"))
-			continue;
+/* Id, and content, of A record for subdomain in records list, or 0 if not found */
+static int get_record_id(const char *subdomain, char *content, size_t len)
+{
+	jsmntok_t *records, *rec;
 
-		if (jsoneq(response, tok + 1, "ok") == 0) {
-			rc = 1;
-			break;
-		}
+	records = json_get(&doc, NULL, "records");
+	if (!records || records->type != JSMN_ARRAY) {
+		logit(LOG_ERR, "Got JSON document that cannot understand\n");
+		return -1;
 	}
 
-	free(t);
+	for (rec = json_first(&doc, records); rec; rec = json_next(&doc, rec)) {
+		jsmntok_t *name, *type, *id;
+		long record_id;
 
-	return rc;
-}
+		name = json_get(&doc, rec, "subdomain");
+		type = json_get(&doc, rec, "type");
+		id   = json_get(&doc, rec, "record_id");
+		if (!name || !type || !id)
+			continue;
 
-static int get_record_id(const char *response, const char *subdomain)
-{
-	jsmntok_t *t;
-	int	   n, i;
-	int	   record_id = 0;
-	int	   id_keyword_found = 0;
-
-	enum {
-		ST_UNKNOWN,
-		ST_FIND_RECORDS,
-		ST_FIND_RECORD_ID
-	} state = ST_UNKNOWN;
-
-	enum {
-		SUBDOMAIN_NONE,
-		SUBDOMAIN_KEYWORD,
-		SUBDOMAIN_VALUE
-	} subdomain_field = SUBDOMAIN_NONE;
-
-	enum {
-		TYPE_NONE,
-		TYPE_KEYWORD,
-		TYPE_VALUE
-	} type_field = TYPE_NONE;
-
-	t = get_tokens(response, &n);
-	if (!t)
-		return -1;
+		if (jsoneq(doc.js, name, subdomain) || jsoneq(doc.js, type, "A"))
+			continue;
 
-	for (i = 1; i < n; i++) {
-		jsmntok_t *tok = &t[i];
-
-		switch (tok->type) {
-		case JSMN_STRING:
-		case JSMN_PRIMITIVE:
-			if (jsoneq(response, tok, "records") == 0) {
-				state = ST_FIND_RECORDS;
-				break;
-			}
-
-			if (state != ST_FIND_RECORD_ID)
-				break;
-
-			if (jsoneq(response, tok, "subdomain") == 0) {
-				subdomain_field = SUBDOMAIN_KEYWORD;
-				break;
-			}
-
-			if (jsoneq(response, tok, "type") == 0) {
-				type_field = TYPE_KEYWORD;
-				break;
-			}
-
-			if (jsoneq(response, tok, "record_id") == 0) {
-				id_keyword_found = 1;
-				break;
-			}
-
-			if ((subdomain_field == SUBDOMAIN_KEYWORD) &&
-					(jsoneq(response, tok, subdomain)) == 0)
-				subdomain_field = SUBDOMAIN_VALUE;
-
-			if ((type_field == TYPE_KEYWORD) &&
-					(jsoneq(response, tok, "A")) == 0)
-				type_field = TYPE_VALUE;
-
-			if (id_keyword_found) {
-				char buf[129]; // additional byte for \0
-				size_t n = tok->end - tok->start;
-
-				id_keyword_found = 0;
-				if (n > sizeof(buf) - 1)
-					break;
-
-				memset(buf, 0, sizeof(buf));
-				strncpy(buf, response + tok->start, n);
-				record_id = strtol(buf, NULL, 10);
-			}
-
-			if (subdomain_field == SUBDOMAIN_VALUE &&
-					type_field == TYPE_VALUE &&
-					record_id > 0) {
-				free(t);
-				return record_id;
-			}
-
-			break;
-		case JSMN_ARRAY:
-			if (state != ST_FIND_RECORDS)
-				break;
-
-			state = ST_FIND_RECORD_ID;
-			break;
-		case JSMN_OBJECT:
-			if (state != ST_FIND_RECORD_ID)
-				break;
-
-			subdomain_field  = SUBDOMAIN_NONE;
-			type_field	 = TYPE_NONE;
-			id_keyword_found = 0;
-			break;
-
-		case JSMN_UNDEFINED:
-			break;
-		}
-	}
+		if (!json_long(doc.js, id, &record_id) && record_id > 0) {
+			jsmntok_t *tok = json_get(&doc, rec, "content");
 
-	free(t);
+			if (!tok || json_copy(doc.js, tok, content, len))
+				content[0] = 0;
 
-	if (state != ST_FIND_RECORD_ID) {
-		logit(LOG_ERR, "Got JSON document that cannot understand\n");
-		return -1;
+			return record_id;
+		}
 	}
 
 	return 0;
@@ -254,6 +129,7 @@ static int get_record_id(const char *response, const char *subdomain)
 
 static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 {
+	char content[MAX_ADDRESS_LEN] = "";
 	struct yandex *y;
 	http_trans_t trans;
 	http_t client;
@@ -274,6 +150,7 @@ static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 
 	http_set_port(&client, info->server_name.port);
 	http_set_remote_name(&client, info->server_name.name);
+	http_set_remote_timeout(&client, info->timeout * 1000);
 
 	client.ssl_enabled = info->ssl_enabled;
 	rc = http_init(&client, "Sending records list query");
@@ -303,13 +180,16 @@ static int setup(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias)
 
 	resp = trans.rsp_body;
 	logit(LOG_DEBUG, "Yandex response: %s", resp);
-	if (!success(resp))
+	if (parse(resp) || !success())
 		return RC_DDNS_INVALID_OPTION;
 
-	y->record_id = get_record_id(resp, alias->name);
+	y->record_id = get_record_id(alias->name, content, sizeof(content));
 	if (y->record_id < 0)
 		return RC_DDNS_INVALID_OPTION;
 
+	if (y->record_id > 0 && same_address(content, alias->address))
+		return RC_DDNS_RSP_UNCHANGED;
+
 	if (y->record_id > 0) {
 		logit(LOG_INFO, "Updating record, id = %i", y->record_id);
 		y->len = snprintf(y->url, sizeof(y->url),
@@ -354,7 +234,7 @@ static int response(http_trans_t *trans, ddns_info_t *info, ddns_alias_t *alias)
 	(void)alias;
 
 	DO(http_status_valid(trans->status));
-	if (success(resp))
+	if (!parse(resp) && success())
 		return 0;
 
 	return RC_DDNS_RSP_NOTOK;
@@ -368,4 +248,5 @@ PLUGIN_INIT(plugin_init)
 PLUGIN_EXIT(plugin_exit)
 {
 	plugin_unregister(&plugin);
+	json_free(&doc);
 }
@@ -0,0 +1,285 @@
+/* Find and validate IP addresses in checkip responses
+ *
+ * Copyright (C) 2003-2004  Narcis Ilisei <inarcis2002@hotpop.com>
+ * Copyright (C) 2006       Steve Horbachuk
+ * Copyright (C) 2010-2020  Joachim Nilsson <troglobit@gmail.com>
+ * Copyright (C) 2026       agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "ddns.h"
+
+/* Character classes of address candidates, see parse_address() */
+#define CL_V4		0x01	/* 0-9 .     */
+#define CL_V6		0x02	/* 0-9 a-f : */
+#define CL_ANCHOR	0x04	/* 0-9 :     */
+
+#define ONES		0x0101010101010101ULL
+#define HIGH		0x8080808080808080ULL
+
+/* Any byte of x in the open range (m, n), m and n <= 128, see bithacks */
+#define hasbetween(x, m, n)							\
+	((ONES * (127 + (n)) - ((x) & ONES * 127)) & ~(x) &			\
+	 (((x) & ONES * 127) + ONES * (127 - (m))) & HIGH)
+
+static const unsigned char class[256] = {
+	['0' ... '9'] = CL_V4 | CL_V6 | CL_ANCHOR,
+	['.']         = CL_V4,
+	[':']         = CL_V6 | CL_ANCHOR,
+	['a' ... 'f'] = CL_V6,
+	['A' ... 'F'] = CL_V6,
+};
+
+static int check_address(int family, const void *addr, const char *host)
+{
+	if (!verify_addr) {
+		logit(LOG_DEBUG, "IP address validation disabled, %s is thus valid.", host);
+		return 1;
+	}
+
+	if (family == AF_INET) {
+		in_addr_t a = ntohl(((const struct in_addr *)addr)->s_addr);
+
+		logit(LOG_DEBUG, "Checking IPv4 address %s ...", host);
+		if (IN_ZERONET(a)   || IN_LOOPBACK(a) || IN_LINKLOCAL(a) ||
+		    IN_MULTICAST(a) || IN_EXPERIMENTAL(a))
+			goto error;
+
+		logit(LOG_DEBUG, "IPv4 address %s is valid.", host);
+		return 1;
+	}
+
+	if (!allow_ipv6) {
+		logit(LOG_INFO, "IPv6 address disallowed, enable with 'allow-ipv6 = true'");
+		return 0;
+	}
+
+	if (family == AF_INET6) {
+		const struct in6_addr *a = addr;
+
+		logit(LOG_DEBUG, "Checking IPv6 address %s ...", host);
+		if (IN6_IS_ADDR_UNSPECIFIED(a) || IN6_IS_ADDR_LOOPBACK(a) ||
+		    IN6_IS_ADDR_LINKLOCAL(a)   || IN6_IS_ADDR_SITELOCAL(a))
+			goto error;
+
+		logit(LOG_DEBUG, "IPv6 address %s is valid.", host);
+		return 1;
+	}
+
+error:
+	logit(LOG_WARNING, "IP%s address %s is not a valid Internet address.",
+	      family == AF_INET ? "v4" : family == AF_INET6 ? "v6" : "", host);
+	return 0;
+}
+
+/*
+ * IP address validator, discards empty, local, loopback and other
+ * globally invalid addresses
+ */
+int is_address_valid(int family, const char *host)
+{
+	struct in6_addr addr;
+
+	if (!verify_addr)
+		return check_address(family, NULL, host);
+
+	if ((family != AF_INET && family != AF_INET6) || !inet_pton(family, host, &addr)) {
+		logit(LOG_WARNING, "IP%s address %s is not a valid Internet address.",
+		      family == AF_INET ? "v4" : family == AF_INET6 ? "v6" : "", host);
+		return 0;
+	}
+
+	return check_address(family, &addr, host);
+}
+
+/* Dotted quad, same rules as inet_pton(), but without a NUL terminator */
+static int pton4(const char *s, size_t n, struct in_addr *addr)
+{
+	unsigned char *dst = (unsigned char *)&addr->s_addr;
+	const char *end = s + n;
+	int octets = 0;
+
+	while (s < end) {
+		unsigned int val = 0;
+		const char *p = s;
+
+		while (p < end && *p >= '0' && *p <= '9') {
+			val = val * 10 + (*p - '0');
+			if (val > 255 || (p > s && *s == '0'))
+				return 0;
+			p++;
+		}
+		if (p == s || octets == 4)
+			return 0;
+
+		dst[octets++] = val;
+		if (p < end && (*p != '.' || p + 1 == end))
+			return 0;
+		s = p + 1;
+	}
+
+	return octets == 4;
+}
+
+/* Maximal run of digits and dots, or of hex digits and colons */
+static int candidate(int family, const char *s, size_t n, char *address, size_t len)
+{
+	struct in6_addr addr;
+
+	if (family == AF_INET) {
+		if (n < 7 || n > 15 || !pton4(s, n, (struct in_addr *)&addr))
+			return 0;
+	} else {
+		char buf[INET6_ADDRSTRLEN];
+
+		if (n < 2 || n >= sizeof(buf) || !memchr(s, ':', n))
+			return 0;
+
+		memcpy(buf, s, n);
+		buf[n] = 0;
+		if (inet_pton(AF_INET6, buf, &addr) != 1)
+			return 0;
+	}
+
+	if (!inet_ntop(family, &addr, address, len))
+		return 0;
+
+	return check_address(family, &addr, address);
+}
+
+/* First byte in [0-9:], i.e. that can start an address, or end */
+static const char *anchor(const char *p, const char *end)
+{
+	while (p + sizeof(uint64_t) <= end) {
+		uint64_t x;
+
+		memcpy(&x, p, sizeof(x));
+		if (hasbetween(x, '0' - 1, ':' + 1))
+			break;
+		p += sizeof(x);
+	}
+
+	while (p < end && !(class[(unsigned char)*p] & CL_ANCHOR))
+		p++;
+
+	return p;
+}
+
+/*
+ * Find the first valid address in a checkip response or command output.
+ * Linear, in one pass, without modifying the buffer.  Candidates are the
+ * same as inet_pton() would see had the buffer been split on all other
+ * characters.  Stretches without digits or colons, i.e. most of an HTML
+ * page, are skipped a word at a time.
+ *
+ * With AF_UNSPEC an IPv6 address anywhere is preferred over IPv4.
+ * Returns 1 when found.
+ */
+int parse_address(const char *buffer, int family, char *address, size_t len)
+{
+	const char *p, *end, *lo, *s4 = NULL, *s6 = NULL;
+	int want4 = family != AF_INET6;
+	int want6 = family != AF_INET;
+	int have4 = 0;
+	char ipv4[INET_ADDRSTRLEN];
+
+	p   = buffer;
+	end = buffer + strlen(buffer);
+	while (p < end) {
+		/* Outside any run, skip to next anchor and back up to run start */
+		if (!s4 && !s6) {
+			lo = p;
+			p  = anchor(p, end);
+			if (p == end)
+				break;
+			while (p > lo && (class[(unsigned char)p[-1]] & (CL_V4 | CL_V6)))
+				p--;
+		}
+
+		for (; p < end; p++) {
+			unsigned char cl = class[(unsigned char)*p];
+
+			if (cl & CL_V4) {
+				if (!s4)
+					s4 = p;
+			} else if (s4) {
+				if (want4 && !have4)
+					have4 = candidate(AF_INET, s4, p - s4, ipv4, sizeof(ipv4));
+				if (have4 && !want6)
+					goto done;
+				s4 = NULL;
+			}
+
+			if (cl & CL_V6) {
+				if (!s6)
+					s6 = p;
+			} else if (s6) {
+				if (want6 && candidate(AF_INET6, s6, p - s6, address, len))
+					return 1;
+				s6 = NULL;
+			}
+
+			if (!s4 && !s6) {
+				p++;
+				break;
+			}
+		}
+	}
+
+	if (s4 && want4 && !have4)
+		have4 = candidate(AF_INET, s4, end - s4, ipv4, sizeof(ipv4));
+	if (s6 && want6 && candidate(AF_INET6, s6, end - s6, address, len))
+		return 1;
+done:
+	if (!have4)
+		return 0;
+
+	strlcpy(address, ipv4, len);
+	return 1;
+}
+
+/*
+ * Compare two addresses as read from a DDNS provider, in binary, since
+ * an IPv6 address can be written in more than one way.  Returns 1 when
+ * they are the same.
+ */
+int same_address(const char *a, const char *b)
+{
+	struct in6_addr x, y;
+	int family;
+
+	family = strchr(a, ':') ? AF_INET6 : AF_INET;
+	memset(&x, 0, sizeof(x));
+	memset(&y, 0, sizeof(y));
+	if (inet_pton(family, a, &x) != 1 || inet_pton(family, b, &y) != 1)
+		return 0;
+
+	return !memcmp(&x, &y, sizeof(x));
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -34,48 +34,71 @@
 #include <time.h>
 #include <unistd.h>
 #include <netinet/in.h>
-#include <resolv.h>
 #include <sys/stat.h>
 
 #include "ddns.h"
 #include "cache.h"
+#include "dns.h"
+#include "event.h"
+
+#define NSLOOKUP_MAX	16	/* Lookups in flight, each has its own socket */
+
+struct nslookup {
+	ddns_alias_t *alias;
+	dns_result_t  res;
+};
+
+static int running;
 
 extern ddns_info_t *conf_info_iterator(int first);
 
-static int nslookup(ddns_alias_t *alias)
+static void nslookup_result(ddns_alias_t *alias, dns_result_t *res)
 {
-	int error;
-	struct addrinfo hints;
-	struct addrinfo *result;
-
-	memset(&hints, 0, sizeof(struct addrinfo));
-	hints.ai_family = AF_INET;	/* IPv4 */
-	hints.ai_socktype = SOCK_DGRAM;	/* Datagram socket */
-	hints.ai_flags = 0;
-	hints.ai_protocol = 0;          /* Any protocol */
-
-	error = getaddrinfo(alias->name, NULL, &hints, &result);
-	if (!error) {
-		char address[MAX_ADDRESS_LEN];
+	char address[MAX_ADDRESS_LEN];
+
+	/* DNS reply for alias found, convert to IP# */
+	if (!getnameinfo(&res->addr[0].sa, dns_addrlen(&res->addr[0]), address, sizeof(address), NULL, 0, NI_NUMERICHOST)) {
+		/* Update local record for next checkip call. */
+		alias->last_update = 0;
+		strlcpy(alias->address, address, sizeof(alias->address));
+		logit(LOG_INFO, "Resolving hostname %s => IP# %s", alias->name, address);
+	}
+}
 
-		/* DNS reply for alias found, convert to IP# */
-		if (!getnameinfo(result->ai_addr, result->ai_addrlen, address, sizeof(address), NULL, 0, NI_NUMERICHOST)) {
-			/* Update local record for next checkip call. */
-			alias->last_update = 0;
-			strlcpy(alias->address, address, sizeof(alias->address));
-			logit(LOG_INFO, "Resolving hostname %s => IP# %s", alias->name, address);
-		}
+static void nslookup_done(int rc, void *arg)
+{
+	struct nslookup *ns = (struct nslookup *)arg;
 
-		freeaddrinfo(result);
-		return 0;
-	}
+	running--;
+	if (!rc)
+		nslookup_result(ns->alias, &ns->res);
+	free(ns);
+}
 
-	logit(LOG_WARNING, "Failed resolving hostname %s: %s", alias->name, gai_strerror(error));
+/* Result is handed to the alias in nslookup_done(), not left to the DNS cache */
+static void nslookup(ddns_alias_t *alias)
+{
+	struct nslookup *ns;
+	int rc;
+
+	ns = calloc(1, sizeof(*ns));
+	if (!ns)
+		return;
+
+	ns->alias = alias;
+	rc = dns_lookup(alias->name, AF_INET, &ns->res, nslookup_done, ns);
+	if (rc == RC_WANT_RESOLVE) {
+		running++;
+		return;
+	}
 
-	return 1;
+	if (!rc)
+		nslookup_result(alias, &ns->res);
+	free(ns);
 }
 
-static void read_one(ddns_alias_t *alias, int nonslookup)
+/* Returns 1 if there is no cache file, and a DNS lookup is needed */
+static int read_one(ddns_alias_t *alias, int nonslookup)
 {
 	FILE *fp;
 	char path[256];
@@ -88,10 +111,10 @@ static void read_one(ddns_alias_t *alias, int nonslookup)
 	if (!fp) {
 		/* Exception for dnsomatic's special global hostname */
 		if (nonslookup || !strncmp(alias->name, "all.dnsomatic.com", sizeof(alias->name)))
-			return;
+			return 0;
 
-		/* Try a DNS lookup of our last known IP#. */
-		nslookup(alias);
+		/* Try a DNS lookup of our last known IP#, see read_cache_file() */
+		return 1;
 	} else {
 		struct stat st;
 		char address[MAX_ADDRESS_LEN];
@@ -109,6 +132,8 @@ static void read_one(ddns_alias_t *alias, int nonslookup)
 
 		fclose(fp);
 	}
+
+	return 0;
 }
 
 char *cache_file(char *name, char *buf, size_t len)
@@ -132,17 +157,20 @@ char *cache_file(char *name, char *buf, size_t len)
 int read_cache_file(ddns_t *ctx)
 {
 	ddns_info_t *info;
-
-	/*
-	 * Clear DNS cache before querying for the IP below, this to
-	 * prevent any artefacts from, e.g., nscd, which is a known
-	 * problem with DDNS clients.
-	 */
-	res_init();
+	ddns_alias_t **lookup;
+	size_t num = 0, i;
 
 	if (!ctx)
 		return RC_INVALID_POINTER;
 
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0))
+		num += info->alias_count;
+
+	lookup = calloc(num + 1, sizeof(*lookup));
+	if (!lookup)
+		return RC_OUT_OF_MEMORY;
+
+	num = 0;
 	info = conf_info_iterator(1);
 	while (info) {
 		/* XXX: Possibly move this exception to each plugin */
@@ -151,7 +179,7 @@ int read_cache_file(ddns_t *ctx)
 			"default@tunnelbroker.net"
 		};
 		const char *name = info->system->name;
-		size_t i, j;
+		size_t j;
 		int nonslookup = 0;
 
 		/* Exceptions -- no name to lookup */
@@ -163,12 +191,28 @@ int read_cache_file(ddns_t *ctx)
 		}
 
 // XXX: TODO better plugin identifiction here
-		for (j = 0; j < info->alias_count; j++)
-			read_one(&info->alias[j], nonslookup);
+		for (j = 0; j < info->alias_count; j++) {
+			if (read_one(&info->alias[j], nonslookup))
+				lookup[num++] = &info->alias[j];
+		}
 
 		info = conf_info_iterator(0);
 	}
 
+	/*
+	 * Look up NSLOOKUP_MAX names at a time and wait for the replies,
+	 * the resolver does not use nscd, so there are no artefacts from a
+	 * stale cache, a known problem with DDNS clients.
+	 */
+	for (i = 0; i < num; i++) {
+		while (running >= NSLOOKUP_MAX)
+			event_poll(-1);
+		nslookup(lookup[i]);
+	}
+	while (running)
+		event_poll(-1);
+	free(lookup);
+
 	return 0;
 }
 
@@ -194,6 +238,71 @@ int write_cache_file(ddns_alias_t *alias)
 	return 1;
 }
 
+/*
+ * Provider data for an alias, e.g. record ids, kept next to its cache
+ * file, in /var/cache/inadyn/my.server.name.EXT, to save lookups after
+ * a restart.  Lost, stale, or garbled data only costs a new lookup.
+ */
+static char *data_file(const char *name, const char *ext, char *buf, size_t len)
+{
+	if (snprintf(buf, len, "%s/%s.%s", cache_dir, name, ext) >= (int)len) {
+		logit(LOG_WARNING, "Too long name for buffer: '%s/' + '%s' + '.%s'", cache_dir, name, ext);
+		return NULL;
+	}
+
+	return buf;
+}
+
+int read_cache_data(const char *name, const char *ext, char *data, size_t len)
+{
+	char path[256];
+	FILE *fp;
+	int rc = 1;
+
+	if (!data_file(name, ext, path, sizeof(path)))
+		return 1;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return 1;
+
+	if (fgets(data, len, fp)) {
+		data[strcspn(data, "\n")] = 0;
+		rc = 0;
+	}
+	fclose(fp);
+
+	return rc;
+}
+
+int write_cache_data(const char *name, const char *ext, const char *data)
+{
+	char path[256];
+	FILE *fp;
+
+	if (!data_file(name, ext, path, sizeof(path)))
+		return 1;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		logit(LOG_DEBUG, "Failed saving %s: %s", path, strerror(errno));
+		return 1;
+	}
+
+	fprintf(fp, "%s\n", data);
+	fclose(fp);
+
+	return 0;
+}
+
+void remove_cache_data(const char *name, const char *ext)
+{
+	char path[256];
+
+	if (data_file(name, ext, path, sizeof(path)))
+		remove(path);
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
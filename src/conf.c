@@ -115,19 +115,14 @@ static int validate_hostname(cfg_t *cfg, const char *provider, cfg_opt_t *hostna
 
 	for (i = 0; i < cfg_opt_size(hostname); i++) {
 		char *name = cfg_opt_getnstr(hostname, i);
-		ddns_info_t info;
+		ddns_alias_t alias;
 
-		if (sizeof(info.alias[0].name) < strlen(name)) {
+		if (sizeof(alias.name) < strlen(name)) {
 			cfg_error(cfg, "Too long DDNS hostname (%s) in provider %s", name, provider);
 			return -1;
 		}
 	}
 
-	if (i >= DDNS_MAX_ALIAS_NUMBER) {
-		cfg_error(cfg, "Too many hostname aliases, MAX %d supported!", DDNS_MAX_ALIAS_NUMBER);
-		return -1;
-	}
-
 	return 0;
 }
 
@@ -351,6 +346,10 @@ static int set_provider_opts(cfg_t *cfg, ddns_info_t *info, int custom)
 	if (str && strlen(str) <= sizeof(info->creds.password))
 		strlcpy(info->creds.password, str, sizeof(info->creds.password));
 
+	info->alias = calloc(cfg_size(cfg, "hostname"), sizeof(ddns_alias_t));
+	if (!info->alias)
+		goto error;
+
 	for (j = 0; j < cfg_size(cfg, "hostname"); j++) {
 		size_t pos = info->alias_count;
 
@@ -358,19 +357,16 @@ static int set_provider_opts(cfg_t *cfg, ddns_info_t *info, int custom)
 		if (!str)
 			continue;
 
-		if (info->alias_count == DDNS_MAX_ALIAS_NUMBER) {
-			logit(LOG_WARNING, "Too many hostname aliases, skipping %s ...", str);
-			continue;
-		}
-
 		strlcpy(info->alias[pos].name, str, sizeof(info->alias[pos].name));
 		info->alias_count++;
 	}
 
+	/* Mandatory for custom, optional override of a provider's server */
+	cfg_getserver(cfg, "ddns-server", &info->server_name);
+
 	if (custom) {
 		info->append_myip = cfg_getbool(cfg, "append-myip");
 
-		cfg_getserver(cfg, "ddns-server", &info->server_name);
 		str = cfg_getstr(cfg, "ddns-path");
 		if (str && strlen(str) <= sizeof(info->server_url))
 			strlcpy(info->server_url, str, sizeof(info->server_url));
@@ -451,6 +447,12 @@ static int set_provider_opts(cfg_t *cfg, ddns_info_t *info, int custom)
 	else if (script_cmd)
 		info->checkip_cmd = strdup(script_cmd);
 
+	/* The per-provider schedule and timeout, zero means use the global setting */
+	info->period = cfg_getint(cfg, "period");
+	info->forced_update_period = cfg_getint(cfg, "forced-update");
+	info->error_period = cfg_getint(cfg, "error-period");
+	info->timeout = cfg_getint(cfg, "timeout");
+
 	/* The per-provider user-agent setting, defaults to the global setting */
 	info->user_agent = cfg_getstr(cfg, "user-agent");
 	if (!info->user_agent)
@@ -480,6 +482,7 @@ static int create_provider(cfg_t *cfg, int custom)
 	http_construct(&info->checkip);
 	http_construct(&info->server);
 	if (set_provider_opts(cfg, info, custom)) {
+		free(info->alias);
 		free(info);
 		return 1;
 	}
@@ -515,6 +518,7 @@ void conf_info_cleanup(void)
 			free(ptr->checkip_cmd);
 		if (ptr->data)
 			free(ptr->data);
+		free(ptr->alias);
 		LIST_REMOVE(ptr, link);
 		free(ptr);
 	}
@@ -536,6 +540,11 @@ cfg_t *conf_parse_file(char *file, ddns_t *ctx)
 		CFG_BOOL    ("checkip-ssl",    cfg_true, CFGF_NONE),
 		CFG_STR     ("checkip-command",NULL, CFGF_NONE), /* Syntax: /path/to/cmd [args] */
 		CFG_STR     ("user-agent",     NULL, CFGF_NONE),
+		CFG_INT     ("period",         0, CFGF_NONE),    /* Default: global period */
+		CFG_INT     ("forced-update",  0, CFGF_NONE),    /* Default: global forced-update */
+		CFG_INT     ("error-period",   0, CFGF_NONE),    /* Default: global error-period */
+		CFG_INT     ("timeout",        0, CFGF_NONE),    /* Default: global timeout */
+		CFG_STR     ("ddns-server",    NULL, CFGF_NONE), /* Syntax:  name:port */
 //		CFG_STR     ("proxy",          NULL, CFGF_NONE), /* Syntax:  name:port */
 		CFG_END()
 	};
@@ -552,6 +561,10 @@ cfg_t *conf_parse_file(char *file, ddns_t *ctx)
 		CFG_BOOL    ("checkip-ssl",    cfg_true, CFGF_NONE),
 		CFG_STR     ("checkip-command",NULL, CFGF_NONE), /* Syntax: /path/to/cmd [args] */
 		CFG_STR     ("user-agent",     NULL, CFGF_NONE),
+		CFG_INT     ("period",         0, CFGF_NONE),    /* Default: global period */
+		CFG_INT     ("forced-update",  0, CFGF_NONE),    /* Default: global forced-update */
+		CFG_INT     ("error-period",   0, CFGF_NONE),    /* Default: global error-period */
+		CFG_INT     ("timeout",        0, CFGF_NONE),    /* Default: global timeout */
 //		CFG_STR     ("proxy",          NULL, CFGF_NONE), /* Syntax:  name:port */
 		/* Custom settings */
 		CFG_BOOL    ("append-myip",    cfg_false, CFGF_NONE),
@@ -564,13 +577,18 @@ cfg_t *conf_parse_file(char *file, ddns_t *ctx)
 		CFG_BOOL("verify-address", cfg_true, CFGF_NONE),
 		CFG_BOOL("fake-address",  cfg_false, CFGF_NONE),
 		CFG_BOOL("allow-ipv6",    cfg_false, CFGF_NONE),
+		CFG_BOOL("netlink",       cfg_false, CFGF_NONE),
 		CFG_BOOL("secure-ssl",    cfg_true, CFGF_NONE),
 		CFG_BOOL("broken-rtc",    cfg_false, CFGF_NONE),
 		CFG_STR ("ca-trust-file", NULL, CFGF_NONE),
+		CFG_BOOL("ssl-session-cache", cfg_false, CFGF_NONE),
 		CFG_STR ("cache-dir",	  NULL, CFGF_DEPRECATED | CFGF_DROP),
 		CFG_INT ("period",	  DDNS_DEFAULT_PERIOD, CFGF_NONE),
 		CFG_INT ("iterations",    DDNS_DEFAULT_ITERATIONS, CFGF_NONE),
 		CFG_INT ("forced-update", DDNS_FORCED_UPDATE_PERIOD, CFGF_NONE),
+		CFG_INT ("error-period",  DDNS_ERROR_UPDATE_PERIOD, CFGF_NONE),
+		CFG_INT ("parallel-updates", DDNS_DEFAULT_PARALLEL_UPDATES, CFGF_NONE),
+		CFG_INT ("timeout",       DDNS_DEFAULT_TIMEOUT, CFGF_NONE),
 		CFG_STR ("iface",         NULL, CFGF_NONE),
 		CFG_STR ("user-agent",    NULL, CFGF_NONE),
 		CFG_SEC ("provider",      provider_opts, CFGF_MULTI | CFGF_TITLE),
@@ -590,6 +608,11 @@ cfg_t *conf_parse_file(char *file, ddns_t *ctx)
 
 	/* Validators */
 	cfg_set_validate_func(cfg, "period", validate_period);
+	cfg_set_validate_func(cfg, "provider|period", validate_period);
+	cfg_set_validate_func(cfg, "custom|period", validate_period);
+	cfg_set_validate_func(cfg, "error-period", validate_period);
+	cfg_set_validate_func(cfg, "provider|error-period", validate_period);
+	cfg_set_validate_func(cfg, "custom|error-period", validate_period);
 	cfg_set_validate_func(cfg, "provider", validate_provider);
 	cfg_set_validate_func(cfg, "custom", validate_custom);
 
@@ -608,12 +631,18 @@ cfg_t *conf_parse_file(char *file, ddns_t *ctx)
 
 	/* Set global options */
 	ctx->normal_update_period_sec = cfg_getint(cfg, "period");
-	ctx->error_update_period_sec  = DDNS_ERROR_UPDATE_PERIOD;
+	ctx->error_update_period_sec  = cfg_getint(cfg, "error-period");
 	ctx->forced_update_period_sec = cfg_getint(cfg, "forced-update");
 	if (once)
 		ctx->total_iterations = 1;
 	else
 		ctx->total_iterations = cfg_getint(cfg, "iterations");
+	ctx->parallel_updates         = cfg_getint(cfg, "parallel-updates");
+	if (ctx->parallel_updates < 0)
+		ctx->parallel_updates = DDNS_DEFAULT_PARALLEL_UPDATES;
+	ctx->timeout_sec              = cfg_getint(cfg, "timeout");
+	if (ctx->timeout_sec <= 0)
+		ctx->timeout_sec = DDNS_DEFAULT_TIMEOUT;
 
 	verify_addr                   = cfg_getbool(cfg, "verify-address");
 	ctx->forced_update_fake_addr  = cfg_getbool(cfg, "fake-address");
@@ -625,8 +654,10 @@ cfg_t *conf_parse_file(char *file, ddns_t *ctx)
 	if (!user_agent)
 		user_agent            = DDNS_USER_AGENT;
 	allow_ipv6                    = cfg_getbool(cfg, "allow-ipv6");
+	use_netlink                   = cfg_getbool(cfg, "netlink");
 	secure_ssl                    = cfg_getbool(cfg, "secure-ssl");
 	broken_rtc                    = cfg_getbool(cfg, "broken-rtc");
+	ssl_session_cache             = cfg_getbool(cfg, "ssl-session-cache");
 	ca_trust_file                 = cfg_getstr(cfg, "ca-trust-file");
 	if (ca_trust_file && !fexist(ca_trust_file)) {
 		logit(LOG_ERR, "Cannot find CA trust file %s", ca_trust_file);
@@ -37,40 +37,104 @@
 
 #include "ddns.h"
 #include "cache.h"
+#include "dns.h"
+#include "event.h"
 #include "log.h"
+#include "netlink.h"
+#include "ssl.h"
 #include "base64.h"
 #include "md5.h"
 #include "sha1.h"
 
 /* Conversation with the checkip server */
 #define DYNDNS_CHECKIP_HTTP_REQUEST  					\
-	"GET %s HTTP/1.0\r\n"						\
+	"GET %s HTTP/1.1\r\n"						\
 	"Host: %s\r\n"							\
 	"User-Agent: %s\r\n\r\n"
 
 /* Used to preserve values during reset at SIGHUP.  Time also initialized from cache file at startup. */
 static int cached_num_iterations = 0;
+static int netlink_active = 0;
+
+/* Number of providers with expired timers, waiting to be checked */
+static int pending = 0;
+
+/* One alias update, queued or in flight, see run_jobs() */
+struct job {
+	TAILQ_ENTRY(job) link;
+
+	ddns_info_t     *info;
+	ddns_alias_t   **alias;	/* More than one if batched */
+	int             *result;	/* Outcome of each alias */
+	size_t           num;
+	int              fake;	/* Update to fake address, response ignored */
+
+	http_t           client;
+	http_trans_t     trans;
+};
+
+static TAILQ_HEAD(, job) jobs = TAILQ_HEAD_INITIALIZER(jobs);
+static int running = 0;
+
+/*
+ * Address sources: checkip-command, interface, or checkip server.  The
+ * outcome of each source is only looked up once per check, all other
+ * providers using the same source get the same result.
+ */
+enum {
+	SOURCE_CMD,
+	SOURCE_IFACE,
+	SOURCE_REMOTE,
+};
+
+struct source {
+	LIST_ENTRY(source) link;
+
+	int              rc;
+	char             address[MAX_ADDRESS_LEN];
+	char             key[];
+};
+
+static LIST_HEAD(, source) sources = LIST_HEAD_INITIALIZER(sources);
 extern ddns_info_t *conf_info_iterator(int first);
 
 
-static int wait_for_cmd(ddns_t *ctx)
+/* Timer callback, the provider is checked from the main loop */
+static void provider_due(event_timer_t *timer, void *arg)
+{
+	ddns_info_t *info = (ddns_info_t *)arg;
+
+	if (!info->due)
+		pending++;
+	info->due = 1;
+}
+
+/*
+ * Sleep in the event loop until the timer of a provider expires, or a
+ * signal sets a command.  With @sec >= 0, also wake up after at most
+ * @sec seconds.  Deadlines are on the monotonic clock, so changes to
+ * system time, e.g. by NTP, cannot cause us to sleep too long.
+ */
+static int wait_for_cmd(ddns_t *ctx, int sec)
 {
-	int counter;
-	ddns_cmd_t old_cmd;
+	long long deadline = 0;
 
 	if (!ctx)
 		return RC_INVALID_POINTER;
 
-	old_cmd = ctx->cmd;
-	if (old_cmd != NO_CMD)
-		return 0;
+	if (sec >= 0)
+		deadline = event_now() + (long long)sec * 1000;
 
-	counter = ctx->update_period / ctx->cmd_check_period;
-	while (counter--) {
-		if (ctx->cmd != old_cmd)
-			break;
+	while (ctx->cmd == NO_CMD && !pending) {
+		int msec = -1;
+
+		if (deadline) {
+			msec = event_msec(deadline);
+			if (!msec)
+				break;
+		}
 
-		sleep(ctx->cmd_check_period);
+		event_poll(msec);
 	}
 
 	return 0;
@@ -162,151 +226,14 @@ static int server_transaction(ddns_t *ctx, ddns_info_t *provider)
 	return rc;
 }
 
-/*
- * IP address validator, discards empty, local, loopback and other
- * globally invalid addresses
- */
-static int is_address_valid(int family, const char *host)
-{
-	if (!verify_addr) {
-		logit(LOG_DEBUG, "IP address validation disabled, %s is thus valid.", host);
-		return 1;
-	}
-
-	if (family == AF_INET) {
-		in_addr_t addr;
-		struct in_addr address;
-
-		logit(LOG_DEBUG, "Checking IPv4 address %s ...", host);
-		if (!inet_pton(family, host, &address))
-			goto error;
-
-		addr = ntohl(address.s_addr);
-		if (IN_ZERONET(addr)   || IN_LOOPBACK(addr) || IN_LINKLOCAL(addr) ||
-		    IN_MULTICAST(addr) || IN_EXPERIMENTAL(addr))
-			goto error;
-
-		logit(LOG_DEBUG, "IPv4 address %s is valid.", host);
-		return 1;
-	}
-
-	if (!allow_ipv6) {
-		logit(LOG_INFO, "IPv6 address disallowed, enable with 'allow-ipv6 = true'");
-		return 0;
-	}
-
-	if (family == AF_INET6) {
-		struct in6_addr address, *addr = &address;
-
-		logit(LOG_DEBUG, "Checking IPv6 address %s ...", host);
-		if (!inet_pton(family, host, &address))
-			goto error;
-
-		if (IN6_IS_ADDR_UNSPECIFIED(addr) || IN6_IS_ADDR_LOOPBACK(addr) ||
-		    IN6_IS_ADDR_LINKLOCAL(addr)   || IN6_IS_ADDR_SITELOCAL(addr))
-			goto error;
-
-		logit(LOG_DEBUG, "IPv6 address %s is valid.", host);
-		return 1;
-	}
-
-error:
-	logit(LOG_WARNING, "IP%s address %s is not a valid Internet address.",
-	      family == AF_INET ? "v4" : family == AF_INET6 ? "v6" : "", host);
-	return 0;
-}
-
-static int parse_ipv4_address(char *buffer, char *address, size_t len)
-{
-	int found = 0;
-	char *accept = "0123456789.";
-	char *needle, *haystack, *end;
-	struct in_addr  addr;
-
-	haystack = buffer;
-	needle   = haystack;
-	end      = haystack + strlen(haystack) - 1;
-	while (needle && haystack < end) {
-		char ch;
-		size_t num = 0;
-
-		needle = strpbrk(haystack, accept);
-		if (needle) {
-			num = strspn(needle, accept);
-			if (num) {
-				ch = needle[num];
-				needle[num] = 0;
-
-				if (inet_pton(AF_INET, needle, &addr) == 1) {
-					inet_ntop(AF_INET, &addr, address, len);
-					if (is_address_valid(AF_INET, address)) {
-						found = 1;
-						break;
-					}
-				}
-
-				needle[num] = ch;
-			}
-		}
-
-		/* nothing yet, skip to next search point */
-		haystack = needle + num + 1;
-	}
-
-	return found;
-}
-
-static int parse_ipv6_address(char *buffer, char *address, size_t len)
-{
-	int found = 0;
-	char *accept = "0123456789abcdefABCDEF:";
-	char *needle, *haystack, *end;
-	struct in6_addr addr;
-
-	haystack = buffer;
-	needle   = haystack;
-	end      = haystack + strlen(haystack) - 1;
-	while (needle && haystack < end) {
-		char ch;
-		size_t num = 0;
-
-		needle = strpbrk(haystack, accept);
-		if (needle) {
-			num = strspn(needle, accept);
-			if (num) {
-				ch = needle[num];
-				needle[num] = 0;
-
-				if (inet_pton(AF_INET6, needle, &addr) == 1) {
-					inet_ntop(AF_INET6, &addr, address, len);
-					if (is_address_valid(AF_INET6, address)) {
-						found = 1;
-						break;
-					}
-				}
-
-				needle[num] = ch;
-			}
-		}
-
-		/* nothing yet, skip to next search point */
-		haystack = needle + num + 1;
-	}
-
-	return found;
-}
-
 static int parse_my_address(char *buffer, char *address, size_t len)
 {
-	if (parse_ipv6_address(buffer, address, len))
-		return 0;
-
-	return !parse_ipv4_address(buffer, address, len);
+	return !parse_address(buffer, AF_UNSPEC, address, len);
 }
 
 static int get_address_remote(ddns_t *ctx, ddns_info_t *info, char *address, size_t len)
 {
-	if (!info->server_url[0])
+	if (!info->checkip_url[0])
 		return 1;
 
 	DO(server_transaction(ctx, info));
@@ -429,18 +356,102 @@ static int get_address_iface(ddns_t *ctx, const char *ifname, char *address, siz
 	return 0;
 }
 
+/* Identify source, a checkip-command may use the provider and user from the environment */
+static void source_key(ddns_info_t *info, int type, char *key, size_t len)
+{
+	const char *host;
+	int port;
+
+	switch (type) {
+	case SOURCE_CMD:
+		snprintf(key, len, "cmd:INADYN_PROVIDER=\"%s\" INADYN_USER=\"%s\" %s",
+			 info->system->name, info->creds.username,
+			 info->checkip_cmd ? info->checkip_cmd : "");
+		break;
+
+	case SOURCE_IFACE:
+		snprintf(key, len, "iface:%s", iface ? iface : "");
+		break;
+
+	default:
+		/* Remote name and port is that of the proxy, if any */
+		http_get_remote_name(&info->checkip, &host);
+		http_get_port(&info->checkip, &port);
+		snprintf(key, len, "%s://%s%s@%s:%d", info->checkip_ssl ? "https" : "http",
+			 info->checkip_name.name, info->checkip_url, host ? host : "", port);
+		break;
+	}
+}
+
+static int get_address_source(ddns_t *ctx, ddns_info_t *info, int type, char *address, size_t len)
+{
+	char key[DDNS_HTTP_REQUEST_BUFFER_SIZE];
+	struct source *src;
+	int rc;
+
+	/* Not configured, try next source */
+	if ((type == SOURCE_CMD   && (!info->checkip_cmd || !info->checkip_cmd[0])) ||
+	    (type == SOURCE_IFACE && (!iface || !iface[0])))
+		return 1;
+
+	source_key(info, type, key, sizeof(key));
+	LIST_FOREACH(src, &sources, link) {
+		if (strcmp(src->key, key))
+			continue;
+
+		logit(LOG_DEBUG, "Reusing result from %s for %s", key, info->system->name);
+		strlcpy(address, src->address, len);
+		return src->rc;
+	}
+
+	switch (type) {
+	case SOURCE_CMD:
+		rc = get_address_cmd(ctx, info, address, len);
+		break;
+
+	case SOURCE_IFACE:
+		rc = get_address_iface(ctx, iface, address, len);
+		break;
+
+	default:
+		rc = get_address_remote(ctx, info, address, len);
+		break;
+	}
+
+	src = calloc(1, sizeof(*src) + strlen(key) + 1);
+	if (src) {
+		src->rc = rc;
+		strlcpy(src->address, address, sizeof(src->address));
+		strcpy(src->key, key);
+		LIST_INSERT_HEAD(&sources, src, link);
+	}
+
+	return rc;
+}
+
+/* Forget all sources, next check must look up the address again */
+static void flush_sources(void)
+{
+	struct source *src, *tmp;
+
+	LIST_FOREACH_SAFE(src, &sources, link, tmp) {
+		LIST_REMOVE(src, link);
+		free(src);
+	}
+}
+
 static int get_address_backend(ddns_t *ctx, ddns_info_t *info, char *address, size_t len)
 {
 	logit(LOG_DEBUG, "Get address for %s", info->system->name);
 	memset(address, 0, len);
 
-	if (!get_address_cmd   (ctx, info, address, len))
+	if (!get_address_source(ctx, info, SOURCE_CMD,    address, len))
 		return 0;
 
-	if (!get_address_iface (ctx, iface,address, len))
+	if (!get_address_source(ctx, info, SOURCE_IFACE,  address, len))
 		return 0;
 
-	if (!get_address_remote(ctx, info, address, len))
+	if (!get_address_source(ctx, info, SOURCE_REMOTE, address, len))
 		return 0;
 
 	logit(LOG_ERR, "Failed to get IP address for %s, giving up!", info->system->name);
@@ -449,238 +460,386 @@ static int get_address_backend(ddns_t *ctx, ddns_info_t *info, char *address, si
 }
 
 /*
- * Fetch IP, using any of the backends for each DDNS provider,
+ * Fetch IP, using any of the backends for the DDNS provider,
  * then check for address change.
  */
-static int get_address(ddns_t *ctx)
+static int get_address(ddns_t *ctx, ddns_info_t *info)
 {
 	char address[MAX_ADDRESS_LEN];
-	ddns_info_t *info;
-
-	info = conf_info_iterator(1);
-	while (info) {
-		int anychange = 0;
-		size_t i;
+	int anychange = 0;
+	size_t i;
 
-		if (get_address_backend(ctx, info, address, sizeof(address)))
-			goto next;
+	if (get_address_backend(ctx, info, address, sizeof(address)))
+		return 0;
 
-		for (i = 0; i < info->alias_count; i++) {
-			ddns_alias_t *alias = &info->alias[i];
+	for (i = 0; i < info->alias_count; i++) {
+		ddns_alias_t *alias = &info->alias[i];
 
-			alias->ip_has_changed = strncmp(alias->address, address, sizeof(alias->address)) != 0;
-			if (alias->ip_has_changed) {
-				anychange++;
-				strlcpy(alias->address, address, sizeof(alias->address));
-			}
+		alias->ip_has_changed = strncmp(alias->address, address, sizeof(alias->address)) != 0;
+		if (alias->ip_has_changed) {
+			anychange++;
+			strlcpy(alias->address, address, sizeof(alias->address));
+		}
 
 #ifdef ENABLE_SIMULATION
-			logit(LOG_WARNING, "In simulation, forcing IP# change ...");
-			alias->ip_has_changed = 1;
+		logit(LOG_WARNING, "In simulation, forcing IP# change ...");
+		alias->ip_has_changed = 1;
 #endif
-		}
-
-		if (!anychange)
-			logit(LOG_INFO, "No IP# change detected for %s, still at %s", info->system->name, address);
-		else
-			logit(LOG_INFO, "Current IP# %s at %s", address, info->system->name);
-
-	next:
-		info = conf_info_iterator(0);
 	}
 
+	if (!anychange)
+		logit(LOG_INFO, "No IP# change detected for %s, still at %s", info->system->name, address);
+	else
+		logit(LOG_INFO, "Current IP# %s at %s", address, info->system->name);
+
 	return 0;
 }
 
-static int time_to_check(ddns_t *ctx, ddns_alias_t *alias)
+static int time_to_check(ddns_info_t *info, ddns_alias_t *alias)
 {
 	time_t past_time = time(NULL) - alias->last_update;
 
-	return ctx->force_addr_update ||
-		(past_time > ctx->forced_update_period_sec);
+	return info->force_addr_update ||
+		(past_time > info->forced_update_period);
 }
 
-static int check_alias_update_table(ddns_t *ctx)
+static int check_alias_update_table(ddns_t *ctx, ddns_info_t *info)
 {
-	ddns_info_t *info;
+	size_t i;
 
-	/* Uses fix test if ip of server 0 has changed.
-	 * That should be OK even if changes check_address() to
-	 * iterate over servernum, but not if it's fix set to =! 0 */
-	info = conf_info_iterator(1);
-	while (info) {
-		size_t i;
-
-		for (i = 0; i < info->alias_count; i++) {
-			int override;
-			ddns_alias_t *alias = &info->alias[i];
+	for (i = 0; i < info->alias_count; i++) {
+		int override;
+		ddns_alias_t *alias = &info->alias[i];
 
 /* XXX: TODO time_to_check() will return false positive if the cache
  *     file is missing => causing unnnecessary update.  We should save
  *     the cache file with the current IP instead and fall back to
  *     standard update interval!
  */
-			override = time_to_check(ctx, alias);
-			if (!alias->ip_has_changed && !override) {
-				alias->update_required = 0;
-				continue;
-			}
-
-			alias->update_required = 1;
-			logit(LOG_NOTICE, "Update %s for alias %s, new IP# %s",
-			      override ? "forced" : "needed", alias->name, alias->address);
+		override = time_to_check(info, alias);
+		if (!alias->ip_has_changed && !override) {
+			alias->update_required = 0;
+			continue;
 		}
 
-		info = conf_info_iterator(0);
+		alias->update_required = 1;
+		logit(LOG_NOTICE, "Update %s for alias %s, new IP# %s",
+		      override ? "forced" : "needed", alias->name, alias->address);
 	}
 
 	return 0;
 }
 
-static int send_update(ddns_t *ctx, ddns_info_t *info, ddns_alias_t *alias, int *changed)
+/* Successful update, save in cache and run any user script */
+static void alias_updated(ddns_alias_t *alias)
 {
-	int            rc;
-	http_trans_t   trans;
-	http_t        *client = &info->server;
+	alias->update_required = 0;
+	alias->last_update = time(NULL);
 
-	if (info->system->setup)
-		DO(info->system->setup(ctx, info, alias));
+	/* Update cache file for this entry */
+	write_cache_file(alias);
 
-	client->ssl_enabled = info->ssl_enabled;
-	rc = http_init(client, "Sending IP# update to DDNS server");
-	if (rc) {
-		/* Update failed, force update again in ctx->cmd_check_period seconds */
-		ctx->force_addr_update = 1;
-		return rc;
-	}
+	/* Run command or script on successful update. */
+	if (script_exec)
+		os_shell_execute(script_exec, alias->address, alias->name);
+}
 
-	memset(ctx->work_buf, 0, ctx->work_buflen);
-	memset(ctx->request_buf, 0, ctx->request_buflen);
-	memset(&trans, 0, sizeof(trans));
+/*
+ * Only DDNS server errors are reported, all other errors of an update,
+ * e.g. network errors, are temporary and retried with backoff, see
+ * check_error().  Each also forces an update at the next check.
+ */
+static void remember(ddns_info_t *info, int rc)
+{
+	if (!rc)
+		return;
+
+	info->force_addr_update = 1;
+	if (RC_DDNS_RSP_NOTOK == rc || RC_DDNS_RSP_AUTH_FAIL == rc)
+		info->rc = rc;
+	else if (!info->rc)
+		info->rc = RC_DDNS_RSP_RETRY_LATER;
+}
 
-	trans.req_len     = info->system->request(ctx, info, alias);
-	trans.req         = (char *)ctx->request_buf;
-	trans.rsp         = (char *)ctx->work_buf;
-	trans.max_rsp_len = ctx->work_buflen - 1;	/* Save place for a \0 at the end */
+static void update_done(http_t *client, http_trans_t *trans, int rc, void *arg)
+{
+	struct job   *job   = (struct job *)arg;
+	ddns_info_t  *info  = job->info;
+	size_t        i;
+	int           err = 0;
 
-	if (trans.req_len < 0) {
-		logit(LOG_ERR, "Invalid HTTP GET request in %s provider, cannot update.", info->system->name);
-		rc = RC_ERROR;
+	running--;
 
+	if (rc) {
+		logit(LOG_WARNING, "HTTP(S) Transaction failed, error %d: %s", rc, error_str(rc));
+		if (job->fake)
+			goto exit;
+
+		/* Update failed, force update again at next check */
+		logit(LOG_INFO, "Update failed, forcing update at next retry ...");
+		remember(info, rc);
 		goto exit;
 	}
+	logit(LOG_DEBUG, "DDNS server response: %s", trans->rsp);
 
-#ifdef ENABLE_SIMULATION
-	logit(LOG_WARNING, "In simulation, skipping update to server ...");
-	goto exit;
-#endif
+	/* If the DDNS server responds with an error, we ignore it here,
+	 * since this is just to fool the DDNS server to register a a
+	 * change, i.e., an active user. */
+	if (job->fake)
+		goto exit;
 
-	ctx->request_buf[trans.req_len] = 0;
-	logit(LOG_DEBUG, "Sending alias table update to DDNS server: %s", ctx->request_buf);
+	if (job->num > 1)
+		info->system->batch_response(trans, info, job->alias, job->num, job->result);
+	else
+		job->result[0] = info->system->response(trans, info, job->alias[0]);
 
-	rc = http_transaction(client, &trans);
-	if (rc) {
-		/* Update failed, force update again in ctx->cmd_check_period seconds */
-		logit(LOG_WARNING, "HTTP(S) Transaction failed, error %d: %s", rc, error_str(rc));
-		logit(LOG_INFO, "Update failed, forced update/retry in %d sec ...", ctx->cmd_check_period);
-		ctx->force_addr_update = 1;
-		goto exit;
-	}
-	logit(LOG_DEBUG, "DDNS server response: %s", trans.rsp);
+	for (i = 0; i < job->num; i++) {
+		ddns_alias_t *alias = job->alias[i];
 
-	rc = info->system->response(&trans, info, alias);
-	if (rc) {
-		logit(LOG_WARNING, "%s error in DDNS server response:",
-		      rc == RC_DDNS_RSP_RETRY_LATER ? "Temporary" : "Fatal");
-		logit(LOG_WARNING, "[%d %s] %s", trans.status, trans.status_desc,
-		      trans.rsp_body != trans.rsp ? trans.rsp_body : "");
+		rc = job->result[i];
+		if (rc) {
+			logit(LOG_WARNING, "%s error in DDNS server response for %s",
+			      rc == RC_DDNS_RSP_RETRY_LATER ? "Temporary" : "Fatal", alias->name);
 
-		/* Update failed, force update again in ctx->cmd_check_period seconds */
-		ctx->force_addr_update = 1;
-	} else {
-		logit(LOG_INFO, "Successful alias table update for %s => new IP# %s",
-		      alias->name, alias->address);
+			/* Update failed, force update again at next check */
+			remember(info, rc);
+			err = 1;
+		} else {
+			logit(LOG_INFO, "Successful alias table update for %s => new IP# %s",
+			      alias->name, alias->address);
 
-		ctx->force_addr_update = 0;
-		if (changed)
-			(*changed)++;
+			info->force_addr_update = 0;
+			alias_updated(alias);
+		}
+	}
+
+	if (err) {
+		logit(LOG_WARNING, "[%d %s] %s", trans->status, trans->status_desc,
+		      trans->rsp_body != trans->rsp ? trans->rsp_body : "");
+
+		if (trans->retry_after > info->retry_after)
+			info->retry_after = trans->retry_after;
 	}
 
 exit:
 	http_exit(client);
-
-	return rc;
+	free(trans->rsp);
+	trans->rsp = NULL;
 }
 
-static int update_alias_table(ddns_t *ctx)
+/*
+ * Aliases the plugin setup() finds already up to date are dropped from
+ * @alias, and @num.  Returns length of request, or -RC_* on error.
+ */
+static int build_request(ddns_t *ctx, ddns_info_t *info, ddns_alias_t **alias, size_t *num, int fake)
 {
-	int rc = 0, remember = 0;
-	int anychange = 0;
-	ddns_info_t *info;
+	size_t i, j;
+	int len;
+
+	for (i = j = 0; i < *num; i++) {
+		int rc = 0;
+
+		if (info->system->setup)
+			rc = info->system->setup(ctx, info, alias[i]);
+		if (rc == RC_DDNS_RSP_UNCHANGED) {
+			if (!fake) {
+				logit(LOG_INFO, "DNS record of %s already has IP# %s, skipping update.",
+				      alias[i]->name, alias[i]->address);
+				info->force_addr_update = 0;
+				alias_updated(alias[i]);
+			}
+			continue;
+		}
+		if (rc)
+			return -rc;
 
-	/* Issue #15: On external trig. force update to random addr. */
-	if (ctx->force_addr_update && ctx->forced_update_fake_addr) {
-		/* If the DDNS server responds with an error, we ignore it here,
-		 * since this is just to fool the DDNS server to register a a
-		 * change, i.e., an active user. */
-		info = conf_info_iterator(1);
-		while (info) {
-			size_t i;
+		alias[j++] = alias[i];
+	}
 
-			for (i = 0; i < info->alias_count; i++) {
-				ddns_alias_t *alias = &info->alias[i];
-				char backup[sizeof(alias->address)];
+	*num = j;
+	if (!j)
+		return 0;
 
-				strlcpy(backup, alias->address, sizeof(backup));
+	memset(ctx->request_buf, 0, ctx->request_buflen);
+	if (j > 1)
+		len = info->system->batch_request(ctx, info, alias, j);
+	else
+		len = info->system->request(ctx, info, alias[0]);
 
-				/* Picking random address in 203.0.113.0/24 ... */
-				snprintf(alias->address, sizeof(alias->address), "203.0.113.%d", (rand() + 1) % 255);
-				TRY(send_update(ctx, info, alias, NULL));
+	if (len < 0 || (size_t)len >= ctx->request_buflen)
+		return -RC_BUFFER_OVERFLOW;
 
-				strlcpy(alias->address, backup, sizeof(alias->address));
-			}
+	return len;
+}
+
+/* Prepare request, the update is sent later by run_jobs() */
+static int queue_update(ddns_t *ctx, ddns_info_t *info, ddns_alias_t **alias, size_t num, int fake)
+{
+	struct job *job;
+	size_t i;
+	int len;
 
-			info = conf_info_iterator(0);
+	len = build_request(ctx, info, alias, &num, fake);
+	if (len == -RC_BUFFER_OVERFLOW && num > 1) {
+		int rc = 0;
+
+		/* Batch too large for request buffer, fall back to one at a time */
+		for (i = 0; i < num; i++) {
+			int err = queue_update(ctx, info, &alias[i], 1, fake);
+
+			if (err)
+				rc = err;
 		}
 
-		/* Play nice with server, wait a bit before sending actual IP */
-		sleep(3);
+		return rc;
+	}
+	if (len == -RC_BUFFER_OVERFLOW) {
+		logit(LOG_ERR, "Invalid HTTP GET request in %s provider, cannot update.", info->system->name);
+		return RC_ERROR;
 	}
+	if (len < 0)
+		return -len;
+	if (!num)
+		return 0;
 
-	info = conf_info_iterator(1);
-	while (info) {
-		size_t i;
+#ifdef ENABLE_SIMULATION
+	logit(LOG_WARNING, "In simulation, skipping update to server ...");
+	for (i = 0; !fake && i < num; i++)
+		alias_updated(alias[i]);
+	return 0;
+#endif
 
-		for (i = 0; i < info->alias_count; i++) {
-			ddns_alias_t *alias = &info->alias[i];
+	/* Request is copied, ctx->request_buf is reused for the next update */
+	job = calloc(1, sizeof(*job) + num * (sizeof(*job->alias) + sizeof(*job->result)) + len + 1);
+	if (!job)
+		return RC_OUT_OF_MEMORY;
 
-			if (!alias->update_required)
-				continue;
+	job->info   = info;
+	job->alias  = (ddns_alias_t **)(job + 1);
+	job->result = (int *)(job->alias + num);
+	job->num    = num;
+	job->fake   = fake;
+	for (i = 0; i < num; i++)
+		job->alias[i] = alias[i];
 
-			TRY(send_update(ctx, info, alias, &anychange));
+	job->client = info->server;
+	job->client.ssl_enabled = info->ssl_enabled;
 
-			/* Only reset if send_update() succeeds. */
-			alias->update_required = 0;
-			alias->last_update = time(NULL);
+	job->trans.req_len = len;
+	job->trans.req     = (char *)(job->result + num);
+	memcpy(job->trans.req, ctx->request_buf, len);
+
+	TAILQ_INSERT_TAIL(&jobs, job, link);
+
+	return 0;
+}
+
+static void start_update(ddns_t *ctx, struct job *job)
+{
+	int rc;
+
+	running++;
+
+	job->trans.rsp         = malloc(ctx->work_buflen);
+	job->trans.max_rsp_len = ctx->work_buflen - 1;	/* Save place for a \0 at the end */
+	if (!job->trans.rsp) {
+		update_done(&job->client, &job->trans, RC_OUT_OF_MEMORY, job);
+		return;
+	}
 
-			/* Update cache file for this entry */
-			write_cache_file(alias);
+	logit(LOG_DEBUG, "Sending alias table update to DDNS server: %s", job->trans.req);
+	rc = http_start(&job->client, &job->trans, "Sending IP# update to DDNS server", update_done, job);
+	if (rc)
+		update_done(&job->client, &job->trans, rc, job);
+}
 
-			/* Run command or script on successful update. */
-			if (script_exec)
-				os_shell_execute(script_exec, alias->address, alias->name);
+/*
+ * Send all queued updates, at most parallel-updates at a time, 0 for no
+ * limit, and wait for them to complete.  Each update has a deadline, so
+ * this is bounded by the slowest DDNS server rather than the sum of all.
+ */
+static void run_jobs(ddns_t *ctx)
+{
+	struct job *job, *next;
+
+	next = TAILQ_FIRST(&jobs);
+	while (next || running) {
+		while (next && (!ctx->parallel_updates || running < ctx->parallel_updates)) {
+			job  = next;
+			next = TAILQ_NEXT(job, link);
+			start_update(ctx, job);
 		}
 
-		if (RC_DDNS_RSP_NOTOK == rc || RC_DDNS_RSP_AUTH_FAIL == rc)
-			remember = rc;
+		if (running)
+			event_poll(-1);
+	}
+
+	while ((job = TAILQ_FIRST(&jobs))) {
+		TAILQ_REMOVE(&jobs, job, link);
+		free(job);
+	}
+}
+
+/* Issue #15: On external trig. force update to random addr. */
+static int queue_fake_updates(ddns_t *ctx, ddns_info_t *info)
+{
+	int num = 0;
+	size_t i;
 
-		if (RC_DDNS_RSP_RETRY_LATER == rc && !remember)
-			remember = rc;
+	for (i = 0; i < info->alias_count; i++) {
+		ddns_alias_t *alias = &info->alias[i];
+		char backup[sizeof(alias->address)];
 
-		info = conf_info_iterator(0);
+		strlcpy(backup, alias->address, sizeof(backup));
+
+		/* Picking random address in 203.0.113.0/24 ... */
+		snprintf(alias->address, sizeof(alias->address), "203.0.113.%d", (rand() + 1) % 255);
+		if (!queue_update(ctx, info, &alias, 1, 1))
+			num++;
+
+		strlcpy(alias->address, backup, sizeof(alias->address));
 	}
 
-	return remember;
+	return num;
+}
+
+/*
+ * Queue updates of all aliases marked for update.  Providers supporting
+ * it get up to .batch hostnames in each request, e.g. dyndns2 accepts a
+ * comma separated list, saving one round trip per hostname.
+ */
+static void queue_updates(ddns_t *ctx, ddns_info_t *info)
+{
+	ddns_alias_t **batch;
+	size_t max = 1;
+	size_t i, num = 0;
+
+	if (info->system->batch_request && info->system->batch_response && info->system->batch > 1)
+		max = info->system->batch;
+
+	batch = calloc(max, sizeof(*batch));
+	if (!batch) {
+		remember(info, RC_OUT_OF_MEMORY);
+		return;
+	}
+
+	for (i = 0; i < info->alias_count; i++) {
+		ddns_alias_t *alias = &info->alias[i];
+
+		if (!alias->update_required)
+			continue;
+
+		batch[num++] = alias;
+		if (num == max) {
+			remember(info, queue_update(ctx, info, batch, num, 0));
+			num = 0;
+		}
+	}
+
+	if (num)
+		remember(info, queue_update(ctx, info, batch, num, 0));
+
+	free(batch);
 }
 
 static int get_encoded_user_passwd(void)
@@ -782,46 +941,148 @@ static int init_context(ddns_t *ctx)
 			http_set_remote_name(update,  info->server_name.name);
 		}
 
+		/* Per provider schedule, unless set, follows global settings */
+		if (!info->period)
+			info->period = ctx->normal_update_period_sec;
+		if (!info->error_period)
+			info->error_period = ctx->error_update_period_sec;
+		if (!info->forced_update_period)
+			info->forced_update_period = ctx->forced_update_period_sec;
+		if (info->timeout <= 0)
+			info->timeout = ctx->timeout_sec;
+
+		/* Deadline of each transaction: DNS, connect, TLS and response */
+		http_set_remote_timeout(checkip, info->timeout * 1000);
+		http_set_remote_timeout(update,  info->timeout * 1000);
+
+		/* Restore values, if reset by SIGHUP. */
+		info->num_iterations = cached_num_iterations;
+		event_timer_init(&info->timer, provider_due, info);
+
 		info = conf_info_iterator(0);
 	}
 
-	/* Restore values, if reset by SIGHUP.  Initialize time from cache file at startup. */
-	ctx->num_iterations = cached_num_iterations;
-
 	ctx->initialized = 1;
 
 	return 0;
 }
 
-static int check_address(ddns_t *ctx)
+static int check_address(ddns_t *ctx, ddns_info_t *info)
 {
-	if (!ctx)
+	if (!ctx || !info)
 		return RC_INVALID_POINTER;
 
 	/* Get IP address from any of the different backends */
-	DO(get_address(ctx));
+	DO(get_address(ctx, info));
 
 	/* Step through aliases list, resolve them and check if they point to my IP */
-	DO(check_alias_update_table(ctx));
-
-	/* Update IPs marked as not identical with my IP */
-	DO(update_alias_table(ctx));
+	DO(check_alias_update_table(ctx, info));
 
 	return 0;
 }
 
+/*
+ * Providers whose address netlink can see change: those looking it up
+ * on --iface, or from a checkip server behind the default route, not
+ * with a checkip-command.
+ */
+static int netlink_watched(ddns_info_t *info)
+{
+	if (!netlink_active)
+		return 0;
+
+	if (info->checkip_cmd && info->checkip_cmd[0])
+		return 0;
+
+	return 1;
+}
+
+/*
+ * With netlink monitoring of --iface, and no checkip-command to run,
+ * nothing can change without us being notified.  So there is no need
+ * to poll, only wake up in time for the next forced update.
+ */
+static int event_driven(ddns_info_t *info)
+{
+	return iface && netlink_watched(info);
+}
+
+/*
+ * Seconds until the first of the provider's aliases is due for a forced
+ * update, or -1 if none.  Aliases already overdue, i.e., failed updates,
+ * are retried at the regular or error period.
+ */
+static int next_forced_update(ddns_info_t *info)
+{
+	time_t now = time(NULL);
+	int period = -1;
+	size_t i;
+
+	for (i = 0; i < info->alias_count; i++) {
+		time_t left;
+
+		/* time_to_check() needs forced_update_period to have passed */
+		left = info->alias[i].last_update + info->forced_update_period - now + 1;
+		if (left > 0 && (period < 0 || left < period))
+			period = left;
+	}
+
+	if (period >= 0 && period < DDNS_MIN_PERIOD)
+		period = DDNS_MIN_PERIOD;
+
+	return period;
+}
+
+/*
+ * Exponential backoff with full jitter: a random delay up to a ceiling
+ * that doubles with each consecutive error, from DDNS_MIN_PERIOD up to
+ * the provider's error period.  This way thousands of clients, failing
+ * at the same time, do not retry in lockstep when the DDNS server comes
+ * back.  The server can ask for a longer delay with Retry-After.
+ */
+static int backoff(ddns_info_t *info)
+{
+	int ceiling = DDNS_MIN_PERIOD;
+	int period, i;
+
+	for (i = 0; i < info->retries && ceiling < info->error_period; i++)
+		ceiling *= 2;
+
+	if (ceiling >= info->error_period)
+		ceiling = info->error_period;
+	else
+		info->retries++;
+
+	period = 1 + rand() % ceiling;
+	if (period < info->retry_after)
+		period = info->retry_after;
+	if (period > DDNS_MAX_PERIOD)
+		period = DDNS_MAX_PERIOD;
+
+	return period;
+}
+
 /*
  * Error filter.  Some errors are to be expected in a network
  * application, some we can recover from, wait a shorter while and try
  * again, whereas others are terminal, e.g., some OS errors.
+ *
+ * Sets the time until the next check of the provider in @period.
  */
-static int check_error(ddns_t *ctx, int rc)
+static int check_error(ddns_info_t *info, int rc, int *period)
 {
 	const char *errstr = "Error response from DDNS server";
+	int forced;
+
+	*period = info->period;
 
 	switch (rc) {
 	case RC_OK:
-		ctx->update_period = ctx->normal_update_period_sec;
+		info->retries = 0;
+
+		/* Pending updates are retried at the regular period, no event may come */
+		if (event_driven(info) && !info->force_addr_update)
+			*period = info->forced_update_period;
 		break;
 
 	/* dyn_dns_update_ip() failed, inform the user the (network) error
@@ -833,8 +1094,8 @@ static int check_error(ddns_t *ctx, int rc)
 	case RC_OS_INVALID_IP_ADDRESS:
 	case RC_DDNS_RSP_RETRY_LATER:
 	case RC_DDNS_INVALID_CHECKIP_RSP:
-		ctx->update_period = ctx->error_update_period_sec;
-		logit(LOG_WARNING, "Will retry again in %d sec ...", ctx->update_period);
+		*period = backoff(info);
+		logit(LOG_WARNING, "Will retry %s again in %d sec ...", info->system->name, *period);
 		break;
 
 	case RC_DDNS_RSP_NOTOK:
@@ -852,13 +1113,179 @@ static int check_error(ddns_t *ctx, int rc)
 		return 1;
 	}
 
+	/* Never sleep past the next forced update of any alias, unless told to */
+	forced = next_forced_update(info);
+	if (forced > 0 && *period > forced && forced >= info->retry_after)
+		*period = forced;
+
+	return 0;
+}
+
+/*
+ * Reschedule provider after its check.  Providers that have run all
+ * their iterations are not rescheduled.
+ */
+static int schedule_provider(ddns_t *ctx, ddns_info_t *info, int rc)
+{
+	int period;
+
+	if (RC_OK == rc)
+		info->num_iterations++;
+
+	if (check_error(info, rc, &period))
+		return rc;
+
+	if (ctx->total_iterations != 0 && info->num_iterations >= ctx->total_iterations)
+		return 0;
+
+	logit(LOG_DEBUG, "Next check of %s in %d sec", info->system->name, period);
+	if (event_timer_set(&info->timer, (long long)period * 1000))
+		return RC_OUT_OF_MEMORY;
+
 	return 0;
 }
 
+/*
+ * Check address of all providers with expired timers, then send all
+ * their updates at the same time, see run_jobs().  Returns non-zero
+ * on unrecoverable error.
+ */
+static int check_providers(ddns_t *ctx)
+{
+	ddns_info_t *info;
+	int fake = 0;
+	int rc = 0;
+
+	/* Plugins may keep what they learn from servers for this check only */
+	ctx->check++;
+
+	/* Providers sharing an address source only look it up once */
+	flush_sources();
+
+	/* No connections in use between checks, safe to reload CA trust store */
+	if (ssl_changed()) {
+		logit(LOG_INFO, "CA trust file %s has changed, reloading ...", ca_trust_file);
+		http_pool_flush();
+		ssl_reload();
+	}
+
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0)) {
+		if (!info->due)
+			continue;
+
+		info->due = 0;
+		pending--;
+
+		info->checking = 1;
+		info->retry_after = 0;
+		info->rc = check_address(ctx, info);
+		if (info->rc)
+			continue;
+
+		if (info->force_addr_update && ctx->forced_update_fake_addr)
+			fake += queue_fake_updates(ctx, info);
+	}
+
+	if (fake) {
+		run_jobs(ctx);
+
+		/* Play nice with server, wait a bit before sending actual IP */
+		sleep(3);
+	}
+
+	/* Update IPs marked as not identical with my IP */
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0)) {
+		if (info->checking && !info->rc)
+			queue_updates(ctx, info);
+	}
+	run_jobs(ctx);
+	flush_sources();
+
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0)) {
+		if (!info->checking)
+			continue;
+
+		info->checking = 0;
+		if (!rc)
+			rc = schedule_provider(ctx, info, info->rc);
+	}
+
+	return rc;
+}
+
+/* Mark all providers as due, e.g. on CHECK_NOW, optionally forcing update */
+static void check_all(int force)
+{
+	ddns_info_t *info;
+
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0)) {
+		if (force)
+			info->force_addr_update = 1;
+
+		event_timer_del(&info->timer);
+		provider_due(&info->timer, info);
+	}
+}
+
+/*
+ * Mark providers watched by netlink as due, on address or route change.
+ * Providers backing off from errors, or told by the server when to come
+ * back, keep their timers, so a flapping link cannot hammer a server.
+ */
+static void check_changed(void)
+{
+	ddns_info_t *info;
+
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0)) {
+		if (!netlink_watched(info))
+			continue;
+
+		if (info->retries || info->retry_after) {
+			logit(LOG_DEBUG, "%s backing off, not checking now.", info->system->name);
+			continue;
+		}
+
+		event_timer_del(&info->timer);
+		provider_due(&info->timer, info);
+	}
+}
+
+/* All providers have run their configured number of iterations */
+static int all_done(ddns_t *ctx)
+{
+	ddns_info_t *info;
+
+	if (ctx->total_iterations == 0)
+		return 0;
+
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0)) {
+		if (info->num_iterations < ctx->total_iterations)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Least number of iterations run by any provider, saved across SIGHUP */
+static int min_iterations(void)
+{
+	ddns_info_t *info;
+	int num = -1;
+
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0)) {
+		if (num == -1 || info->num_iterations < num)
+			num = info->num_iterations;
+	}
+
+	return num < 0 ? 0 : num;
+}
+
 int ddns_main_loop(ddns_t *ctx)
 {
 	int rc = 0;
 	static int first_startup = 1;
+	int force_all = once && force;
+	ddns_info_t *info;
 
 	if (!ctx)
 		return RC_INVALID_POINTER;
@@ -872,9 +1299,8 @@ int ddns_main_loop(ddns_t *ctx)
 		logit(LOG_NOTICE, "Startup delay: %d sec ...", startup_delay);
 		first_startup = 0;
 
-		/* Now sleep a while. Using the time set in update_period data member */
-		ctx->update_period = startup_delay;
-		wait_for_cmd(ctx);
+		/* Now sleep a while, no provider timers are running yet */
+		wait_for_cmd(ctx, startup_delay);
 
 		if (ctx->cmd == CMD_STOP) {
 			logit(LOG_NOTICE, "STOP command received, exiting.");
@@ -886,7 +1312,7 @@ int ddns_main_loop(ddns_t *ctx)
 		}
 		if (ctx->cmd == CMD_FORCED_UPDATE) {
 			logit(LOG_INFO, "FORCED_UPDATE command received, updating now.");
-			ctx->force_addr_update = 1;
+			force_all = 1;
 			ctx->cmd = NO_CMD;
 		} else if (ctx->cmd == CMD_CHECK_NOW) {
 			logit(LOG_INFO, "CHECK_NOW command received, leaving startup delay.");
@@ -894,12 +1320,17 @@ int ddns_main_loop(ddns_t *ctx)
 		}
 	}
 
+	pending = 0;
 	DO(init_context(ctx));
 	DO(read_cache_file(ctx));
 	DO(get_encoded_user_passwd());
 
-	if (once && force)
-		ctx->force_addr_update = 1;
+	/* Check all providers at startup, forcing update in --once --force mode */
+	check_all(force_all);
+
+	/* Get notified by the kernel as soon as the address changes */
+	if (use_netlink && !once)
+		netlink_active = !netlink_init(ctx);
 
 	/* Initialization done, create pidfile to indicate we are ready to communicate */
 	if (once == 0 && pidfile_name[0] && pidfile(pidfile_name))
@@ -907,12 +1338,10 @@ int ddns_main_loop(ddns_t *ctx)
 
 	/* DDNS client main loop */
 	while (1) {
-		rc = check_address(ctx);
-		if (RC_OK == rc) {
-			if (ctx->total_iterations != 0 &&
-			    ++ctx->num_iterations >= ctx->total_iterations)
-				break;
-		}
+		/* Check all providers with expired timers */
+		rc = check_providers(ctx);
+		if (rc || all_done(ctx))
+			break;
 
 		if (ctx->cmd == CMD_RESTART) {
 			logit(LOG_INFO, "RESTART command received. Restarting.");
@@ -921,12 +1350,8 @@ int ddns_main_loop(ddns_t *ctx)
 			break;
 		}
 
-		/* On error, check why, possibly need to retry sooner ... */
-		if (check_error(ctx, rc))
-			break;
-
-		/* Now sleep a while. Using the time set in update_period data member */
-		wait_for_cmd(ctx);
+		/* Now sleep until the next provider is due, or a command is received */
+		wait_for_cmd(ctx, -1);
 
 		if (ctx->cmd == CMD_STOP) {
 			logit(LOG_NOTICE, "STOP command received, exiting.");
@@ -940,20 +1365,43 @@ int ddns_main_loop(ddns_t *ctx)
 		}
 		if (ctx->cmd == CMD_FORCED_UPDATE) {
 			logit(LOG_INFO, "FORCED_UPDATE command received, updating now.");
-			ctx->force_addr_update = 1;
+			check_all(1);
 			ctx->cmd = NO_CMD;
 			continue;
 		}
 
 		if (ctx->cmd == CMD_CHECK_NOW) {
 			logit(LOG_INFO, "CHECK_NOW command received, checking ...");
+			check_all(0);
+			ctx->cmd = NO_CMD;
+			continue;
+		}
+
+		if (ctx->cmd == CMD_ADDR_CHANGED) {
+			check_changed();
 			ctx->cmd = NO_CMD;
 			continue;
 		}
 	}
 
 	/* Save old value, if restarted by SIGHUP */
-	cached_num_iterations = ctx->num_iterations;
+	cached_num_iterations = min_iterations();
+
+	/* Provider timers must not outlive the providers */
+	for (info = conf_info_iterator(1); info; info = conf_info_iterator(0))
+		event_timer_del(&info->timer);
+
+	/* Idle connections may be to servers no longer in .conf */
+	http_pool_flush();
+
+	/* TLS settings may have changed, reloaded at next connection */
+	if (rc == RC_RESTART) {
+		ssl_reload();
+		dns_flush();
+	}
+
+	netlink_exit();
+	netlink_active = 0;
 
 	return rc;
 }
@@ -0,0 +1,1368 @@
+/* Non-blocking DNS resolver with a TTL respecting cache
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Inadyn used to call res_init() and getaddrinfo() for every connection,
+ * and for every alias at startup, blocking the whole daemon while a slow
+ * or dead name server was retried.  This is a small stub resolver: A and
+ * AAAA queries are sent in parallel over UDP to the name servers listed
+ * in /etc/resolv.conf, retried over TCP if the reply is truncated, and
+ * all sockets are driven by the event loop.
+ *
+ * Answers, positive and negative, are cached for as long as their TTL
+ * allows, so the same DDNS and checkip servers are not looked up again
+ * every check.  Numeric addresses and /etc/hosts are always honored.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_RANDOM_H
+#include <sys/random.h>
+#endif
+
+#include "compat.h"
+#include "dns.h"
+#include "event.h"
+#include "log.h"
+#include "queue.h"
+
+#define RESOLV_CONF	"/etc/resolv.conf"
+#define HOSTS_FILE	"/etc/hosts"
+
+#define DNS_PORT	53
+#define DNS_MAX_NS	3	/* Name servers used from resolv.conf, like MAXNS */
+#define DNS_TIMEOUT	5	/* sec, per server and attempt, "options timeout:n" */
+#define DNS_ATTEMPTS	2	/* Rounds over all servers, "options attempts:n" */
+#define DNS_NDOTS	1	/* Dots before name is tried as is, "options ndots:n" */
+#define DNS_MAX_SEARCH	6	/* Search domains used from resolv.conf, like MAXDNSRCH */
+#define DNS_MSG_MAX	4096	/* Largest reply accepted */
+#define DNS_EDNS_SIZE	1232	/* UDP payload size announced, DNS flag day 2020 */
+#define DNS_MAX_CNAME	8	/* Max length of CNAME chain */
+
+#define DNS_MAX_TTL	86400	/* sec */
+#define DNS_NEG_TTL	60	/* sec, no such host or no address, when zone has no SOA */
+#define DNS_FAIL_TTL	5	/* sec, name servers timed out or failed */
+
+#define TYPE_A		1
+#define TYPE_CNAME	5
+#define TYPE_SOA	6
+#define TYPE_AAAA	28
+#define TYPE_OPT	41
+#define CLASS_IN	1
+
+#define RCODE_NXDOMAIN	3
+
+/* Waiting for a query, or more likely, the http client waiting for it */
+struct waiter {
+	TAILQ_ENTRY(waiter) link;
+
+	int            family;
+	dns_result_t  *res;
+	dns_cb_t       cb;	/* NULL: dns_resolve() on the stack */
+	void          *arg;
+
+	int            rc;
+	int            done;
+};
+
+/* Query in flight, one per name, both A and AAAA are asked for */
+struct query {
+	TAILQ_ENTRY(query)   link;
+	TAILQ_HEAD(, waiter) waiters;
+	event_timer_t        timer;
+
+	int            done;	/* Waiters are called back from event loop */
+
+	int            sd;
+	int            ns;	/* Current name server */
+	int            tries;
+	int            tcp;	/* Retrying truncated replies over TCP */
+	int            connected;
+
+	int            pending;	/* Bitmask of types not yet answered */
+	int            truncated;
+	int            nxdomain;
+	int            absolute;	/* Name ended with a dot, no search */
+	int            search;	/* Next name in search list to try */
+	uint16_t       id[2];
+
+	unsigned int   ttl;
+	dns_result_t   answer[2];
+
+	size_t         len;	/* TCP receive buffer, length prefixed */
+	unsigned char  buf[DNS_MSG_MAX + 2];
+
+	char           fqdn[256];	/* Name currently asked for */
+	char           name[];
+};
+
+/* Cache entry, negative entries have no addresses */
+struct entry {
+	TAILQ_ENTRY(entry) link;
+
+	long long      expires;
+	int            rc;
+	dns_result_t   res;
+
+	char           name[];
+};
+
+/* Resource record, while parsing a reply */
+struct rr {
+	char           name[256];
+	uint16_t       type;
+	uint16_t       class;
+	uint32_t       ttl;
+	uint16_t       len;
+	size_t         data;	/* Offset in message */
+};
+
+static const uint16_t qtypes[] = { TYPE_A, TYPE_AAAA };
+
+static TAILQ_HEAD(, query) queries = TAILQ_HEAD_INITIALIZER(queries);
+static TAILQ_HEAD(entry_list, entry) cache = TAILQ_HEAD_INITIALIZER(cache);
+static int cache_len = 0;
+
+static dns_addr_t  nameserver[DNS_MAX_NS];
+static int         ns_count    = 0;
+static int         ns_timeout  = DNS_TIMEOUT;
+static int         ns_attempts = DNS_ATTEMPTS;
+static int         ns_ndots    = DNS_NDOTS;
+static char        search[DNS_MAX_SEARCH][256];
+static int         search_count = 0;
+static struct stat resolv_st;
+
+/* Used by dns_resolve() to drive queries outside of the event loop */
+static struct pollfd *pfds     = NULL;
+static size_t         pfds_max = 0;
+
+static void query_io      (int sd, int revents, void *arg);
+static void query_timeout (event_timer_t *timer, void *arg);
+
+socklen_t dns_addrlen(dns_addr_t *addr)
+{
+	if (addr->sa.sa_family == AF_INET6)
+		return sizeof(addr->sin6);
+
+	return sizeof(addr->sin);
+}
+
+void dns_setport(dns_addr_t *addr, int port)
+{
+	if (addr->sa.sa_family == AF_INET6)
+		addr->sin6.sin6_port = htons(port);
+	else
+		addr->sin.sin_port = htons(port);
+}
+
+static const char *dns_ntop(dns_addr_t *addr, char *buf, size_t len)
+{
+	if (getnameinfo(&addr->sa, dns_addrlen(addr), buf, len, NULL, 0, NI_NUMERICHOST))
+		strlcpy(buf, "?", len);
+
+	return buf;
+}
+
+static int numeric(const char *name, dns_addr_t *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+
+	if (inet_pton(AF_INET, name, &addr->sin.sin_addr) == 1) {
+		addr->sin.sin_family = AF_INET;
+		return 1;
+	}
+
+	if (inet_pton(AF_INET6, name, &addr->sin6.sin6_addr) == 1) {
+		addr->sin6.sin6_family = AF_INET6;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Copy addresses of @family, AF_UNSPEC for all, keeping their order */
+static int result_copy(dns_result_t *dst, dns_result_t *src, int family)
+{
+	int i;
+
+	dst->count = 0;
+	for (i = 0; i < src->count; i++) {
+		if (family != AF_UNSPEC && src->addr[i].sa.sa_family != family)
+			continue;
+
+		dst->addr[dst->count++] = src->addr[i];
+	}
+
+	return dst->count ? 0 : RC_TCP_INVALID_REMOTE_ADDR;
+}
+
+/*
+ * Name servers and options, reread when resolv.conf has changed, e.g.
+ * by a DHCP client or PPP daemon.  Everything cached is flushed then,
+ * it may have been learned from the previous (wrong) servers.
+ */
+static void search_add(const char *domain)
+{
+	size_t len = strlen(domain);
+
+	while (len && domain[len - 1] == '.')
+		len--;
+	if (!len || len >= sizeof(search[0]))
+		return;
+
+	memcpy(search[search_count], domain, len);
+	search[search_count++][len] = 0;
+}
+
+static void resolv_load(void)
+{
+	char line[256];
+	struct stat st;
+	FILE *fp;
+
+	if (stat(RESOLV_CONF, &st))
+		memset(&st, 0, sizeof(st));
+
+	if (ns_count && st.st_mtime == resolv_st.st_mtime && st.st_size == resolv_st.st_size &&
+	    st.st_ino == resolv_st.st_ino)
+		return;
+
+	if (ns_count) {
+		logit(LOG_INFO, "Name servers in %s have changed, flushing DNS cache.", RESOLV_CONF);
+		dns_flush();
+	}
+
+	resolv_st   = st;
+	ns_count    = 0;
+	ns_timeout  = DNS_TIMEOUT;
+	ns_attempts = DNS_ATTEMPTS;
+	ns_ndots    = DNS_NDOTS;
+	search_count = 0;
+
+	fp = fopen(RESOLV_CONF, "r");
+	while (fp && fgets(line, sizeof(line), fp)) {
+		char *tok, *scope;
+
+		tok = strtok(line, " \t\r\n");
+		if (!tok)
+			continue;
+
+		if (!strcmp(tok, "nameserver")) {
+			tok = strtok(NULL, " \t\r\n");
+			if (!tok || ns_count >= DNS_MAX_NS)
+				continue;
+
+			scope = strchr(tok, '%');
+			if (scope)
+				*scope++ = 0;
+
+			if (!numeric(tok, &nameserver[ns_count]))
+				continue;
+
+			if (scope && nameserver[ns_count].sa.sa_family == AF_INET6)
+				nameserver[ns_count].sin6.sin6_scope_id = if_nametoindex(scope);
+			dns_setport(&nameserver[ns_count++], DNS_PORT);
+		} else if (!strcmp(tok, "domain") || !strcmp(tok, "search")) {
+			/* Last one wins, like the C library */
+			search_count = 0;
+			while ((tok = strtok(NULL, " \t\r\n")) && search_count < DNS_MAX_SEARCH)
+				search_add(tok);
+		} else if (!strcmp(tok, "options")) {
+			while ((tok = strtok(NULL, " \t\r\n"))) {
+				if (!strncmp(tok, "timeout:", 8))
+					ns_timeout = atoi(tok + 8);
+				else if (!strncmp(tok, "attempts:", 9))
+					ns_attempts = atoi(tok + 9);
+				else if (!strncmp(tok, "ndots:", 6))
+					ns_ndots = atoi(tok + 6);
+			}
+		}
+	}
+	if (fp)
+		fclose(fp);
+
+	/* No search list, use domain of our hostname, like the C library does */
+	if (!search_count && !gethostname(line, sizeof(line))) {
+		char *dot;
+
+		line[sizeof(line) - 1] = 0;
+		dot = strchr(line, '.');
+		if (dot)
+			search_add(dot + 1);
+	}
+
+	if (ns_timeout < 1 || ns_timeout > 30)
+		ns_timeout = DNS_TIMEOUT;
+	if (ns_attempts < 1 || ns_attempts > 5)
+		ns_attempts = DNS_ATTEMPTS;
+	if (ns_ndots < 0 || ns_ndots > 15)
+		ns_ndots = ns_ndots < 0 ? 0 : 15;
+
+	/* No name server listed, use local one, like the C library does */
+	if (!ns_count) {
+		numeric("127.0.0.1", &nameserver[0]);
+		dns_setport(&nameserver[ns_count++], DNS_PORT);
+	}
+
+	logit(LOG_DEBUG, "Using %d name server(s), timeout %d sec, %d attempts, %d search domain(s), ndots %d",
+	      ns_count, ns_timeout, ns_attempts, search_count, ns_ndots);
+}
+
+/* Static entries take precedence over DNS, like 'hosts: files dns' */
+static int hosts_lookup(const char *name, int family, dns_result_t *res)
+{
+	char line[512];
+	FILE *fp;
+
+	res->count = 0;
+
+	fp = fopen(HOSTS_FILE, "r");
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp) && res->count < DNS_MAX_ADDRS) {
+		dns_addr_t addr;
+		char *tok, *ptr;
+
+		ptr = strchr(line, '#');
+		if (ptr)
+			*ptr = 0;
+
+		tok = strtok(line, " \t\r\n");
+		if (!tok || !numeric(tok, &addr))
+			continue;
+
+		if (family != AF_UNSPEC && addr.sa.sa_family != family)
+			continue;
+
+		while ((tok = strtok(NULL, " \t\r\n"))) {
+			if (strcasecmp(tok, name))
+				continue;
+
+			res->addr[res->count++] = addr;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return res->count;
+}
+
+static void cache_del(struct entry *entry)
+{
+	TAILQ_REMOVE(&cache, entry, link);
+	free(entry);
+	cache_len--;
+}
+
+/* Least recently used entries are evicted first */
+static struct entry *cache_find(const char *name)
+{
+	struct entry *entry, *tmp;
+
+	TAILQ_FOREACH_SAFE(entry, &cache, link, tmp) {
+		if (strcasecmp(entry->name, name))
+			continue;
+
+		if (entry->expires <= event_now()) {
+			cache_del(entry);
+			return NULL;
+		}
+
+		TAILQ_REMOVE(&cache, entry, link);
+		TAILQ_INSERT_HEAD(&cache, entry, link);
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+static void cache_add(const char *name, int rc, dns_result_t *res, unsigned int ttl)
+{
+	struct entry *entry;
+	size_t len;
+
+	entry = cache_find(name);
+	if (entry)
+		cache_del(entry);
+
+	if (!ttl)
+		return;
+
+	len = strlen(name) + 1;
+	entry = calloc(1, sizeof(*entry) + len);
+	if (!entry)
+		return;
+
+	memcpy(entry->name, name, len);
+	entry->rc      = rc;
+	entry->res     = *res;
+	entry->expires = event_now() + ttl * 1000LL;
+
+	TAILQ_INSERT_HEAD(&cache, entry, link);
+	if (++cache_len > DNS_CACHE_MAX)
+		cache_del(TAILQ_LAST(&cache, entry_list));
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static unsigned char *put16(unsigned char *p, uint16_t val)
+{
+	*p++ = val >> 8;
+	*p++ = val & 0xff;
+
+	return p;
+}
+
+/*
+ * Expand, possibly compressed, name at @off into @name, without the
+ * trailing dot.  On return @off is just past the name in the message.
+ */
+static int dns_name(const unsigned char *msg, size_t len, size_t *off, char *name, size_t sz)
+{
+	size_t pos = *off, num = 0;
+	int jumps = 0;
+
+	while (1) {
+		unsigned char c;
+
+		if (pos >= len)
+			return -1;
+
+		c = msg[pos];
+		if ((c & 0xc0) == 0xc0) {
+			if (pos + 1 >= len || ++jumps > 16)
+				return -1;
+			if (jumps == 1)
+				*off = pos + 2;
+
+			pos = (c & 0x3f) << 8 | msg[pos + 1];
+			continue;
+		}
+		if (c & 0xc0)
+			return -1;
+
+		pos++;
+		if (!c)
+			break;
+
+		if (pos + c > len || num + c + 2 > sz)
+			return -1;
+
+		if (num)
+			name[num++] = '.';
+		memcpy(&name[num], &msg[pos], c);
+		num += c;
+		pos += c;
+	}
+	name[num] = 0;
+
+	if (!jumps)
+		*off = pos;
+
+	return 0;
+}
+
+static int rr_next(const unsigned char *msg, size_t len, size_t *off, struct rr *rr)
+{
+	if (dns_name(msg, len, off, rr->name, sizeof(rr->name)) || *off + 10 > len)
+		return -1;
+
+	rr->type  = get16(&msg[*off]);
+	rr->class = get16(&msg[*off + 2]);
+	rr->ttl   = get32(&msg[*off + 4]);
+	rr->len   = get16(&msg[*off + 8]);
+	rr->data  = *off + 10;
+	if (rr->data + rr->len > len)
+		return -1;
+
+	/* RFC 2181: TTL with most significant bit set is zero */
+	if (rr->ttl > INT32_MAX)
+		rr->ttl = 0;
+	if (rr->ttl > DNS_MAX_TTL)
+		rr->ttl = DNS_MAX_TTL;
+
+	*off = rr->data + rr->len;
+
+	return 0;
+}
+
+/* Query of type @i for our name, with EDNS0 to avoid truncated replies */
+static size_t query_build(struct query *q, int i, unsigned char *buf, size_t len)
+{
+	const char *label = q->fqdn;
+	unsigned char *p = buf;
+
+	memset(buf, 0, 12);
+	p = put16(p, q->id[i]);
+	*p++ = 0x01;			/* Recursion desired */
+	*p++ = 0x00;
+	p = put16(p, 1);		/* One question */
+	p = put16(p, 0);
+	p = put16(p, 0);
+	p = put16(p, 1);		/* One OPT record */
+
+	while (*label) {
+		const char *dot = strchr(label, '.');
+		size_t num = dot ? (size_t)(dot - label) : strlen(label);
+
+		if (!num || num > 63 || (size_t)(p - buf) + num + 1 + 16 > len)
+			return 0;
+
+		*p++ = num;
+		memcpy(p, label, num);
+		p += num;
+
+		label += num;
+		if (*label)
+			label++;
+	}
+	*p++ = 0;
+	p = put16(p, qtypes[i]);
+	p = put16(p, CLASS_IN);
+
+	/* RFC 6891: root name, type OPT, UDP payload size as class, no flags */
+	*p++ = 0;
+	p = put16(p, TYPE_OPT);
+	p = put16(p, DNS_EDNS_SIZE);
+	memset(p, 0, 6);
+	p += 6;
+
+	return p - buf;
+}
+
+/* Fill @buf from the kernel CSPRNG, returns 0 on success */
+static int random_fill(void *buf, size_t len)
+{
+	ssize_t num;
+	int fd;
+
+#if defined(HAVE_GETRANDOM) && defined(HAVE_SYS_RANDOM_H)
+	if (getrandom(buf, len, GRND_NONBLOCK) == (ssize_t)len)
+		return 0;
+#endif
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd != -1) {
+		num = read(fd, buf, len);
+		close(fd);
+		if (num == (ssize_t)len)
+			return 0;
+	}
+
+#ifdef HAVE_ARC4RANDOM_BUF
+	arc4random_buf(buf, len);
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Transaction ids must not be guessable, or an off-path attacker can
+ * spoof answers, and with them the address of a DDNS server that gets
+ * our credentials.  So not from rand(), which also drives backoff
+ * jitter and fake addresses, but from the kernel, in batches.
+ */
+static uint16_t query_id(void)
+{
+	static uint16_t pool[64];
+	static size_t left;
+
+	if (!left) {
+		if (random_fill(pool, sizeof(pool))) {
+			size_t i;
+
+			logit(LOG_WARNING, "No kernel random source, DNS ids are guessable!");
+			for (i = 0; i < NELEMS(pool); i++)
+				pool[i] = rand() & 0xffff;
+		}
+		left = NELEMS(pool);
+	}
+
+	return pool[--left];
+}
+
+/* Send all unanswered queries, over TCP each is prefixed with its length */
+static int query_send(struct query *q)
+{
+	unsigned char buf[2 * 300];
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		unsigned char *p;
+		size_t num;
+
+		if (!(q->pending & (1 << i)))
+			continue;
+
+		q->id[i] = query_id();
+		p = &buf[len + (q->tcp ? 2 : 0)];
+		num = query_build(q, i, p, 300 - 2);
+		if (!num) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (q->tcp) {
+			put16(&buf[len], num);
+			len += 2 + num;
+			continue;
+		}
+
+		if (send(q->sd, p, num, 0) != (ssize_t)num)
+			return -1;
+	}
+
+	if (len && send(q->sd, buf, len, 0) != (ssize_t)len)
+		return -1;
+
+	return 0;
+}
+
+static void query_close(struct query *q)
+{
+	if (q->sd < 0)
+		return;
+
+	event_del(q->sd);
+	close(q->sd);
+	q->sd = -1;
+}
+
+/* Connect to current name server and send, or for TCP, start connecting */
+static int query_open(struct query *q)
+{
+	dns_addr_t *ns = &nameserver[q->ns];
+	char host[INET6_ADDRSTRLEN + 1];
+
+	query_close(q);
+	q->connected = !q->tcp;
+	q->len = 0;
+
+	q->sd = socket(ns->sa.sa_family, q->tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (q->sd == -1)
+		goto fail;
+
+	if (fcntl(q->sd, F_SETFD, FD_CLOEXEC) || fcntl(q->sd, F_SETFL, fcntl(q->sd, F_GETFL) | O_NONBLOCK))
+		goto fail;
+
+	if (connect(q->sd, &ns->sa, dns_addrlen(ns)) && (!q->tcp || errno != EINPROGRESS))
+		goto fail;
+
+	if (!q->tcp && query_send(q))
+		goto fail;
+
+	if (event_add(q->sd, q->tcp ? POLLOUT : POLLIN, query_io, q) || event_timer_set(&q->timer, ns_timeout * 1000))
+		goto fail;
+
+	return 0;
+fail:
+	logit(LOG_DEBUG, "Failed querying name server %s for %s: %s", dns_ntop(ns, host, sizeof(host)),
+	      q->name, strerror(errno));
+	query_close(q);
+
+	return -1;
+}
+
+/* Move on to next name server, returns non-zero when all attempts are used up */
+static int query_next(struct query *q)
+{
+	while (++q->tries < ns_count * ns_attempts) {
+		q->ns = (q->ns + 1) % ns_count;
+		if (!query_open(q))
+			return 0;
+	}
+
+	return -1;
+}
+
+/* Prefer IPv6, like getaddrinfo(), but only if there is a route to it */
+static int reachable(dns_addr_t *addr)
+{
+	dns_addr_t tmp = *addr;
+	int sd, rc;
+
+	sd = socket(tmp.sa.sa_family, SOCK_DGRAM, 0);
+	if (sd == -1)
+		return 0;
+
+	dns_setport(&tmp, DNS_PORT);
+	rc = connect(sd, &tmp.sa, dns_addrlen(&tmp));
+	close(sd);
+
+	return !rc;
+}
+
+static void query_notify(event_timer_t *timer, void *arg)
+{
+	struct query *q = (struct query *)arg;
+	struct waiter *w;
+
+	/* Callbacks may cancel other waiters, or start new lookups */
+	while ((w = TAILQ_FIRST(&q->waiters))) {
+		dns_cb_t cb = w->cb;
+		void *cbarg = w->arg;
+		int rc = w->rc;
+
+		TAILQ_REMOVE(&q->waiters, w, link);
+		free(w);
+
+		cb(rc, cbarg);
+	}
+
+	TAILQ_REMOVE(&queries, q, link);
+	free(q);
+}
+
+/*
+ * All answers are in, or all name servers have failed.  Cache outcome
+ * and hand out the addresses.  Callbacks are always called from the
+ * event loop, a dns_resolve() caller may be waiting for the same name.
+ */
+static void query_done(struct query *q)
+{
+	dns_result_t res = { 0 };
+	struct waiter *w, *tmp;
+	int first = 0, i, j;
+	int rc = 0;
+
+	query_close(q);
+	event_timer_del(&q->timer);
+	q->done = 1;
+
+	if (q->answer[1].count && reachable(&q->answer[1].addr[0]))
+		first = 1;
+	for (i = 0; i < 2; i++) {
+		dns_result_t *answer = &q->answer[i ? !first : first];
+
+		for (j = 0; j < answer->count; j++)
+			res.addr[res.count++] = answer->addr[j];
+	}
+
+	/* Do not remember failing name servers for long */
+	if (q->pending && q->ttl > DNS_FAIL_TTL)
+		q->ttl = DNS_FAIL_TTL;
+
+	if (res.count) {
+		logit(LOG_DEBUG, "Resolved %s => %d address(es), TTL %u sec", q->fqdn, res.count, q->ttl);
+	} else {
+		rc = RC_TCP_INVALID_REMOTE_ADDR;
+		logit(LOG_WARNING, "Failed resolving hostname %s: %s", q->name,
+		      q->pending ? "Name server not responding" : q->nxdomain ? "No such host" : "No address");
+	}
+	cache_add(q->name, rc, &res, q->ttl);
+
+	TAILQ_FOREACH_SAFE(w, &q->waiters, link, tmp) {
+		w->rc = rc ? rc : result_copy(w->res, &res, w->family);
+		w->done = 1;
+
+		if (!w->cb)
+			TAILQ_REMOVE(&q->waiters, w, link);
+	}
+
+	if (TAILQ_EMPTY(&q->waiters)) {
+		TAILQ_REMOVE(&queries, q, link);
+		free(q);
+		return;
+	}
+
+	event_timer_init(&q->timer, query_notify, q);
+	if (event_timer_set(&q->timer, 0))
+		query_notify(&q->timer, q);
+}
+
+/*
+ * Next name to ask for, like res_search(): names with at least ndots
+ * dots are tried as given first, then with each search domain appended,
+ * other names the other way around.  Returns non-zero when all tried.
+ */
+static int query_name(struct query *q)
+{
+	int num = q->absolute ? 1 : search_count + 1;
+	int dots = 0, len, i;
+	const char *p;
+
+	for (p = q->name; *p; p++) {
+		if (*p == '.')
+			dots++;
+	}
+
+	while ((i = q->search++) < num) {
+		if (dots < ns_ndots)
+			i = (i + 1) % num;
+
+		if (!i)
+			len = snprintf(q->fqdn, sizeof(q->fqdn), "%s", q->name);
+		else
+			len = snprintf(q->fqdn, sizeof(q->fqdn), "%s.%s", q->name, search[i - 1]);
+		if (len > 0 && (size_t)len < sizeof(q->fqdn))
+			return 0;
+	}
+
+	return -1;
+}
+
+/* Name servers say there is no address for this name, try next in search list */
+static int query_again(struct query *q)
+{
+	char prev[sizeof(q->fqdn)];
+
+	if (q->pending || q->answer[0].count || q->answer[1].count)
+		return 1;
+
+	strcpy(prev, q->fqdn);
+	if (query_name(q))
+		return 1;
+
+	logit(LOG_DEBUG, "No address for %s, trying %s ...", prev, q->fqdn);
+	memset(q->answer, 0, sizeof(q->answer));
+	q->pending   = 3;
+	q->truncated = 0;
+	q->nxdomain  = 0;
+	q->tcp       = 0;
+	q->tries     = 0;
+	q->ttl       = DNS_MAX_TTL;
+	if (query_open(q) && query_next(q))
+		return 1;
+
+	return 0;
+}
+
+/* Current name server timed out, failed, or refused, try next one */
+static void query_retry(struct query *q)
+{
+	if (query_next(q))
+		query_done(q);
+}
+
+/*
+ * Check that reply is for one of our queries, then pick the addresses
+ * for our name, following any CNAME chain.  Returns -1 if the reply is
+ * to be ignored, and 1 on name server failure.
+ */
+static int query_parse(struct query *q, const unsigned char *msg, size_t len)
+{
+	dns_result_t *res;
+	char target[256];
+	unsigned int ttl = DNS_MAX_TTL;
+	size_t pos, off = 12;
+	int an, ns, rcode;
+	struct rr rr;
+	int i, j, hops;
+
+	if (len < 12 || !(msg[2] & 0x80) || get16(&msg[4]) != 1)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		if ((q->pending & (1 << i)) && get16(msg) == q->id[i])
+			break;
+	}
+	if (i == 2)
+		return -1;
+
+	if (dns_name(msg, len, &off, target, sizeof(target)) || off + 4 > len)
+		return -1;
+	if (strcasecmp(target, q->fqdn) || get16(&msg[off]) != qtypes[i])
+		return -1;
+	off += 4;
+
+	an    = get16(&msg[6]);
+	ns    = get16(&msg[8]);
+	rcode = msg[3] & 0x0f;
+
+	/* Truncated, ask again over TCP when all UDP replies are in */
+	if ((msg[2] & 0x02) && !q->tcp) {
+		q->truncated |= 1 << i;
+		q->pending   &= ~(1 << i);
+		return 0;
+	}
+
+	if (rcode && rcode != RCODE_NXDOMAIN)
+		return 1;
+
+	for (hops = 0; hops < DNS_MAX_CNAME; hops++) {
+		for (pos = off, j = 0; j < an; j++) {
+			if (rr_next(msg, len, &pos, &rr))
+				return 1;
+			if (rr.type == TYPE_CNAME && !strcasecmp(rr.name, target))
+				break;
+		}
+		if (j == an)
+			break;
+
+		pos = rr.data;
+		if (dns_name(msg, len, &pos, target, sizeof(target)))
+			return 1;
+		if (rr.ttl < ttl)
+			ttl = rr.ttl;
+	}
+
+	res = &q->answer[i];
+	res->count = 0;
+	for (pos = off, j = 0; j < an; j++) {
+		dns_addr_t *addr;
+
+		if (rr_next(msg, len, &pos, &rr))
+			return 1;
+
+		if (rr.type != qtypes[i] || rr.class != CLASS_IN || strcasecmp(rr.name, target))
+			continue;
+		if (rr.len != (rr.type == TYPE_A ? 4 : 16) || res->count >= DNS_MAX_ADDRS / 2)
+			continue;
+
+		addr = &res->addr[res->count++];
+		memset(addr, 0, sizeof(*addr));
+		if (rr.type == TYPE_A) {
+			addr->sin.sin_family = AF_INET;
+			memcpy(&addr->sin.sin_addr, &msg[rr.data], 4);
+		} else {
+			addr->sin6.sin6_family = AF_INET6;
+			memcpy(&addr->sin6.sin6_addr, &msg[rr.data], 16);
+		}
+
+		if (rr.ttl < ttl)
+			ttl = rr.ttl;
+	}
+
+	/* Negative answer, cached as long as the zone's SOA allows, RFC 2308 */
+	if (!res->count) {
+		unsigned int neg = DNS_NEG_TTL;
+
+		for (j = 0; j < ns; j++) {
+			if (rr_next(msg, len, &pos, &rr))
+				break;
+			if (rr.type != TYPE_SOA)
+				continue;
+
+			off = rr.data;
+			if (dns_name(msg, len, &off, target, sizeof(target)) ||
+			    dns_name(msg, len, &off, target, sizeof(target)) ||
+			    off + 20 > rr.data + rr.len)
+				break;
+
+			neg = get32(&msg[off + 16]);
+			if (rr.ttl < neg)
+				neg = rr.ttl;
+			break;
+		}
+
+		if (neg < ttl)
+			ttl = neg;
+		if (rcode == RCODE_NXDOMAIN)
+			q->nxdomain = 1;
+	}
+
+	if (ttl < q->ttl)
+		q->ttl = ttl;
+	q->pending &= ~(1 << i);
+
+	return 0;
+}
+
+static int soerror(int sd)
+{
+	int code = 0;
+	socklen_t len = sizeof(code);
+
+	if (getsockopt(sd, SOL_SOCKET, SO_ERROR, &code, &len))
+		return 1;
+
+	return errno = code;
+}
+
+/* Send queries when connected, then read length prefixed replies */
+static int query_tcp(struct query *q)
+{
+	ssize_t num;
+
+	if (!q->connected) {
+		if (soerror(q->sd) || query_send(q) || event_mod(q->sd, POLLIN))
+			return 1;
+
+		q->connected = 1;
+		return 0;
+	}
+
+	while ((num = recv(q->sd, &q->buf[q->len], sizeof(q->buf) - q->len, 0)) > 0) {
+		q->len += num;
+
+		while (q->len >= 2) {
+			size_t len = get16(q->buf);
+
+			if (q->len < len + 2)
+				break;
+
+			if (query_parse(q, &q->buf[2], len) > 0)
+				return 1;
+
+			q->len -= len + 2;
+			memmove(q->buf, &q->buf[len + 2], q->len);
+		}
+
+		if (q->len == sizeof(q->buf))
+			return 1;
+	}
+
+	if (!num)
+		return q->pending ? 1 : 0;
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		return 1;
+
+	return 0;
+}
+
+static int query_udp(struct query *q)
+{
+	unsigned char buf[DNS_MSG_MAX];
+	ssize_t num;
+
+	while ((num = recv(q->sd, buf, sizeof(buf), 0)) > 0) {
+		if (query_parse(q, buf, num) > 0)
+			return 1;
+	}
+
+	/* E.g., ECONNREFUSED when there is no name server on that address */
+	if (num == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		return 1;
+
+	return 0;
+}
+
+static void query_io(int sd, int revents, void *arg)
+{
+	struct query *q = (struct query *)arg;
+	int rc;
+
+	rc = q->tcp ? query_tcp(q) : query_udp(q);
+	if (rc) {
+		query_retry(q);
+		return;
+	}
+
+	if (q->pending)
+		return;
+
+	if (q->truncated && !q->tcp) {
+		logit(LOG_DEBUG, "Truncated reply for %s, retrying over TCP", q->name);
+		q->pending   = q->truncated;
+		q->truncated = 0;
+		q->tries     = 0;
+		q->tcp       = 1;
+		if (query_open(q))
+			query_retry(q);
+		return;
+	}
+
+	if (query_again(q))
+		query_done(q);
+}
+
+static void query_timeout(event_timer_t *timer, void *arg)
+{
+	struct query *q = (struct query *)arg;
+	char host[INET6_ADDRSTRLEN + 1];
+
+	logit(LOG_DEBUG, "Timed out waiting for name server %s, resolving %s",
+	      dns_ntop(&nameserver[q->ns], host, sizeof(host)), q->name);
+	query_retry(q);
+}
+
+static struct query *query_start(const char *name)
+{
+	unsigned char buf[300];
+	struct query *q;
+	size_t len;
+
+	len = strlen(name);
+	q = calloc(1, sizeof(*q) + len + 1);
+	if (!q)
+		return NULL;
+
+	memcpy(q->name, name, len);
+	if (len && q->name[len - 1] == '.') {
+		q->name[len - 1] = 0;
+		q->absolute = 1;
+	}
+
+	TAILQ_INIT(&q->waiters);
+	event_timer_init(&q->timer, query_timeout, q);
+	q->sd      = -1;
+	q->pending = 3;
+	q->ttl     = DNS_MAX_TTL;
+
+	if (!q->name[0] || query_name(q) || !query_build(q, 1, buf, sizeof(buf))) {
+		logit(LOG_WARNING, "Failed resolving hostname %s: Invalid name", name);
+		free(q);
+		return NULL;
+	}
+
+	if (query_open(q) && query_next(q)) {
+		logit(LOG_WARNING, "Failed resolving hostname %s: %s", name, strerror(errno));
+		free(q);
+		return NULL;
+	}
+
+	TAILQ_INSERT_TAIL(&queries, q, link);
+	logit(LOG_DEBUG, "Resolving hostname %s ...", q->name);
+
+	return q;
+}
+
+/* Addresses from /etc/hosts or cache, otherwise @qp is the query to wait for */
+static int lookup(const char *name, int family, dns_result_t *res, struct query **qp)
+{
+	struct entry *entry;
+	struct query *q;
+	dns_result_t tmp;
+
+	if (!name || !name[0])
+		return RC_TCP_INVALID_REMOTE_ADDR;
+
+	if (numeric(name, &tmp.addr[0])) {
+		tmp.count = 1;
+		return result_copy(res, &tmp, family);
+	}
+
+	if (hosts_lookup(name, family, res))
+		return 0;
+
+	resolv_load();
+
+	entry = cache_find(name);
+	if (entry) {
+		logit(LOG_DEBUG, "Using cached DNS %s of %s, expires in %d sec", entry->rc ? "failure" : "reply",
+		      name, event_msec(entry->expires) / 1000);
+		if (entry->rc)
+			return entry->rc;
+
+		return result_copy(res, &entry->res, family);
+	}
+
+	TAILQ_FOREACH(q, &queries, link) {
+		if (!q->done && !strcasecmp(q->name, name))
+			break;
+	}
+
+	if (!q) {
+		q = query_start(name);
+		if (!q)
+			return RC_TCP_INVALID_REMOTE_ADDR;
+	}
+
+	*qp = q;
+
+	return RC_WANT_RESOLVE;
+}
+
+/*
+ * Look up addresses of @name, of @family or AF_UNSPEC for both IPv6 and
+ * IPv4.  Returns 0 with @res filled in, when found in /etc/hosts or the
+ * cache.  Otherwise RC_WANT_RESOLVE, then @cb is called from the event
+ * loop when @res is filled in, or the lookup has failed.  If @res is
+ * NULL the lookup is only started, to have the reply cached later on.
+ */
+int dns_lookup(const char *name, int family, dns_result_t *res, dns_cb_t cb, void *arg)
+{
+	struct query *q = NULL;
+	struct waiter *w;
+	dns_result_t tmp;
+	int rc;
+
+	rc = lookup(name, family, res ? res : &tmp, &q);
+	if (rc != RC_WANT_RESOLVE || !res)
+		return rc;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return RC_OUT_OF_MEMORY;
+
+	w->family = family;
+	w->res    = res;
+	w->cb     = cb;
+	w->arg    = arg;
+	TAILQ_INSERT_TAIL(&q->waiters, w, link);
+
+	return RC_WANT_RESOLVE;
+}
+
+/* Drive all queries in flight, outside of the event loop, until @deadline */
+static int dns_wait(long long deadline)
+{
+	struct query *q, *tmp;
+	long long next = deadline;
+	size_t i, num = 0;
+	int rc;
+
+	TAILQ_FOREACH(q, &queries, link) {
+		if (q->done || q->sd < 0)
+			continue;
+
+		if (num == pfds_max) {
+			size_t len = pfds_max ? pfds_max * 2 : 8;
+			struct pollfd *p;
+
+			p = realloc(pfds, len * sizeof(*p));
+			if (!p)
+				return -1;
+
+			pfds = p;
+			pfds_max = len;
+		}
+
+		pfds[num].fd      = q->sd;
+		pfds[num].events  = q->connected ? POLLIN : POLLOUT;
+		pfds[num].revents = 0;
+		num++;
+
+		if (q->timer.pos && q->timer.deadline < next)
+			next = q->timer.deadline;
+	}
+
+	if (event_now() >= deadline)
+		return -1;
+
+	rc = poll(pfds, num, event_msec(next));
+	for (i = 0; rc > 0 && i < num; i++) {
+		if (!pfds[i].revents)
+			continue;
+
+		/* Earlier reply may have completed, or moved, this query */
+		TAILQ_FOREACH(q, &queries, link) {
+			if (!q->done && q->sd == pfds[i].fd)
+				break;
+		}
+		if (q)
+			query_io(q->sd, pfds[i].revents, q);
+	}
+
+	TAILQ_FOREACH_SAFE(q, &queries, link, tmp) {
+		if (!q->done && q->timer.pos && q->timer.deadline <= event_now())
+			query_timeout(&q->timer, q);
+	}
+
+	return 0;
+}
+
+/*
+ * Blocking version of dns_lookup(), for connections made outside of the
+ * event loop.  Waits at most @timeout msec, or if zero, until the name
+ * servers have been tried.  Other lookups in flight make progress too.
+ */
+int dns_resolve(const char *name, int family, dns_result_t *res, int timeout)
+{
+	struct waiter w = { .family = family, .res = res };
+	struct query *q = NULL;
+	long long deadline;
+	int rc;
+
+	rc = lookup(name, family, res, &q);
+	if (rc != RC_WANT_RESOLVE)
+		return rc;
+
+	if (timeout <= 0)
+		timeout = (ns_count * ns_attempts * ns_timeout + 1) * 1000;
+	deadline = event_now() + timeout;
+
+	TAILQ_INSERT_TAIL(&q->waiters, &w, link);
+	while (!w.done) {
+		if (dns_wait(deadline)) {
+			TAILQ_REMOVE(&q->waiters, &w, link);
+			logit(LOG_WARNING, "Failed resolving hostname %s: Timed out", name);
+			return RC_TCP_INVALID_REMOTE_ADDR;
+		}
+	}
+
+	return w.rc;
+}
+
+/* Caller gave up, e.g. timed out, the query continues to warm the cache */
+void dns_cancel(dns_result_t *res)
+{
+	struct query *q;
+	struct waiter *w, *tmp;
+
+	TAILQ_FOREACH(q, &queries, link) {
+		TAILQ_FOREACH_SAFE(w, &q->waiters, link, tmp) {
+			if (w->res != res)
+				continue;
+
+			TAILQ_REMOVE(&q->waiters, w, link);
+			if (w->cb)
+				free(w);
+		}
+	}
+}
+
+void dns_flush(void)
+{
+	while (!TAILQ_EMPTY(&cache))
+		cache_del(TAILQ_FIRST(&cache));
+}
+
+void dns_exit(void)
+{
+	struct query *q;
+	struct waiter *w;
+
+	while ((q = TAILQ_FIRST(&queries))) {
+		while ((w = TAILQ_FIRST(&q->waiters))) {
+			TAILQ_REMOVE(&q->waiters, w, link);
+			if (w->cb)
+				free(w);
+		}
+
+		query_close(q);
+		event_timer_del(&q->timer);
+		TAILQ_REMOVE(&queries, q, link);
+		free(q);
+	}
+
+	dns_flush();
+	ns_count = 0;
+
+	free(pfds);
+	pfds = NULL;
+	pfds_max = 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -35,6 +35,9 @@ static const ERROR_NAME global_error_table[] = {
 	{ RC_OUT_OF_MEMORY,               "Out of memory"                    },
 	{ RC_BUFFER_OVERFLOW,             "Too small internal buffer"        },
 	{ RC_PIDFILE_EXISTS_ALREADY,      "Already running"                  },
+	{ RC_WANT_READ,                   "Operation would block (read)"     },
+	{ RC_WANT_WRITE,                  "Operation would block (write)"    },
+	{ RC_WANT_RESOLVE,                "Operation would block (DNS)"      },
 
 	{ RC_TCP_SOCKET_CREATE_ERROR,     "Failed creating IP socket"        },
 	{ RC_TCP_BAD_PARAMETER,           "Invalid Internet port"            },
@@ -60,6 +63,7 @@ static const ERROR_NAME global_error_table[] = {
 	{ RC_DDNS_RSP_NOTOK,              "DDNS server response not OK"      },
 	{ RC_DDNS_RSP_RETRY_LATER,        "DDNS server busy, try later"      },
 	{ RC_DDNS_RSP_AUTH_FAIL,          "Authentication failure"           },
+	{ RC_DDNS_RSP_UNCHANGED,          "DNS record already up to date"    },
 
 	{ RC_OS_FORK_FAILURE,             "Failed forking off child"         },
 	{ RC_OS_CHANGE_PERSONA_FAILURE,   "Failed dropping privileges"       },
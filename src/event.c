@@ -0,0 +1,346 @@
+/* Small poll() based event loop
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Inadyn spends nearly all of its life waiting: for the next periodic
+ * check, for a signal from the user, or for a socket to become ready.
+ * Every descriptor we wait for is registered here, with a callback,
+ * and the main loop sleeps in poll() until something happens or the
+ * next deadline expires.  No periodic wakeups.
+ *
+ * Deadlines are kept in a binary min-heap of timers, so finding the
+ * earliest one is O(1) and (re)scheduling is O(log n), regardless of
+ * the number of providers and aliases.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "event.h"
+
+struct ev {
+	int         sd;
+	short       events;
+	event_cb_t  cb;
+	void       *arg;
+};
+
+static struct ev     *evs  = NULL;
+static struct pollfd *pfds = NULL;
+static size_t         num  = 0;
+static size_t         max  = 0;
+
+/* 1-based heap, the earliest deadline is always at heap[1] */
+static event_timer_t **heap     = NULL;
+static size_t          heap_len = 0;
+static size_t          heap_max = 0;
+
+static struct ev *find(int sd)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		if (evs[i].sd == sd)
+			return &evs[i];
+	}
+
+	return NULL;
+}
+
+int event_add(int sd, int events, event_cb_t cb, void *arg)
+{
+	struct ev *ev;
+
+	if (sd < 0 || !cb) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ev = find(sd);
+	if (!ev) {
+		if (num == max) {
+			size_t len = max ? max * 2 : 8;
+			struct pollfd *p;
+			struct ev *e;
+
+			e = realloc(evs, len * sizeof(*e));
+			if (!e)
+				return -1;
+			evs = e;
+
+			p = realloc(pfds, len * sizeof(*p));
+			if (!p)
+				return -1;
+			pfds = p;
+
+			max = len;
+		}
+		ev = &evs[num++];
+	}
+
+	ev->sd     = sd;
+	ev->events = events;
+	ev->cb     = cb;
+	ev->arg    = arg;
+
+	return 0;
+}
+
+int event_mod(int sd, int events)
+{
+	struct ev *ev;
+
+	ev = find(sd);
+	if (!ev) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	ev->events = events;
+
+	return 0;
+}
+
+int event_del(int sd)
+{
+	struct ev *ev;
+
+	ev = find(sd);
+	if (!ev)
+		return 0;
+
+	*ev = evs[--num];
+
+	return 0;
+}
+
+static void heap_set(size_t pos, event_timer_t *timer)
+{
+	heap[pos] = timer;
+	timer->pos = pos;
+}
+
+static void heap_up(size_t pos)
+{
+	event_timer_t *timer = heap[pos];
+
+	while (pos > 1 && heap[pos / 2]->deadline > timer->deadline) {
+		heap_set(pos, heap[pos / 2]);
+		pos /= 2;
+	}
+	heap_set(pos, timer);
+}
+
+static void heap_down(size_t pos)
+{
+	event_timer_t *timer = heap[pos];
+
+	while (pos * 2 <= heap_len) {
+		size_t child = pos * 2;
+
+		if (child < heap_len && heap[child + 1]->deadline < heap[child]->deadline)
+			child++;
+		if (heap[child]->deadline >= timer->deadline)
+			break;
+
+		heap_set(pos, heap[child]);
+		pos = child;
+	}
+	heap_set(pos, timer);
+}
+
+void event_timer_init(event_timer_t *timer, event_timer_cb_t cb, void *arg)
+{
+	memset(timer, 0, sizeof(*timer));
+	timer->cb  = cb;
+	timer->arg = arg;
+}
+
+/*
+ * Start, or restart, @timer to expire in @msec milliseconds.  The
+ * timer is one-shot, the callback may restart it.
+ */
+int event_timer_set(event_timer_t *timer, long long msec)
+{
+	if (!timer || !timer->cb) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!timer->pos) {
+		if (heap_len + 1 >= heap_max) {
+			size_t len = heap_max ? heap_max * 2 : 16;
+			event_timer_t **h;
+
+			h = realloc(heap, len * sizeof(*h));
+			if (!h)
+				return -1;
+
+			heap = h;
+			heap_max = len;
+		}
+		heap_set(++heap_len, timer);
+	}
+
+	timer->deadline = event_now() + (msec > 0 ? msec : 0);
+	heap_up(timer->pos);
+	heap_down(timer->pos);
+
+	return 0;
+}
+
+void event_timer_del(event_timer_t *timer)
+{
+	event_timer_t *last;
+	size_t pos;
+
+	if (!timer || !timer->pos)
+		return;
+
+	pos = timer->pos;
+	timer->pos = 0;
+
+	last = heap[heap_len--];
+	if (last == timer)
+		return;
+
+	/* Move last timer into the hole, then restore heap order */
+	heap_set(pos, last);
+	heap_up(pos);
+	heap_down(last->pos);
+}
+
+/* Call the callback of all expired timers, in deadline order */
+static int run_timers(void)
+{
+	long long now = event_now();
+	int count = 0;
+
+	while (heap_len && heap[1]->deadline <= now) {
+		event_timer_t *timer = heap[1];
+
+		event_timer_del(timer);
+		timer->cb(timer, timer->arg);
+		count++;
+	}
+
+	return count;
+}
+
+/*
+ * Wait at most @msec milliseconds, -1 to wait forever, for any of the
+ * registered descriptors, or the next timer to expire.  Callbacks are
+ * called for each descriptor with pending events, and for each expired
+ * timer.  Callbacks may add or delete descriptors and timers.
+ *
+ * Returns the number of descriptors and timers handled, 0 on timeout
+ * or signal.
+ */
+int event_poll(int msec)
+{
+	size_t i, n = num;
+	int rc;
+
+	if (heap_len) {
+		int next = event_msec(heap[1]->deadline);
+
+		if (msec < 0 || next < msec)
+			msec = next;
+	}
+
+	for (i = 0; i < n; i++) {
+		pfds[i].fd      = evs[i].sd;
+		pfds[i].events  = evs[i].events;
+		pfds[i].revents = 0;
+	}
+
+	rc = poll(pfds, n, msec);
+	if (rc <= 0) {
+		if (rc < 0 && errno != EINTR)
+			logit(LOG_WARNING, "Failed waiting for events: %s", strerror(errno));
+		return run_timers();
+	}
+
+	for (i = 0; i < n; i++) {
+		struct ev *ev;
+
+		if (!pfds[i].revents)
+			continue;
+
+		/* Callback of an earlier descriptor may have removed this one */
+		ev = find(pfds[i].fd);
+		if (!ev)
+			continue;
+
+		ev->cb(ev->sd, pfds[i].revents, ev->arg);
+	}
+
+	return rc + run_timers();
+}
+
+void event_exit(void)
+{
+	while (heap_len)
+		event_timer_del(heap[1]);
+	free(heap);
+	heap = NULL;
+	heap_max = 0;
+
+	free(evs);
+	free(pfds);
+	evs  = NULL;
+	pfds = NULL;
+	num  = max = 0;
+}
+
+/* Monotonic time in milliseconds, unaffected by changes to system time */
+long long event_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Milliseconds left until @deadline, as a poll() timeout */
+int event_msec(long long deadline)
+{
+	long long left = deadline - event_now();
+
+	if (left <= 0)
+		return 0;
+	if (left > INT_MAX)
+		return INT_MAX;
+
+	return (int)left;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
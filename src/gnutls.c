@@ -20,14 +20,18 @@
  */
 
 #include <stdint.h>
+#include <sys/stat.h>
 #include <gnutls/x509.h>
 
 #include "log.h"
 #include "http.h"
+#include "session.h"
 #include "ssl.h"
 
 extern char *prognm;
-static gnutls_certificate_credentials_t xcred;
+/* Shared by all connections, loaded at first connection, see ssl_reload() */
+static gnutls_certificate_credentials_t xcred = NULL;
+static struct stat ca_st;	/* ca-trust-file when xcred was loaded */
 
 
 /* This function will verify the peer's certificate, and check
@@ -118,23 +122,23 @@ error:
 	return 0;
 }
 
-static int ssl_set_ca_location(void)
+static int ssl_set_ca_location(gnutls_certificate_credentials_t cred)
 {
 	int num = 0;
 
 	/* A user defined CA PEM bundle overrides any built-ins or fall-backs */
 	if (ca_trust_file) {
-		num = gnutls_certificate_set_x509_trust_file(xcred, ca_trust_file, GNUTLS_X509_FMT_PEM);
+		num = gnutls_certificate_set_x509_trust_file(cred, ca_trust_file, GNUTLS_X509_FMT_PEM);
 		goto done;
 	}
 
 #ifdef gnutls_certificate_set_x509_system_trust /* Since 3.0.20 */
-	num = gnutls_certificate_set_x509_system_trust(xcred);
+	num = gnutls_certificate_set_x509_system_trust(cred);
 #endif
 	if (num <= 0)
-		num = gnutls_certificate_set_x509_trust_file(xcred, CAFILE1, GNUTLS_X509_FMT_PEM);
+		num = gnutls_certificate_set_x509_trust_file(cred, CAFILE1, GNUTLS_X509_FMT_PEM);
 	if (num <= 0)
-		num = gnutls_certificate_set_x509_trust_file(xcred, CAFILE2, GNUTLS_X509_FMT_PEM);
+		num = gnutls_certificate_set_x509_trust_file(cred, CAFILE2, GNUTLS_X509_FMT_PEM);
 done:
 	if (num <= 0)
 		return 1;
@@ -152,23 +156,72 @@ int ssl_init(void)
 	/* for backwards compatibility with gnutls < 3.3.0 */
 	gnutls_global_init();
 
-	/* X509 stuff */
-	gnutls_certificate_allocate_credentials(&xcred);
+	return 0;
+}
+
+
+void ssl_exit(void)
+{
+	if (xcred)
+		gnutls_certificate_free_credentials(xcred);
+	xcred = NULL;
+	session_exit();
+	gnutls_global_deinit();
+}
+
+/*
+ * Parsing the CA trust store is expensive, in both CPU and memory, so
+ * the X509 credentials are loaded once and shared by all connections.
+ */
+static int ssl_load(void)
+{
+	gnutls_certificate_credentials_t cred;
+
+	if (gnutls_certificate_allocate_credentials(&cred))
+		return RC_HTTPS_OUT_OF_MEMORY;
 
 	/* Try to figure out location of trusted CA certs on system */
-	if (ssl_set_ca_location())
+	if (ssl_set_ca_location(cred)) {
+		gnutls_certificate_free_credentials(cred);
 		return RC_HTTPS_NO_TRUSTED_CA_STORE;
+	}
 
-	gnutls_certificate_set_verify_function(xcred, verify_certificate_callback);
+	gnutls_certificate_set_verify_function(cred, verify_certificate_callback);
+
+	memset(&ca_st, 0, sizeof(ca_st));
+	if (ca_trust_file)
+		stat(ca_trust_file, &ca_st);
+
+	logit(LOG_DEBUG, "Loaded TLS credentials and CA trust store");
+	xcred = cred;
 
 	return 0;
 }
 
+/* Has ca-trust-file been replaced since it was loaded? */
+int ssl_changed(void)
+{
+	struct stat st;
 
-void ssl_exit(void)
+	if (!xcred || !ca_trust_file || stat(ca_trust_file, &st))
+		return 0;
+
+	return st.st_mtime != ca_st.st_mtime || st.st_size != ca_st.st_size || st.st_ino != ca_st.st_ino;
+}
+
+/*
+ * Drop shared credentials, loaded again with current settings at next
+ * connection.  Sessions refer to the credentials, so all connections
+ * must be closed first.
+ */
+void ssl_reload(void)
 {
-	gnutls_certificate_free_credentials(xcred);
-	gnutls_global_deinit();
+	if (xcred)
+		gnutls_certificate_free_credentials(xcred);
+	xcred = NULL;
+
+	/* Resumed sessions skip verification, start over with new settings */
+	session_flush();
 }
 
 void ssl_get_info(http_t *client)
@@ -186,21 +239,46 @@ void ssl_get_info(http_t *client)
 }
 
 
-int ssl_open(http_t *client, char *msg)
+/* Remember session for the next connection to the same server */
+static void ssl_save_session(http_t *client)
 {
-	int ret;
-	char buf[256];
-	size_t len;
+	gnutls_datum_t data;
+	unsigned int status;
+	const char *sn;
+	int port;
+
+	/* Resumed sessions skip verification, so only keep verified ones */
+	if (gnutls_certificate_verify_peers2(client->ssl, &status) || status)
+		return;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030605
+	/* With TLS 1.3 the session ticket arrives after the handshake, if at all */
+	if (gnutls_protocol_get_version(client->ssl) == GNUTLS_TLS1_3 &&
+	    !(gnutls_session_get_flags(client->ssl) & GNUTLS_SFLAGS_SESSION_TICKET))
+		return;
+#endif
+
+	if (gnutls_session_get_data2(client->ssl, &data))
+		return;
+
+	http_get_remote_name(client, &sn);
+	http_get_port(client, &port);
+	session_save(sn, port, data.data, data.size);
+	gnutls_free(data.data);
+}
+
+/* Set up TLS session on a connected socket, see ssl_handshake() */
+static int ssl_start(http_t *client)
+{
+	const unsigned char *data;
 	const char *sn, *err;
-	const gnutls_datum_t *cert_list;
-	unsigned int cert_list_size = 0;
-	gnutls_x509_crt_t cert;
+	size_t len;
+	int ret, port;
 
-	if (!client->ssl_enabled)
-		return tcp_init(&client->tcp, msg);
+	if (!xcred)
+		DO(ssl_load());
 
 	/* Initialize TLS session */
-	logit(LOG_INFO, "%s, initiating HTTPS ...", msg);
 	gnutls_init(&client->ssl, GNUTLS_CLIENT);
 
 	/* SSL SNI support: tell the servername we want to speak to */
@@ -221,27 +299,61 @@ int ssl_open(http_t *client, char *msg)
 	/* put the x509 credentials to the current session */
 	gnutls_credentials_set(client->ssl, GNUTLS_CRD_CERTIFICATE, xcred);
 
-	/* connect to the peer */
-	tcp_set_port(&client->tcp, HTTPS_DEFAULT_PORT);
-	DO(tcp_init(&client->tcp, msg));
+	/* Offer previous session with this server, for an abbreviated handshake */
+	http_get_port(client, &port);
+	if (!session_load(sn, port, &data, &len))
+		gnutls_session_set_data(client->ssl, data, len);
 
 	/* Forward TCP socket to GnuTLS, the set_int() API is perhaps too new still ... since 3.1.9 */
 //	gnutls_transport_set_int(client->ssl, client->tcp.socket);
 	gnutls_transport_set_ptr(client->ssl, (gnutls_transport_ptr_t)(intptr_t)client->tcp.socket);
 
+	return 0;
+}
+
+/* Interrupted operation must be called again when the socket is ready */
+static int ssl_want(http_t *client, int ret)
+{
+	if (ret != GNUTLS_E_AGAIN && ret != GNUTLS_E_INTERRUPTED)
+		return 0;
+
+	return gnutls_record_get_direction(client->ssl) ? RC_WANT_WRITE : RC_WANT_READ;
+}
+
+static int ssl_handshake(http_t *client)
+{
+	int ret, port;
+	char buf[256];
+	size_t len;
+	const char *sn;
+	const gnutls_datum_t *cert_list;
+	unsigned int cert_list_size = 0;
+	gnutls_x509_crt_t cert;
+
 	/* Perform the TLS handshake, ignore non-fatal errors. */
 	do {
+		int want;
+
 		ret = gnutls_handshake(client->ssl);
+		want = ssl_want(client, ret);
+		if (want)
+			return want;
 	}
 	while (ret != 0 && !gnutls_error_is_fatal(ret));
 
 	if (gnutls_error_is_fatal(ret)) {
+		http_get_remote_name(client, &sn);
 		logit(LOG_ERR, "SSL handshake with %s failed: %s", sn, gnutls_strerror(ret));
 		return RC_HTTPS_FAILED_CONNECT;
 	}
 
 	ssl_get_info(client);
 
+	http_get_remote_name(client, &sn);
+	http_get_port(client, &port);
+	session_stats(sn, port, gnutls_session_is_resumed(client->ssl));
+	ssl_save_session(client);
+
 	/* Get server's certificate (note: beware of dynamic allocation) - opt */
 	cert_list = gnutls_certificate_get_peers(client->ssl, &cert_list_size);
 	if (cert_list_size > 0) {
@@ -264,76 +376,76 @@ int ssl_open(http_t *client, char *msg)
 	return 0;
 }
 
-int ssl_close(http_t *client)
+static int ssl_close(http_t *client)
 {
-	if (client->ssl_enabled) {
+	if (client->ssl) {
+		/* Session tickets have arrived by now, if any */
+		ssl_save_session(client);
+
 		gnutls_bye(client->ssl, GNUTLS_SHUT_WR);
 		gnutls_deinit(client->ssl);
+		client->ssl = NULL;
 	}
 
 	return tcp_exit(&client->tcp);
 }
 
-int ssl_send(http_t *client, const char *buf, int len)
+static int ssl_write(http_t *client, const char *buf, int len, int *sent)
 {
 	int ret;
 
-	if (!client->ssl_enabled)
-		return tcp_send(&client->tcp, buf, len);
+	*sent = 0;
+	ret = gnutls_record_send(client->ssl, buf, len);
+	if (ret < 0) {
+		int want = ssl_want(client, ret);
 
-	do {
-		ret = gnutls_record_send(client->ssl, buf, len);
-	} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
+		if (want)
+			return want;
 
-	if (ret < 0)
+		logit(LOG_WARNING, "Failed sending GnuTLS request: %s", gnutls_strerror(ret));
 		return RC_HTTPS_SEND_ERROR;
+	}
 
-	logit(LOG_DEBUG, "Successfully sent HTTPS request!");
+	*sent = ret;
 
 	return 0;
 }
 
-int ssl_recv(http_t *client, char *buf, int buf_len, int *recv_len)
+/* Reads what is available, @recv_len is 0 when the server has closed the connection */
+static int ssl_read(http_t *client, char *buf, int buf_len, int *recv_len)
 {
-	int ret, len = buf_len;
+	int ret;
 
-	if (!client->ssl_enabled)
-		return tcp_recv(&client->tcp, buf, buf_len, recv_len);
+	*recv_len = 0;
+	ret = gnutls_record_recv(client->ssl, buf, buf_len);
+	if (ret < 0) {
+		int want = ssl_want(client, ret);
 
-	/* Read HTTP header */
-	do {
-		ret = gnutls_record_recv(client->ssl, buf, len);
-	} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
+		if (want)
+			return want;
 
-	if (ret < 0) {
-		logit(LOG_WARNING, "Failed receiving GnuTLS header response: %s",
-		      gnutls_strerror(ret));
-		return RC_HTTPS_RECV_ERROR;
-	}
+		/* Server closed connection without close_notify */
+		if (ret == GNUTLS_E_PREMATURE_TERMINATION)
+			return 0;
 
-	/* Read HTTP body */
-	len = ret;
-	buf_len -= ret;
-	do {
-		ret = gnutls_record_recv(client->ssl, &buf[len], buf_len);
-		if (ret >= 0) {
-			len += ret;
-			buf_len -= ret;
-		}
-	} while (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN);
-
-	if (ret < 0 && ret != GNUTLS_E_PREMATURE_TERMINATION) {
-		logit(LOG_WARNING, "Failed receiving GnuTLS body response: %s",
-		      gnutls_strerror(ret));
+		logit(LOG_WARNING, "Failed receiving GnuTLS response: %s", gnutls_strerror(ret));
 		return RC_HTTPS_RECV_ERROR;
 	}
 
-	*recv_len = len;
-	logit(LOG_DEBUG, "Successfully received HTTPS response (%d bytes)!", len);
+	*recv_len = ret;
 
 	return 0;
 }
 
+http_transport_t ssl_transport = {
+	.name      = "gnutls",
+	.start     = ssl_start,
+	.handshake = ssl_handshake,
+	.send      = ssl_write,
+	.recv      = ssl_read,
+	.close     = ssl_close,
+};
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
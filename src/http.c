@@ -20,11 +20,59 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "ssl.h"
 #include "http.h"
 #include "error.h"
+#include "log.h"
+#include "queue.h"
+
+/*
+ * Idle keep-alive connections, keyed on host, port and TLS.  The next
+ * transaction to the same server picks up the connection, saving both
+ * the TCP and TLS handshakes.  Newest connection first.
+ */
+struct conn {
+	TAILQ_ENTRY(conn) link;
+	long long         expires;	/* event_now() */
+	http_t            client;
+	char              host[];
+};
+
+static TAILQ_HEAD(pool, conn) pool = TAILQ_HEAD_INITIALIZER(pool);
+static int pool_len = 0;
+
+/* Transport for all clients, e.g. the mock in benchmarks, see http_set_transport() */
+static http_transport_t *transport = NULL;
+
+static int plain_send(http_t *client, const char *buf, int len, int *sent)
+{
+	return tcp_write(&client->tcp, buf, len, sent);
+}
+
+static int plain_recv(http_t *client, char *buf, int len, int *recv_len)
+{
+	return tcp_read(&client->tcp, buf, len, recv_len);
+}
+
+static int plain_close(http_t *client)
+{
+	return tcp_exit(&client->tcp);
+}
+
+http_transport_t http_tcp_transport = {
+	.name  = "tcp",
+	.send  = plain_send,
+	.recv  = plain_recv,
+	.close = plain_close,
+};
 
 int http_construct(http_t *client)
 {
@@ -48,29 +96,275 @@ int http_destruct(http_t *client, int num)
 	return rv;
 }
 
+/* Override transport of all clients, NULL: plain TCP or TLS, as per ssl_enabled */
+void http_set_transport(http_transport_t *tr)
+{
+	transport = tr;
+}
+
+static http_transport_t *http_transport(http_t *client)
+{
+	if (transport)
+		return transport;
+#ifdef ENABLE_SSL
+	if (client->ssl_enabled)
+		return &ssl_transport;
+#endif
+
+	return &http_tcp_transport;
+}
+
+static int http_close(http_t *client)
+{
+	if (!client->transport)
+		return tcp_exit(&client->tcp);
+
+	return client->transport->close(client);
+}
+
+static int http_send(http_t *client, const char *buf, int len, int *sent)
+{
+	http_transport_t *tr = client->transport;
+	int rc;
+
+	*sent = 0;
+	rc = tr->send(client, buf, len, sent);
+	tr->stats.sends++;
+	tr->stats.bytes_sent += *sent;
+
+	return rc;
+}
+
+static int http_recv(http_t *client, char *buf, int len, int *recv_len)
+{
+	http_transport_t *tr = client->transport;
+	int rc;
+
+	*recv_len = 0;
+	rc = tr->recv(client, buf, len, recv_len);
+	tr->stats.recvs++;
+	tr->stats.bytes_recv += *recv_len;
+
+	return rc;
+}
+
 static int local_set_params(http_t *client)
 {
 	int timeout = 0;
 	int port = 0;
 
+	client->transport = http_transport(client);
+
 	http_get_remote_timeout(client, &timeout);
 	if (timeout == 0)
 		http_set_remote_timeout(client, HTTP_DEFAULT_TIMEOUT);
 
+	/* Only the default port follows HTTPS, e.g. server:8443 is kept */
 	http_get_port(client, &port);
-	if (port == 0)
-		http_set_port(client, HTTP_DEFAULT_PORT);
+	if (port == 0 || port == HTTP_DEFAULT_PORT)
+		http_set_port(client, client->ssl_enabled ? HTTPS_DEFAULT_PORT : HTTP_DEFAULT_PORT);
 
 	return 0;
 }
 
+/* Move connection, socket and TLS session, from @src to @dst */
+static void http_move(http_t *dst, http_t *src)
+{
+	dst->tcp.socket      = src->tcp.socket;
+	dst->tcp.initialized = src->tcp.initialized;
+	dst->initialized     = src->initialized;
+	dst->transport       = src->transport;
+	dst->priv            = src->priv;
+	src->priv            = NULL;
+#ifdef ENABLE_SSL
+	dst->ssl             = src->ssl;
+	src->ssl             = NULL;
+#endif
+	src->tcp.socket      = -1;
+	src->tcp.initialized = 0;
+	src->initialized     = 0;
+}
+
+static void conn_close(struct conn *conn)
+{
+	TAILQ_REMOVE(&pool, conn, link);
+	pool_len--;
+
+	http_close(&conn->client);
+	free(conn);
+}
+
+/* Idle connection must not be readable, that is EOF or garbage */
+static int conn_alive(struct conn *conn)
+{
+	struct pollfd pfd = { conn->client.tcp.socket, POLLIN, 0 };
+
+	if (conn->expires < event_now())
+		return 0;
+
+	return poll(&pfd, 1, 0) == 0;
+}
+
+/* Pick up idle connection to the same server, if any */
+static int http_reuse(http_t *client)
+{
+	struct conn *conn, *tmp;
+	const char *host = NULL;
+	int port = 0;
+
+	http_get_remote_name(client, &host);
+	http_get_port(client, &port);
+	if (!host)
+		return 0;
+
+	TAILQ_FOREACH_SAFE(conn, &pool, link, tmp) {
+		if (strcmp(conn->host, host) || conn->client.tcp.port != port ||
+		    conn->client.transport != client->transport)
+			continue;
+
+		if (!conn_alive(conn)) {
+			logit(LOG_DEBUG, "Idle connection to %s:%d closed or expired", host, port);
+			conn_close(conn);
+			continue;
+		}
+
+		TAILQ_REMOVE(&pool, conn, link);
+		pool_len--;
+
+		http_move(client, &conn->client);
+		free(conn);
+
+		logit(LOG_DEBUG, "Reusing connection to %s:%d", host, port);
+		client->reused = 1;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Keep connection of a completed transaction for the next one */
+static int http_park(http_t *client)
+{
+	struct conn *conn;
+	const char *host = NULL;
+	int sd = client->tcp.socket;
+
+	http_get_remote_name(client, &host);
+	if (!host || sd < 0)
+		return 1;
+
+	/* Can be picked up by both blocking and non-blocking transactions */
+	if (fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK))
+		return 1;
+
+	conn = calloc(1, sizeof(*conn) + strlen(host) + 1);
+	if (!conn)
+		return 1;
+
+	strcpy(conn->host, host);
+	conn->expires = event_now() + client->keepalive * 1000LL;
+
+	http_construct(&conn->client);
+	conn->client.ssl_enabled = client->ssl_enabled;
+	http_set_remote_name(&conn->client, conn->host);
+	http_set_port(&conn->client, client->tcp.port);
+	http_move(&conn->client, client);
+	client->keepalive = 0;
+
+	TAILQ_INSERT_HEAD(&pool, conn, link);
+	if (++pool_len > HTTP_POOL_MAX)
+		conn_close(TAILQ_LAST(&pool, pool));
+
+	return 0;
+}
+
+/* Close all idle connections, e.g. on exit or SIGHUP */
+void http_pool_flush(void)
+{
+	while (!TAILQ_EMPTY(&pool))
+		conn_close(TAILQ_FIRST(&pool));
+}
+
+/*
+ * Wait for socket of blocking transaction, returns @err when the
+ * deadline of the transaction has passed.
+ */
+static int http_wait(http_t *client, int want, int err)
+{
+	struct pollfd pfd;
+	int msec;
+
+	pfd.fd      = client->tcp.socket;
+	pfd.events  = want == RC_WANT_READ ? POLLIN : POLLOUT;
+	pfd.revents = 0;
+
+	do {
+		msec = event_msec(client->deadline);
+		if (poll(&pfd, 1, msec) > 0)
+			return 0;
+	} while (msec > 0 && errno == EINTR);
+
+	logit(LOG_WARNING, "Timed out waiting for %s", client->tcp.remote_host);
+
+	return err;
+}
+
+/* Blocking connect and TLS handshake, within the deadline of the transaction */
+static int http_dial(http_t *client, char *msg)
+{
+	http_transport_t *tr = client->transport;
+	int rc;
+
+	if (tr->open)
+		rc = tr->open(client);
+	else
+		rc = tcp_init(&client->tcp, msg, client->deadline);
+	if (rc)
+		return rc;
+
+	if (tr->start) {
+		logit(LOG_INFO, "%s, initiating HTTPS ...", msg);
+		rc = tr->start(client);
+		while (!rc && ((rc = tr->handshake(client)) == RC_WANT_READ || rc == RC_WANT_WRITE))
+			rc = http_wait(client, rc, RC_HTTPS_FAILED_CONNECT);
+	}
+
+	if (rc) {
+		http_close(client);
+		return rc;
+	}
+	tr->stats.opens++;
+
+	return 0;
+}
+
+/* Set the deadline for a blocking transaction */
+static void http_deadline(http_t *client)
+{
+	int timeout = 0;
+
+	http_get_remote_timeout(client, &timeout);
+	client->deadline = event_now() + timeout;
+}
+
 int http_init(http_t *client, char *msg)
 {
 	int rc = 0;
 
+	client->msg       = msg;
+	client->reused    = 0;
+	client->keepalive = 0;
+
 	do {
 		TRY(local_set_params(client));
-		TRY(ssl_open(client, msg));
+
+		/* Overall deadline, for connecting and the transaction */
+		http_deadline(client);
+		if (http_reuse(client))
+			break;
+
+		TRY(http_dial(client, msg));
 	}
 	while (0);
 
@@ -84,38 +378,365 @@ int http_init(http_t *client, char *msg)
 	return 0;
 }
 
+static void http_stop(http_t *client)
+{
+	if (client->state == HTTP_RESOLVE)
+		dns_cancel(&client->tcp.res);
+	if (client->state == HTTP_CONNECT)
+		tcp_exit(&client->tcp);
+	if (client->tcp.socket > -1)
+		event_del(client->tcp.socket);
+	event_timer_del(&client->timer);
+	client->state = HTTP_IDLE;
+}
+
 int http_exit(http_t *client)
 {
 	ASSERT(client);
 
+	if (client->state != HTTP_IDLE)
+		http_stop(client);
+
 	if (!client->initialized)
 		return 0;
 
+	if (client->keepalive && !http_park(client))
+		return 0;
+
+	client->keepalive = 0;
 	client->initialized = 0;
-	return ssl_close(client);
+	return http_close(client);
+}
+
+/*
+ * Value of response header @name, leading whitespace skipped, or NULL.
+ * The value is not NUL terminated, it ends at the CRLF of its line.
+ */
+const char *http_header(http_trans_t *trans, const char *name)
+{
+	http_parser_t *p = &trans->parser;
+	int i, len = strlen(name);
+
+	for (i = 0; i < p->num; i++) {
+		http_header_t *hdr = &p->hdr[i];
+
+		if (hdr->name_len == len && !strncasecmp(trans->rsp + hdr->name, name, len))
+			return trans->rsp + hdr->value;
+	}
+
+	return NULL;
 }
 
-static void http_response_parse(http_trans_t *trans)
+/* Retry-After: is either a delay in seconds or an HTTP-date */
+static int http_retry_after(http_trans_t *trans)
 {
-	char *body;
-	char *rsp = trans->rsp_body = trans->rsp;
-	int status = trans->status = 0;
-	const char sep[] = "\r\n\r\n";
+	const char *ptr;
+	struct tm tm;
+	time_t when;
+
+	ptr = http_header(trans, "Retry-After");
+	if (!ptr)
+		return 0;
+
+	if (isdigit((unsigned char)*ptr))
+		return atoi(ptr);
+
+	memset(&tm, 0, sizeof(tm));
+	if (!strptime(ptr, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+		return 0;
+
+	when = timegm(&tm) - time(NULL);
+	if (when < 0)
+		return 0;
+	if (when > INT_MAX)
+		return INT_MAX;
 
+	return (int)when;
+}
+
+void http_parse_init(http_trans_t *trans)
+{
+	memset(&trans->parser, 0, sizeof(trans->parser));
 	memset(trans->status_desc, 0, sizeof(trans->status_desc));
+	trans->status = 0;
+	trans->rsp_len = 0;
+}
+
+/* Next line from parser position, returns length without CRLF, or -1 if incomplete */
+static int http_line(http_trans_t *trans, char **line)
+{
+	http_parser_t *p = &trans->parser;
+	char *ptr = trans->rsp + p->pos;
+	char *eol;
+
+	eol = memchr(ptr, '\n', trans->rsp_len - p->pos);
+	if (!eol)
+		return -1;
+
+	*line   = ptr;
+	p->pos += eol - ptr + 1;
+	if (eol > ptr && eol[-1] == '\r')
+		eol--;
+
+	return eol - ptr;
+}
+
+static void http_parse_header(http_trans_t *trans, char *line, int len)
+{
+	http_parser_t *p = &trans->parser;
+	http_header_t *hdr;
+	char *ptr;
+
+	ptr = memchr(line, ':', len);
+	if (!ptr || p->num >= HTTP_MAX_HEADERS)
+		return;
+
+	hdr = &p->hdr[p->num++];
+	hdr->name     = line - trans->rsp;
+	hdr->name_len = ptr - line;
+
+	for (ptr++; *ptr == ' ' || *ptr == '\t'; ptr++)
+		;
+	hdr->value = ptr - trans->rsp;
+}
+
+/* Headers are in, how do we know where the body ends? */
+static void http_parse_framing(http_trans_t *trans)
+{
+	http_parser_t *p = &trans->parser;
+	const char *val;
+
+	p->body   = p->pos;
+	p->remain = -1;
+
+	val = http_header(trans, "Transfer-Encoding");
+	if (val && !strncasecmp(val, "chunked", 7)) {
+		p->chunked = 1;
+		p->state = HTTP_PARSE_CHUNK_SIZE;
+		return;
+	}
+
+	/* No Content */
+	if (trans->status == 204 || trans->status == 304) {
+		p->state = HTTP_PARSE_DONE;
+		return;
+	}
+
+	val = http_header(trans, "Content-Length");
+	if (val && isdigit((unsigned char)*val))
+		p->remain = strtol(val, NULL, 10);
+
+	p->state = p->remain ? HTTP_PARSE_BODY : HTTP_PARSE_DONE;
+}
+
+/* Consume up to @remain bytes of body, chunks are joined in place */
+static void http_parse_body(http_trans_t *trans)
+{
+	http_parser_t *p = &trans->parser;
+	long len = trans->rsp_len - p->pos;
+
+	if (p->remain >= 0 && len > p->remain)
+		len = p->remain;
+
+	if (p->chunked)
+		memmove(trans->rsp + p->body + p->body_len, trans->rsp + p->pos, len);
+
+	p->pos      += len;
+	p->body_len += len;
+	if (p->remain > 0)
+		p->remain -= len;
+}
+
+/*
+ * Parse response data that has arrived since the last call.  Returns 1
+ * when the response is complete, 0 when more data is needed, or -1 on
+ * broken chunk framing.  Chunk headers are stripped as we go, moving
+ * the rest of the response down, so the body is always contiguous.
+ */
+int http_parse(http_trans_t *trans)
+{
+	http_parser_t *p = &trans->parser;
+	char *line;
+	int len, rc = 1;
 
-	if (rsp != NULL && (body = strstr(rsp, sep)) != NULL) {
-		body += strlen(sep);
-		trans->rsp_body = body;
+	while (p->state != HTTP_PARSE_DONE) {
+		if (p->state == HTTP_PARSE_BODY || p->state == HTTP_PARSE_CHUNK_DATA) {
+			http_parse_body(trans);
+			if (p->remain) {
+				rc = 0;
+				break;
+			}
+
+			p->state = p->chunked ? HTTP_PARSE_CHUNK_END : HTTP_PARSE_DONE;
+			continue;
+		}
+
+		len = http_line(trans, &line);
+		if (len < 0) {
+			rc = 0;
+			break;
+		}
+
+		switch (p->state) {
+		case HTTP_PARSE_STATUS:
+			/*
+			 * %*c         : HTTP/1.0, 1.1 etc, discard read value
+			 * %4d         : HTTP status code, e.g. 200
+			 * %255[^\r\n] : HTTP status text, e.g. OK -- Reads max 255 bytes, including \0, not \r or \n
+			 */
+			if (sscanf(line, "HTTP/1.%*c %4d %255[^\r\n]", &trans->status, trans->status_desc) < 1) {
+				/* Not HTTP, all of it is body and ends when server closes */
+				trans->status = 0;
+				p->pos   = 0;
+				p->state = HTTP_PARSE_BODY;
+				p->remain = -1;
+				break;
+			}
+			p->state = HTTP_PARSE_HEADERS;
+			break;
+
+		case HTTP_PARSE_HEADERS:
+			if (len)
+				http_parse_header(trans, line, len);
+			else
+				http_parse_framing(trans);
+			break;
+
+		case HTTP_PARSE_CHUNK_SIZE:
+			if (!isxdigit((unsigned char)*line))
+				return -1;
+
+			p->remain = strtol(line, NULL, 16);
+			if (p->remain < 0 || p->remain == LONG_MAX)
+				return -1;
+
+			p->state = p->remain ? HTTP_PARSE_CHUNK_DATA : HTTP_PARSE_TRAILER;
+			break;
+
+		case HTTP_PARSE_CHUNK_END:
+			if (len)
+				return -1;
+			p->state = HTTP_PARSE_CHUNK_SIZE;
+			break;
+
+		case HTTP_PARSE_TRAILER:
+			if (!len)
+				p->state = HTTP_PARSE_DONE;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	/* Drop what has been parsed of chunk framing, freeing up buffer space */
+	if (p->chunked && p->pos > p->body + p->body_len) {
+		int end = p->body + p->body_len;
+
+		memmove(trans->rsp + end, trans->rsp + p->pos, trans->rsp_len - p->pos);
+		trans->rsp_len -= p->pos - end;
+		trans->rsp[trans->rsp_len] = 0;
+		p->pos = end;
 	}
 
-	/*
-	 * %*c         : HTTP/1.0, 1.1 etc, discard read value
-	 * %4d         : HTTP status code, e.g. 200
-	 * %255[^\r\n] : HTTP status text, e.g. OK -- Reads max 255 bytes, including \0, not \r or \n
-	 */
-	if (sscanf(trans->rsp, "HTTP/1.%*c %4d %255[^\r\n]", &status, trans->status_desc) == 2)
-		trans->status = status;
+	return rc;
+}
+
+/* Response is in, or server closed the connection, or buffer is full */
+void http_response_parse(http_trans_t *trans)
+{
+	http_parser_t *p = &trans->parser;
+
+	trans->rsp_body = trans->rsp;
+	if (p->state >= HTTP_PARSE_BODY)
+		trans->rsp_body = trans->rsp + p->body;
+
+	/* Anything after the end of the response is not for us */
+	if (p->state == HTTP_PARSE_DONE) {
+		trans->rsp_len = p->body + p->body_len;
+		trans->rsp[trans->rsp_len] = 0;
+	}
+
+	trans->retry_after = http_retry_after(trans);
+}
+
+/*
+ * Complete response, can the connection be used for another request?
+ * Returns the idle time (sec) the server allows, or 0 for no.
+ */
+static int http_keepalive(http_trans_t *trans)
+{
+	const char *val;
+	int timeout = HTTP_KEEPALIVE_TIMEOUT;
+
+	if (strncmp(trans->rsp, "HTTP/1.1", 8))
+		return 0;
+
+	val = http_header(trans, "Connection");
+	if (val && !strncasecmp(val, "close", 5))
+		return 0;
+
+	/* Keep-Alive: timeout=5, max=100 -- stay clear of the server's limit */
+	val = http_header(trans, "Keep-Alive");
+	if (val && (val = strcasestr(val, "timeout=")) && atoi(val + 8) <= timeout)
+		timeout = atoi(val + 8) - 1;
+
+	return timeout > 0 ? timeout : 0;
+}
+
+static int http_exchange(http_t *client, http_trans_t *trans)
+{
+	int rc, num, sent = 0;
+
+	http_parse_init(trans);
+	while (sent < trans->req_len) {
+		num = 0;
+		rc = http_send(client, trans->req + sent, trans->req_len - sent, &num);
+		if (rc == RC_WANT_READ || rc == RC_WANT_WRITE)
+			rc = http_wait(client, rc, RC_TCP_SEND_ERROR);
+		if (rc)
+			return rc;
+
+		sent += num;
+	}
+	logit(LOG_DEBUG, "Successfully sent HTTP(S) request!");
+
+	while (trans->rsp_len < trans->max_rsp_len) {
+		num = 0;
+		rc = http_recv(client, trans->rsp + trans->rsp_len, trans->max_rsp_len - trans->rsp_len, &num);
+		if (rc == RC_WANT_READ || rc == RC_WANT_WRITE) {
+			rc = http_wait(client, rc, RC_TCP_RECV_ERROR);
+			if (rc)
+				return rc;
+			continue;
+		}
+		if (rc)
+			return rc;
+
+		/* Server closed connection */
+		if (!num)
+			break;
+
+		trans->rsp_len += num;
+		trans->rsp[trans->rsp_len] = 0;
+
+		rc = http_parse(trans);
+		if (rc < 0) {
+			logit(LOG_WARNING, "Malformed HTTP response from %s", client->tcp.remote_host);
+			return RC_TCP_RECV_ERROR;
+		}
+		if (rc) {
+			client->keepalive = http_keepalive(trans);
+			break;
+		}
+	}
+
+	if (!trans->rsp_len)
+		return RC_TCP_RECV_ERROR;
+
+	logit(LOG_DEBUG, "Successfully received HTTP(S) response (%d bytes)!", trans->rsp_len);
+
+	return 0;
 }
 
 int http_transaction(http_t *client, http_trans_t *trans)
@@ -128,12 +749,21 @@ int http_transaction(http_t *client, http_trans_t *trans)
 	if (!client->initialized)
 		return RC_HTTP_OBJECT_NOT_INITIALIZED;
 
-	trans->rsp_len = 0;
-	do {
-		TRY(ssl_send(client, trans->req, trans->req_len));
-		TRY(ssl_recv(client, trans->rsp, trans->max_rsp_len, &trans->rsp_len));
+	client->keepalive = 0;
+	rc = http_exchange(client, trans);
+
+	/* Server may have closed idle connection just as we sent, retry once */
+	if (rc && client->reused && !trans->rsp_len) {
+		logit(LOG_DEBUG, "Reused connection failed, reconnecting ...");
+		http_close(client);
+		client->reused = 0;
+
+		/* Fresh deadline, a silently dropped connection may have used it all */
+		http_deadline(client);
+		rc = http_dial(client, client->msg);
+		if (!rc)
+			rc = http_exchange(client, trans);
 	}
-	while (0);
 
 	trans->rsp[trans->rsp_len] = 0;
 	http_response_parse(trans);
@@ -141,6 +771,319 @@ int http_transaction(http_t *client, http_trans_t *trans)
 	return rc;
 }
 
+/*
+ * Non-blocking transactions.  Instead of blocking in each of connect,
+ * TLS handshake, send and receive, the client is a small state machine
+ * driven by the event loop.  This way the updates of several providers
+ * and aliases can be in flight at the same time.
+ */
+
+static void http_io(int sd, int revents, void *arg);
+static void http_resolved(int rc, void *arg);
+static void http_connected(int rc, void *arg);
+
+/*
+ * Start connecting to the addresses of the server.  On RC_WANT_WRITE
+ * http_connected() is called back when done.
+ */
+static int http_open(http_t *client)
+{
+	int rc;
+
+	rc = tcp_connect(&client->tcp, client->msg, http_connected, client);
+	if (rc && rc != RC_WANT_WRITE)
+		return rc;
+
+	client->initialized = 1;
+	client->state = HTTP_CONNECT;
+
+	return rc;
+}
+
+/* Pick up an idle connection from the pool, or look up server and connect */
+static int http_connect(http_t *client, int reuse)
+{
+	int rc;
+
+	client->sent = 0;
+	http_parse_init(client->trans);
+
+	if (reuse && http_reuse(client)) {
+		client->state = HTTP_SEND;
+		return 0;
+	}
+
+	/* Transport with its own connection, e.g. the mock */
+	if (client->transport->open) {
+		rc = client->transport->open(client);
+		if (rc)
+			return rc;
+
+		client->initialized = 1;
+		client->state = HTTP_CONNECT;
+		return 0;
+	}
+
+	rc = tcp_resolve(&client->tcp, http_resolved, client);
+	if (rc == RC_WANT_RESOLVE) {
+		client->state = HTTP_RESOLVE;
+		return rc;
+	}
+	if (rc)
+		return rc;
+
+	return http_open(client);
+}
+
+static void http_step(http_t *client);
+
+/* Server may have closed idle connection just as we sent, retry once */
+static int http_retry(http_t *client)
+{
+	int timeout = 0;
+	int rc;
+
+	logit(LOG_DEBUG, "Reused connection failed, reconnecting ...");
+	if (client->tcp.socket > -1)
+		event_del(client->tcp.socket);
+	http_close(client);
+	client->reused = 0;
+
+	/* Fresh deadline, a silently dropped connection may have used it all */
+	http_get_remote_timeout(client, &timeout);
+	if (event_timer_set(&client->timer, timeout))
+		return RC_OUT_OF_MEMORY;
+
+	rc = http_connect(client, 0);
+	if (rc == RC_WANT_RESOLVE || rc == RC_WANT_WRITE)
+		return 0;
+	if (rc)
+		return rc;
+
+	http_step(client);
+
+	return 0;
+}
+
+static void http_done(http_t *client, int rc)
+{
+	http_trans_t *trans = client->trans;
+
+	if (rc && client->reused && !trans->rsp_len && !http_retry(client))
+		return;
+
+	http_stop(client);
+
+	if (!rc)
+		logit(LOG_DEBUG, "Successfully received HTTP(S) response (%d bytes)!", trans->rsp_len);
+
+	trans->rsp[trans->rsp_len] = 0;
+	http_response_parse(trans);
+
+	client->cb(client, trans, rc, client->arg);
+}
+
+/* Advance as far as possible, until the socket would block */
+static void http_step(http_t *client)
+{
+	http_trans_t *trans = client->trans;
+	int rc = 0, num;
+
+	/* Socket may change, e.g. when connecting to next address */
+	if (client->tcp.socket > -1)
+		event_del(client->tcp.socket);
+
+	while (!rc) {
+		switch (client->state) {
+		case HTTP_CONNECT:
+			client->state = HTTP_SEND;
+			if (client->transport->start) {
+				logit(LOG_INFO, "%s, initiating HTTPS ...", client->msg);
+				rc = client->transport->start(client);
+				client->state = HTTP_HANDSHAKE;
+				break;
+			}
+			client->transport->stats.opens++;
+			break;
+
+		case HTTP_HANDSHAKE:
+			rc = client->transport->handshake(client);
+			if (!rc) {
+				client->transport->stats.opens++;
+				client->state = HTTP_SEND;
+			}
+			break;
+
+		case HTTP_SEND:
+			rc = http_send(client, trans->req + client->sent, trans->req_len - client->sent, &num);
+			if (rc)
+				break;
+
+			client->sent += num;
+			if (client->sent >= trans->req_len) {
+				logit(LOG_DEBUG, "Successfully sent HTTP(S) request!");
+				client->state = HTTP_RECV;
+			}
+			break;
+
+		case HTTP_RECV:
+			rc = http_recv(client, trans->rsp + trans->rsp_len, trans->max_rsp_len - trans->rsp_len, &num);
+			if (rc)
+				break;
+
+			trans->rsp_len += num;
+			trans->rsp[trans->rsp_len] = 0;
+
+			/* Server closed connection, buffer full, or complete response */
+			if (!num) {
+				http_done(client, trans->rsp_len ? 0 : RC_TCP_RECV_ERROR);
+				return;
+			}
+			rc = http_parse(trans);
+			if (rc < 0) {
+				logit(LOG_WARNING, "Malformed HTTP response from %s", client->tcp.remote_host);
+				http_done(client, RC_TCP_RECV_ERROR);
+				return;
+			}
+			if (rc) {
+				client->keepalive = http_keepalive(trans);
+				http_done(client, 0);
+				return;
+			}
+			if (trans->rsp_len >= trans->max_rsp_len) {
+				http_done(client, 0);
+				return;
+			}
+			break;
+
+		default:
+			return;
+		}
+	}
+
+	if (rc == RC_WANT_READ || rc == RC_WANT_WRITE) {
+		if (!event_add(client->tcp.socket, rc == RC_WANT_READ ? POLLIN : POLLOUT, http_io, client))
+			return;
+		rc = RC_OUT_OF_MEMORY;
+	}
+
+	http_done(client, rc);
+}
+
+static void http_io(int sd, int revents, void *arg)
+{
+	http_step((http_t *)arg);
+}
+
+/* Addresses of server are in, or lookup failed */
+static void http_resolved(int rc, void *arg)
+{
+	http_t *client = (http_t *)arg;
+
+	if (!rc)
+		rc = http_open(client);
+	if (rc == RC_WANT_WRITE)
+		return;
+	if (rc) {
+		http_done(client, rc);
+		return;
+	}
+
+	http_step(client);
+}
+
+/* Connected to one of the addresses of the server, or all failed */
+static void http_connected(int rc, void *arg)
+{
+	http_t *client = (http_t *)arg;
+
+	if (rc) {
+		http_done(client, rc);
+		return;
+	}
+
+	http_step(client);
+}
+
+static void http_timeout(event_timer_t *timer, void *arg)
+{
+	http_t *client = (http_t *)arg;
+	int rc;
+
+	switch (client->state) {
+	case HTTP_RESOLVE:
+		rc = RC_TCP_INVALID_REMOTE_ADDR;
+		break;
+
+	case HTTP_CONNECT:
+		rc = RC_TCP_CONNECT_FAILED;
+		break;
+
+	case HTTP_HANDSHAKE:
+		rc = RC_HTTPS_FAILED_CONNECT;
+		break;
+
+	case HTTP_SEND:
+		rc = RC_TCP_SEND_ERROR;
+		break;
+
+	default:
+		rc = RC_TCP_RECV_ERROR;
+		break;
+	}
+
+	logit(LOG_WARNING, "Timed out waiting for %s", client->tcp.remote_host);
+	http_done(client, rc);
+}
+
+/*
+ * Start a non-blocking transaction.  The callback @cb is called from
+ * the event loop when the transaction is done, or has failed.  Like
+ * http_transaction() the response is always NUL terminated.  Returns
+ * non-zero, without calling @cb, if the transaction cannot be started.
+ */
+int http_start(http_t *client, http_trans_t *trans, char *msg, http_cb_t cb, void *arg)
+{
+	int timeout = 0;
+	int rc;
+
+	ASSERT(client);
+	ASSERT(trans);
+	ASSERT(cb);
+
+	if (client->state != HTTP_IDLE)
+		return RC_ERROR;
+
+	local_set_params(client);
+
+	client->trans     = trans;
+	client->msg       = msg;
+	client->cb        = cb;
+	client->arg       = arg;
+	client->reused    = 0;
+	client->keepalive = 0;
+
+	rc = http_connect(client, 1);
+	if (rc && rc != RC_WANT_WRITE && rc != RC_WANT_RESOLVE)
+		return rc;
+
+	/* Overall deadline for the whole transaction */
+	http_get_remote_timeout(client, &timeout);
+	event_timer_init(&client->timer, http_timeout, client);
+	if (event_timer_set(&client->timer, timeout)) {
+		http_exit(client);
+		return RC_OUT_OF_MEMORY;
+	}
+
+	/* Called back when the server has been looked up, or connected */
+	if (rc == RC_WANT_RESOLVE || rc == RC_WANT_WRITE)
+		return 0;
+
+	http_step(client);
+
+	return 0;
+}
+
 int http_status_valid(int status)
 {
 	if (status == 200)
@@ -149,7 +1092,8 @@ int http_status_valid(int status)
 	if (status == 401 || status == 403)
 		return RC_DDNS_RSP_AUTH_FAIL;
 
-	if (status >= 500 && status < 600)
+	/* Too Many Requests, or server error */
+	if (status == 429 || (status >= 500 && status < 600))
 		return RC_DDNS_RSP_RETRY_LATER;
 
 	return RC_DDNS_RSP_NOTOK;
@@ -27,4 +27,5 @@
  */
 
 #define JSMN_STRICT
+#define JSMN_PARENT_LINKS
 #include "jsmn.h"
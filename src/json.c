@@ -19,40 +19,160 @@
  * Boston, MA  02110-1301, USA.
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "log.h"
 #include "json.h"
 
-int parse_json(const char *json, jsmntok_t *out_tokens[])
-{
-	int num_tokens;
+#define JSON_MIN_TOKENS 64
 
+/*
+ * Parse a document into the token arena in one pass.  When the arena
+ * is too small jsmn stops where it is, so we grow it and let it pick up
+ * from there.  Returns number of tokens, or -1 on error.
+ */
+int json_parse(json_t *doc, const char *js)
+{
 	jsmn_parser parser;
+	size_t len;
+	int num;
+
+	doc->js  = js;
+	doc->num = 0;
+	len = strlen(js);
+
 	jsmn_init(&parser);
-	num_tokens = jsmn_parse(&parser, json, strlen(json), NULL, 0);
+	num = doc->tok ? 0 : JSMN_ERROR_NOMEM;
+	do {
+		if (num == JSMN_ERROR_NOMEM) {
+			int max = doc->max ? doc->max * 2 : JSON_MIN_TOKENS;
+			jsmntok_t *tok;
+
+			tok = realloc(doc->tok, max * sizeof(jsmntok_t));
+			if (!tok) {
+				logit(LOG_ERR, "Couldn't allocate memory to parse JSON.");
+				return -1;
+			}
+
+			doc->tok = tok;
+			doc->max = max;
+		}
 
-	if (num_tokens < 0) {
+		num = jsmn_parse(&parser, js, len, doc->tok, doc->max);
+	} while (num == JSMN_ERROR_NOMEM);
+
+	if (num < 0) {
 		logit(LOG_ERR, "Failed to parse JSON.");
 		return -1;
 	}
 
-	if (num_tokens == 0) {
+	if (num == 0) {
 		logit(LOG_WARNING, "No JSON found in string.");
 		return -1;
 	}
 
-	*out_tokens = malloc(num_tokens * sizeof(jsmntok_t));
+	doc->num = num;
 
-	if (!(*out_tokens)) {
-		logit(LOG_ERR, "Couldn't allocate memory to parse JSON.");
-		return -1;
+	return num;
+}
+
+void json_free(json_t *doc)
+{
+	free(doc->tok);
+	memset(doc, 0, sizeof(*doc));
+}
+
+/* First member (key) of an object, or first element of an array */
+jsmntok_t *json_first(json_t *doc, const jsmntok_t *tok)
+{
+	if (!tok || tok->size == 0)
+		return NULL;
+	if (tok->type != JSMN_OBJECT && tok->type != JSMN_ARRAY)
+		return NULL;
+
+	return (jsmntok_t *)tok + 1;
+}
+
+/*
+ * Next sibling, skipping the subtree of tok, e.g. a key and its value.
+ * Tokens are ordered by offset, so the subtree ends at the first token
+ * starting after it, which we can bisect for instead of walking it.
+ */
+jsmntok_t *json_next(json_t *doc, const jsmntok_t *tok)
+{
+	int lo, hi, end;
+
+	end = tok->end;
+	if (tok->type == JSMN_STRING && tok->size == 1)
+		end = tok[1].end;
+
+	lo = tok - doc->tok + 1;
+	hi = doc->num;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (doc->tok[mid].start < end)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	jsmn_init(&parser);
-	jsmn_parse(&parser, json, strlen(json), *out_tokens, num_tokens);
+	if (lo >= doc->num || doc->tok[lo].parent != tok->parent)
+		return NULL;
 
-	return num_tokens;
+	return &doc->tok[lo];
+}
+
+/*
+ * Look up a value by path, relative to from, or the document root if
+ * NULL.  E.g. "success", "status.code", or "result[0].id".
+ */
+jsmntok_t *json_get(json_t *doc, const jsmntok_t *from, const char *path)
+{
+	const jsmntok_t *tok;
+	size_t len;
+
+	if (!from) {
+		if (doc->num < 1)
+			return NULL;
+		from = doc->tok;
+	}
+
+	tok = from;
+	while (tok && *path) {
+		const jsmntok_t *key;
+
+		if (*path == '[') {
+			char *end;
+			long idx;
+
+			idx = strtol(path + 1, &end, 10);
+			if (*end != ']' || idx < 0 || tok->type != JSMN_ARRAY)
+				return NULL;
+			path = end + 1;
+
+			for (tok = json_first(doc, tok); tok && idx--; )
+				tok = json_next(doc, tok);
+			continue;
+		}
+
+		if (*path == '.')
+			path++;
+		if (tok->type != JSMN_OBJECT)
+			return NULL;
+
+		len = strcspn(path, ".[");
+		for (key = json_first(doc, tok); key; key = json_next(doc, key)) {
+			if (key->type == JSMN_STRING && key->end - key->start == (int)len &&
+			    !memcmp(doc->js + key->start, path, len))
+				break;
+		}
+		tok  = key ? key + 1 : NULL;
+		path += len;
+	}
+
+	return (jsmntok_t *)tok;
 }
 
 int jsoneq(const char *json, const jsmntok_t *tok, const char *s)
@@ -74,3 +194,36 @@ int json_bool(const char *json, const jsmntok_t *token, int *out_value)
 
 	return -1;
 }
+
+/* Integer value, from a number or from a string, e.g. "id": "1234" */
+int json_long(const char *json, const jsmntok_t *token, long *out_value)
+{
+	char buf[24], *end;
+
+	if (json_copy(json, token, buf, sizeof(buf)) || !buf[0])
+		return -1;
+
+	*out_value = strtol(buf, &end, 10);
+	if (*end)
+		return -1;
+
+	return 0;
+}
+
+/* Copy a string or primitive value, -1 if it does not fit */
+int json_copy(const char *json, const jsmntok_t *token, char *dest, size_t len)
+{
+	size_t num;
+
+	if (token->type != JSMN_STRING && token->type != JSMN_PRIMITIVE)
+		return -1;
+
+	num = token->end - token->start;
+	if (num >= len)
+		return -1;
+
+	memcpy(dest, json + token->start, num);
+	dest[num] = 0;
+
+	return 0;
+}
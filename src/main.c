@@ -31,7 +31,9 @@
 
 #include "log.h"
 #include "ddns.h"
+#include "dns.h"
 #include "error.h"
+#include "event.h"
 #include "ssl.h"
 
 int    once = 0;
@@ -39,9 +41,11 @@ int    force = 0;		/* Only allowed with 'once' */
 int    ignore_errors = 0;
 int    startup_delay = DDNS_DEFAULT_STARTUP_SLEEP;
 int    allow_ipv6 = 0;
+int    use_netlink = 0;		/* Linux only, react to iface changes */
 int    secure_ssl = 1;		/* Strict cert validation by default */
 int    broken_rtc = 0;		/* Validate certificate time by default */
 char  *ca_trust_file = NULL;	/* Custom CA trust file/bundle PEM format */
+int    ssl_session_cache = 0;	/* Save TLS sessions in cache dir */
 int    verify_addr = 1;
 char  *prognm = NULL;
 char  *ident = PACKAGE_NAME;
@@ -95,10 +99,7 @@ static int alloc_context(ddns_t **pctx)
 
 		ctx->cmd = NO_CMD;
 		ctx->normal_update_period_sec = DDNS_DEFAULT_PERIOD;
-		ctx->update_period = DDNS_DEFAULT_PERIOD;
 		ctx->total_iterations = DDNS_DEFAULT_ITERATIONS;
-		ctx->cmd_check_period = DDNS_DEFAULT_CMD_CHECK_PERIOD;
-		ctx->force_addr_update = 0;
 
 		ctx->initialized = 0;
 	}
@@ -530,6 +531,8 @@ int main(int argc, char *argv[])
 	} while (restart);
 
 	ssl_exit();
+	dns_exit();
+	event_exit();
 leave:
 	log_exit();
 	free(config);
@@ -0,0 +1,186 @@
+/* In-memory loopback transport, for benchmarks
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * No network, requests are handed to a callback which plays the server.
+ * With http_set_transport(&mock_transport) both http_transaction() and
+ * the request/response path of every plugin run at memory speed, e.g.
+ * to measure their CPU cost per update, see bench/microbench.c
+ *
+ * Each connection has a socketpair that is never written to, only so
+ * the connection looks alive to the pool in http.c and is kept alive
+ * between transactions, like with a real server.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "mock.h"
+
+struct mock {
+	int   peer;		/* Other end of client->tcp.socket */
+	int   req_len;
+	int   rsp_len;
+	int   rsp_pos;
+	int   served;
+	char  req[MOCK_BUF_SIZE];
+	char  rsp[MOCK_BUF_SIZE];
+};
+
+static mock_cb_t  handler;
+static void      *handler_arg;
+
+void mock_set_handler(mock_cb_t cb, void *arg)
+{
+	handler     = cb;
+	handler_arg = arg;
+}
+
+static int mock_open(http_t *client)
+{
+	struct mock *mock;
+	int sd[2];
+
+	if (!handler)
+		return RC_TCP_CONNECT_FAILED;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sd))
+		return RC_TCP_SOCKET_CREATE_ERROR;
+
+	mock = calloc(1, sizeof(*mock));
+	if (!mock) {
+		close(sd[0]);
+		close(sd[1]);
+		return RC_OUT_OF_MEMORY;
+	}
+
+	mock->peer = sd[0];
+	client->priv = mock;
+	client->tcp.socket = sd[1];
+
+	return 0;
+}
+
+/* Headers, and body if there is a Content-Length */
+static int mock_complete(struct mock *mock)
+{
+	const char *end, *len;
+
+	end = strstr(mock->req, "\r\n\r\n");
+	if (!end)
+		return 0;
+
+	len = strcasestr(mock->req, "\r\nContent-Length:");
+	if (!len || len > end)
+		return 1;
+
+	return mock->req + mock->req_len - (end + 4) >= atoi(len + 17);
+}
+
+static int mock_send(http_t *client, const char *buf, int len, int *sent)
+{
+	struct mock *mock = client->priv;
+	int room;
+
+	*sent = 0;
+	if (!mock)
+		return RC_TCP_OBJECT_NOT_INITIALIZED;
+
+	/* Previous response handed out, next request on a kept alive connection */
+	if (mock->served && mock->rsp_pos == mock->rsp_len) {
+		mock->req_len = 0;
+		mock->rsp_len = 0;
+		mock->rsp_pos = 0;
+		mock->served  = 0;
+	}
+
+	room = sizeof(mock->req) - 1 - mock->req_len;
+	if (len > room)
+		len = room;
+	if (!len)
+		return RC_TCP_SEND_ERROR;
+
+	memcpy(mock->req + mock->req_len, buf, len);
+	mock->req_len += len;
+	mock->req[mock->req_len] = 0;
+	*sent = len;
+
+	if (!mock->served && mock_complete(mock)) {
+		mock->rsp_len = handler(mock->req, mock->req_len, mock->rsp, sizeof(mock->rsp), handler_arg);
+		if (mock->rsp_len < 0 || mock->rsp_len > (int)sizeof(mock->rsp))
+			return RC_TCP_SEND_ERROR;
+		mock->served = 1;
+	}
+
+	return 0;
+}
+
+/* Hands out the response, then zero bytes as if the server closed */
+static int mock_recv(http_t *client, char *buf, int len, int *recv_len)
+{
+	struct mock *mock = client->priv;
+
+	*recv_len = 0;
+	if (!mock)
+		return RC_TCP_OBJECT_NOT_INITIALIZED;
+
+	if (len > mock->rsp_len - mock->rsp_pos)
+		len = mock->rsp_len - mock->rsp_pos;
+
+	memcpy(buf, mock->rsp + mock->rsp_pos, len);
+	mock->rsp_pos += len;
+	*recv_len = len;
+
+	return 0;
+}
+
+static int mock_close(http_t *client)
+{
+	struct mock *mock = client->priv;
+
+	if (mock) {
+		close(mock->peer);
+		close(client->tcp.socket);
+		free(mock);
+	}
+	client->priv = NULL;
+	client->tcp.socket = -1;
+
+	return 0;
+}
+
+http_transport_t mock_transport = {
+	.name  = "mock",
+	.open  = mock_open,
+	.send  = mock_send,
+	.recv  = mock_recv,
+	.close = mock_close,
+};
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
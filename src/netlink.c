@@ -0,0 +1,204 @@
+/* Linux netlink monitor of interface address and route changes
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Instead of waiting for the next periodic check to notice that the
+ * address of the WAN interface has changed, subscribe to the kernel's
+ * address and route change notifications.  Any new or removed address
+ * on --iface, or change of default route, triggers an immediate check.
+ */
+
+#include <unistd.h>
+#include <net/if.h>
+
+#include "ddns.h"
+#include "event.h"
+#include "netlink.h"
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+static int nl_sd = -1;
+
+/* Address events of interest, any on @ifname, new ones when usable */
+static int addr_changed(struct nlmsghdr *nlh, unsigned int ifindex)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+		return 0;
+
+	if (ifa->ifa_index != ifindex)
+		return 0;
+
+	/* IPv6 address not usable until DAD completes, new event then */
+	if (nlh->nlmsg_type == RTM_NEWADDR && (ifa->ifa_flags & IFA_F_TENTATIVE))
+		return 0;
+
+	return 1;
+}
+
+/* Only default route changes, on @ifname if set, are of interest */
+static int route_changed(struct nlmsghdr *nlh, unsigned int ifindex)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct rtattr *rta;
+	int len;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm)))
+		return 0;
+
+	if (rtm->rtm_table != RT_TABLE_MAIN || rtm->rtm_dst_len != 0)
+		return 0;
+
+	if (!ifindex)
+		return 1;
+
+	len = RTM_PAYLOAD(nlh);
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type != RTA_OIF)
+			continue;
+
+		return *(unsigned int *)RTA_DATA(rta) == ifindex;
+	}
+
+	return 0;
+}
+
+static void netlink_cb(int sd, int revents, void *arg)
+{
+	ddns_t *ctx = (ddns_t *)arg;
+	unsigned int ifindex = 0;
+	char buf[8192];
+	int changed = 0;
+	ssize_t len;
+
+	if (iface)
+		ifindex = if_nametoindex(iface);
+
+	/* Drain socket, a DHCP renew or PPP reconnect is a burst of messages */
+	while ((len = recv(sd, buf, sizeof(buf), 0)) != 0) {
+		struct nlmsghdr *nlh;
+
+		if (len < 0) {
+			/* Kernel dropped messages, we cannot know what changed */
+			if (errno == ENOBUFS) {
+				changed = 1;
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			switch (nlh->nlmsg_type) {
+			case RTM_NEWADDR:
+			case RTM_DELADDR:
+				if (ifindex && addr_changed(nlh, ifindex))
+					changed = 1;
+				break;
+
+			case RTM_NEWROUTE:
+			case RTM_DELROUTE:
+				if (route_changed(nlh, ifindex))
+					changed = 1;
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+
+	if (!changed)
+		return;
+
+	logit(LOG_INFO, "Address or route change detected%s%s, checking ...",
+	      iface ? " on " : "", iface ? iface : "");
+	if (ctx->cmd == NO_CMD)
+		ctx->cmd = CMD_ADDR_CHANGED;
+}
+
+/*
+ * Subscribe to IPv4/IPv6 address and route changes.  Events are
+ * handled from the event loop, setting ctx->cmd to CMD_ADDR_CHANGED.
+ */
+int netlink_init(void *ctx)
+{
+	struct sockaddr_nl sa;
+
+	if (nl_sd != -1)
+		return 0;
+
+	nl_sd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl_sd == -1) {
+		logit(LOG_WARNING, "Failed opening netlink socket: %s", strerror(errno));
+		return RC_ERROR;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+		       RTMGRP_IPV4_ROUTE  | RTMGRP_IPV6_ROUTE;
+	if (bind(nl_sd, (struct sockaddr *)&sa, sizeof(sa)) || event_add(nl_sd, POLLIN, netlink_cb, ctx)) {
+		logit(LOG_WARNING, "Failed subscribing to netlink events: %s", strerror(errno));
+		close(nl_sd);
+		nl_sd = -1;
+		return RC_ERROR;
+	}
+
+	logit(LOG_DEBUG, "Monitoring address changes%s%s using netlink",
+	      iface ? " on " : "", iface ? iface : "");
+
+	return 0;
+}
+
+void netlink_exit(void)
+{
+	if (nl_sd == -1)
+		return;
+
+	event_del(nl_sd);
+	close(nl_sd);
+	nl_sd = -1;
+}
+
+#else /* !HAVE_LINUX_RTNETLINK_H */
+
+int netlink_init(void *ctx)
+{
+	logit(LOG_WARNING, "Netlink not supported on this system, using periodic checks.");
+	return RC_ERROR;
+}
+
+void netlink_exit(void)
+{
+}
+#endif /* HAVE_LINUX_RTNETLINK_H */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
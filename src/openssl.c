@@ -19,10 +19,17 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <sys/stat.h>
+
 #include "log.h"
 #include "http.h"
+#include "session.h"
 #include "ssl.h"
 
+/* Shared by all connections, loaded at first connection, see ssl_reload() */
+static SSL_CTX     *tls_ctx = NULL;
+static struct stat  ca_st;	/* ca-trust-file when tls_ctx was loaded */
+
 int ssl_init(void)
 {
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -36,6 +43,10 @@ int ssl_init(void)
 
 void ssl_exit(void)
 {
+	if (tls_ctx)
+		SSL_CTX_free(tls_ctx);
+	tls_ctx = NULL;
+	session_exit();
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 	ERR_free_strings();
 	EVP_cleanup();
@@ -91,21 +102,21 @@ static int verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
 	return 1;
 }
 
-static int ssl_set_ca_location(http_t *client)
+static int ssl_set_ca_location(SSL_CTX *ssl_ctx)
 {
 	int ret;
 
 	/* A user defined CA PEM bundle overrides any built-ins or fall-backs */
 	if (ca_trust_file) {
-		ret = SSL_CTX_load_verify_locations(client->ssl_ctx, ca_trust_file, NULL);
+		ret = SSL_CTX_load_verify_locations(ssl_ctx, ca_trust_file, NULL);
 		goto done;
 	}
 
-	ret = SSL_CTX_set_default_verify_paths(client->ssl_ctx);
+	ret = SSL_CTX_set_default_verify_paths(ssl_ctx);
 	if (ret < 1)
-		ret = SSL_CTX_load_verify_locations(client->ssl_ctx, CAFILE1, NULL);
+		ret = SSL_CTX_load_verify_locations(ssl_ctx, CAFILE1, NULL);
 	if (ret < 1)
-		ret = SSL_CTX_load_verify_locations(client->ssl_ctx, CAFILE2, NULL);
+		ret = SSL_CTX_load_verify_locations(ssl_ctx, CAFILE2, NULL);
 done:
 	if (ret < 1)
 		return 1;
@@ -132,38 +143,119 @@ static void ssl_check_error(void)
 	ERR_print_errors_cb(ssl_error_cb, NULL);
 }
 
-int ssl_open(http_t *client, char *msg)
+/* Remember session for the next connection to the same server */
+static void ssl_save_session(http_t *client)
 {
+	unsigned char *buf, *ptr;
+	SSL_SESSION *sess;
 	const char *sn;
-	char buf[512];
-	X509 *cert;
-	int rc;
+	int len, port;
+
+	/* Resumed sessions skip verification, so only keep verified ones */
+	if (SSL_get_verify_result(client->ssl) != X509_V_OK)
+		return;
+
+	sess = SSL_get1_session(client->ssl);
+	if (!sess)
+		return;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	/* With TLS 1.3 the session ticket arrives after the handshake */
+	if (!SSL_SESSION_is_resumable(sess))
+		goto done;
+#endif
+
+	len = i2d_SSL_SESSION(sess, NULL);
+	if (len <= 0 || len > SESSION_MAX_LEN)
+		goto done;
 
-	if (!client->ssl_enabled)
-		return tcp_init(&client->tcp, msg);
+	buf = ptr = malloc(len);
+	if (buf && i2d_SSL_SESSION(sess, &ptr) == len) {
+		http_get_remote_name(client, &sn);
+		http_get_port(client, &port);
+		session_save(sn, port, buf, len);
+	}
+	free(buf);
+done:
+	SSL_SESSION_free(sess);
+}
 
-	tcp_set_port(&client->tcp, HTTPS_DEFAULT_PORT);
-	DO(tcp_init(&client->tcp, msg));
+/*
+ * Parsing the CA trust store is expensive, in both CPU and memory, so
+ * the client context is loaded once and shared by all connections.
+ */
+static int ssl_load(void)
+{
+	SSL_CTX *ssl_ctx;
 
-	logit(LOG_INFO, "%s, initiating HTTPS ...", msg);
-	client->ssl_ctx = SSL_CTX_new(SSLv23_client_method());
-	if (!client->ssl_ctx)
+	ssl_ctx = SSL_CTX_new(SSLv23_client_method());
+	if (!ssl_ctx)
 		return RC_HTTPS_OUT_OF_MEMORY;
 
 	/* POODLE, only allow TLSv1.x or later */
 #ifndef OPENSSL_NO_EC
-	SSL_CTX_set_options(client->ssl_ctx, SSL_OP_SINGLE_ECDH_USE | SSL_OP_SINGLE_DH_USE | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_SINGLE_ECDH_USE | SSL_OP_SINGLE_DH_USE | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
 #else
-	SSL_CTX_set_options(client->ssl_ctx, SSL_OP_SINGLE_DH_USE | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_SINGLE_DH_USE | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
 #endif
-	SSL_CTX_set_verify(client->ssl_ctx, SSL_VERIFY_PEER, verify_callback);
-	SSL_CTX_set_verify_depth(client->ssl_ctx, 150);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	/* Many DDNS servers close the connection without close_notify */
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, verify_callback);
+	SSL_CTX_set_verify_depth(ssl_ctx, 150);
 
 	/* Try to figure out location of trusted CA certs on system */
-	if (ssl_set_ca_location(client))
+	if (ssl_set_ca_location(ssl_ctx)) {
+		SSL_CTX_free(ssl_ctx);
 		return RC_HTTPS_NO_TRUSTED_CA_STORE;
+	}
+
+	memset(&ca_st, 0, sizeof(ca_st));
+	if (ca_trust_file)
+		stat(ca_trust_file, &ca_st);
 
-	client->ssl = SSL_new(client->ssl_ctx);
+	logit(LOG_DEBUG, "Loaded TLS context and CA trust store");
+	tls_ctx = ssl_ctx;
+
+	return 0;
+}
+
+/* Has ca-trust-file been replaced since it was loaded? */
+int ssl_changed(void)
+{
+	struct stat st;
+
+	if (!tls_ctx || !ca_trust_file || stat(ca_trust_file, &st))
+		return 0;
+
+	return st.st_mtime != ca_st.st_mtime || st.st_size != ca_st.st_size || st.st_ino != ca_st.st_ino;
+}
+
+/* Drop shared context, loaded again with current settings at next connection */
+void ssl_reload(void)
+{
+	/* Reference counted, any remaining connections keep their copy */
+	if (tls_ctx)
+		SSL_CTX_free(tls_ctx);
+	tls_ctx = NULL;
+
+	/* Resumed sessions skip verification, start over with new settings */
+	session_flush();
+}
+
+/* Set up TLS session on a connected socket, see ssl_handshake() */
+static int ssl_start(http_t *client)
+{
+	const unsigned char *data;
+	const char *sn;
+	size_t len;
+	int port;
+
+	if (!tls_ctx)
+		DO(ssl_load());
+
+	client->ssl = SSL_new(tls_ctx);
 	if (!client->ssl)
 		return RC_HTTPS_OUT_OF_MEMORY;
 
@@ -172,15 +264,65 @@ int ssl_open(http_t *client, char *msg)
 	if (!SSL_set_tlsext_host_name(client->ssl, sn))
 		return RC_HTTPS_SNI_ERROR;
 
+	/* Offer previous session with this server, for an abbreviated handshake */
+	http_get_port(client, &port);
+	if (!session_load(sn, port, &data, &len)) {
+		SSL_SESSION *sess;
+
+		sess = d2i_SSL_SESSION(NULL, &data, len);
+		if (sess) {
+			SSL_set_session(client->ssl, sess);
+			SSL_SESSION_free(sess);
+		}
+	}
+
 	SSL_set_fd(client->ssl, client->tcp.socket);
+
+	return 0;
+}
+
+static int ssl_want(http_t *client, int rc)
+{
+	switch (SSL_get_error(client->ssl, rc)) {
+	case SSL_ERROR_WANT_READ:
+		return RC_WANT_READ;
+
+	case SSL_ERROR_WANT_WRITE:
+		return RC_WANT_WRITE;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int ssl_handshake(http_t *client)
+{
+	const char *sn;
+	char buf[512];
+	X509 *cert;
+	int rc, port;
+
+	ERR_clear_error();
 	rc = SSL_connect(client->ssl);
-	if (rc < 0) {
+	if (rc <= 0) {
+		int want = ssl_want(client, rc);
+
+		if (want)
+			return want;
+
 		ssl_check_error();
 		return RC_HTTPS_FAILED_CONNECT;
 	}
 
 	logit(LOG_INFO, "SSL connection using %s", SSL_get_cipher(client->ssl));
 
+	http_get_remote_name(client, &sn);
+	http_get_port(client, &port);
+	session_stats(sn, port, SSL_session_reused(client->ssl));
+	ssl_save_session(client);
+
 	cert = SSL_get_peer_certificate(client->ssl);
 	if (!cert)
 		return RC_HTTPS_FAILED_GETTING_CERT;
@@ -198,83 +340,93 @@ int ssl_open(http_t *client, char *msg)
 	return 0;
 }
 
-int ssl_close(http_t *client)
+static int ssl_close(http_t *client)
 {
-	if (client->ssl_enabled) {
-		if (client->ssl) {
-			/* SSL/TLS close_notify */
-			SSL_shutdown(client->ssl);
-
-			/* Clean up. */
-			SSL_free(client->ssl);
-			client->ssl = NULL;
-		}
-		if (client->ssl_ctx) {
-			SSL_CTX_free(client->ssl_ctx);
-			client->ssl_ctx = NULL;
-		}
+	if (client->ssl) {
+		/* Session tickets have arrived by now, if any */
+		if (SSL_is_init_finished(client->ssl))
+			ssl_save_session(client);
+
+		/* SSL/TLS close_notify */
+		SSL_shutdown(client->ssl);
+
+		/* Clean up. */
+		SSL_free(client->ssl);
+		client->ssl = NULL;
 	}
 
 	return tcp_exit(&client->tcp);
 }
 
-int ssl_send(http_t *client, const char *buf, int len)
+static int ssl_write(http_t *client, const char *buf, int len, int *sent)
 {
-	int rc, err = SSL_ERROR_NONE;
-
-	if (!client->ssl_enabled)
-		return tcp_send(&client->tcp, buf, len);
+	int rc;
 
+	*sent = 0;
 	ERR_clear_error();
-	if((rc = SSL_write(client->ssl, buf, len)) <= 0){
-		err = SSL_get_error(client->ssl, rc);
-		if(err == SSL_ERROR_WANT_WRITE){
-			return ssl_send(client, buf, len);
-		}
-	}
+	rc = SSL_write(client->ssl, buf, len);
 	if (rc <= 0) {
+		int want = ssl_want(client, rc);
+
+		if (want)
+			return want;
+
 		ssl_check_error();
 		return RC_HTTPS_SEND_ERROR;
 	}
 
-	logit(LOG_DEBUG, "Successfully sent HTTPS request!");
+	*sent = rc;
 
 	return 0;
 }
 
-int ssl_recv(http_t *client, char *buf, int buf_len, int *recv_len)
+/* Reads what is available, @recv_len is 0 when the server has closed the connection */
+static int ssl_read(http_t *client, char *buf, int buf_len, int *recv_len)
 {
-	int len, rc, err = SSL_ERROR_NONE;
+	int rc;
 
 	*recv_len = 0;
-	if (!client->ssl_enabled)
-		return tcp_recv(&client->tcp, buf, buf_len, recv_len);
-
 	ERR_clear_error();
-	/* Read HTTP header */
-	len = rc = SSL_read(client->ssl, buf, buf_len);
+	rc = SSL_read(client->ssl, buf, buf_len);
 	if (rc <= 0) {
-		err = SSL_get_error(client->ssl, rc);
-		if(err == SSL_ERROR_WANT_READ){
-			return ssl_recv(client, buf, buf_len, recv_len);
+		switch (SSL_get_error(client->ssl, rc)) {
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+
+		case SSL_ERROR_SYSCALL:
+			/* Server closed connection without close_notify */
+			if (rc == 0 && !ERR_peek_error())
+				return 0;
+			break;
+
+		case SSL_ERROR_WANT_READ:
+			return RC_WANT_READ;
+
+		case SSL_ERROR_WANT_WRITE:
+			return RC_WANT_WRITE;
+
+		default:
+			break;
 		}
+
 		ssl_check_error();
 		return RC_HTTPS_RECV_ERROR;
 	}
-	*recv_len += len;
 
-	/* Read HTTP body */
-	len = rc = SSL_read(client->ssl, &buf[len], buf_len - len);
-	if (rc <= 0) {
-		ssl_check_error();
-		len = 0;
-	}
-	*recv_len += len;
-	logit(LOG_DEBUG, "Successfully received HTTPS response (%d bytes)!", *recv_len);
+	*recv_len = rc;
 
 	return 0;
 }
 
+http_transport_t ssl_transport = {
+	.name      = "openssl",
+	.start     = ssl_start,
+	.handshake = ssl_handshake,
+	.send      = ssl_write,
+	.recv      = ssl_read,
+	.close     = ssl_close,
+};
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
@@ -20,17 +20,21 @@
  * Boston, MA  02110-1301, USA.
  */
 
+#include <fcntl.h>
 #include <libgen.h>		/* dirname() */
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <stdio.h>		/* fopen() et al */
 #include <stdlib.h>		/* atoi() */
+#include <unistd.h>
 
 #include "log.h"
 #include "cache.h"
+#include "event.h"
 
 static void *param = NULL;
+static int   sigpipe[2] = { -1, -1 };
 
 
 /**
@@ -83,14 +87,23 @@ int os_shell_execute(char *cmd, char *ip, char *name)
  * printf() is not one of the safe syscalls to be used, according to
  * POSIX signal(7). The calls are commented, since they are most likely
  * also only needed for debugging.
+ *
+ * To wake up the main loop, regardless of where in poll() it is, a byte
+ * is also written to the self-pipe, write() is async-signal-safe.
  */
 static void unix_signal_handler(int signo)
 {
 	ddns_t *ctx = (ddns_t *)param;
+	int saved_errno = errno;
+	char c = (char)signo;
 
 	if (ctx == NULL)
 		return;
 
+	/* A full pipe means the main loop is already being woken up */
+	if (sigpipe[1] != -1 && write(sigpipe[1], &c, 1) < 0)
+		errno = saved_errno;
+
 	switch (signo) {
 	case SIGHUP:
 		ctx->cmd = CMD_RESTART;
@@ -114,6 +127,32 @@ static void unix_signal_handler(int signo)
 	}
 }
 
+/* Drain self-pipe, ctx->cmd has already been set by the signal handler */
+static void signal_cb(int sd, int revents, void *arg)
+{
+	char buf[16];
+
+	(void)revents;
+	(void)arg;
+	while (read(sd, buf, sizeof(buf)) > 0)
+		;
+}
+
+static int signal_pipe_init(void)
+{
+	int i;
+
+	if (pipe(sigpipe))
+		return 1;
+
+	for (i = 0; i < 2; i++) {
+		fcntl(sigpipe[i], F_SETFL, fcntl(sigpipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	return event_add(sigpipe[0], POLLIN, signal_cb, NULL);
+}
+
 /*
  * Set SIGCHLD to 'ignore', i.e., children are automatically reaped,
  * as of POSIX.1-2001.  This is fine since we are (currently) not
@@ -152,7 +191,9 @@ static int os_install_child_handler(void)
  * Install signal handler for signals HUP, INT, TERM and USR1
  *
  * Also block exactly the handled signals, only for the duration
- * of the handler.  All other signals are left alone.
+ * of the handler.  All other signals are left alone.  The self-pipe
+ * is registered with the event loop, so any of these signals wakes
+ * up the main loop immediately.
  */
 int os_install_signal_handler(void *ctx)
 {
@@ -168,7 +209,8 @@ int os_install_signal_handler(void *ctx)
 #endif
 		sa.sa_handler = unix_signal_handler;
 
-		rc = (sigemptyset(&sa.sa_mask)        ||
+		rc = (signal_pipe_init()              ||
+		      sigemptyset(&sa.sa_mask)        ||
 		      sigaddset(&sa.sa_mask, SIGHUP)  ||
 		      sigaddset(&sa.sa_mask, SIGINT)  ||
 		      sigaddset(&sa.sa_mask, SIGTERM) ||
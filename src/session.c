@@ -0,0 +1,224 @@
+/* TLS session cache, for abbreviated handshakes on reconnect
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, visit the Free Software Foundation
+ * website at http://www.gnu.org/licenses/gpl-2.0.html or write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+
+/*
+ * A full TLS handshake, with its public key operations, is the single
+ * most expensive part of an update on a small router.  Both OpenSSL and
+ * GnuTLS can resume a previous session with an abbreviated handshake,
+ * provided the client remembers the session (ticket).  This is that
+ * memory: one serialized session per server, kept in memory and, with
+ * ssl-session-cache enabled, also in the cache directory so sessions
+ * survive a restart.  Each TLS backend serializes its own sessions.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "queue.h"
+#include "session.h"
+
+struct session {
+	LIST_ENTRY(session) link;
+
+	unsigned char *data;
+	size_t         len;	/* 0: none yet */
+
+	char           key[];	/* host:port */
+};
+
+static LIST_HEAD(, session) sessions = LIST_HEAD_INITIALIZER(sessions);
+
+static unsigned int handshakes = 0;
+static unsigned int resumed    = 0;
+
+static char *session_file(struct session *s, char *buf, size_t len)
+{
+	if (snprintf(buf, len, "%s/%s.session", cache_dir, s->key) >= (int)len)
+		return NULL;
+
+	return buf;
+}
+
+static void session_read(struct session *s)
+{
+	char path[256];
+	struct stat st;
+	FILE *fp;
+
+	if (!session_file(s, path, sizeof(path)))
+		return;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	if (!fstat(fileno(fp), &st) && st.st_size > 0 && st.st_size <= SESSION_MAX_LEN) {
+		s->data = malloc(st.st_size);
+		if (s->data && fread(s->data, st.st_size, 1, fp) == 1) {
+			logit(LOG_DEBUG, "Loaded TLS session for %s from %s", s->key, path);
+			s->len = st.st_size;
+		}
+	}
+
+	fclose(fp);
+}
+
+/* Session secrets, readable only by us */
+static void session_write(struct session *s)
+{
+	char path[256];
+	int fd;
+
+	if (!session_file(s, path, sizeof(path)))
+		return;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		logit(LOG_DEBUG, "Failed saving TLS session to %s: %s", path, strerror(errno));
+		return;
+	}
+
+	if (write(fd, s->data, s->len) != (ssize_t)s->len)
+		logit(LOG_DEBUG, "Failed saving TLS session to %s: %s", path, strerror(errno));
+	close(fd);
+}
+
+static struct session *session_find(const char *host, int port)
+{
+	struct session *s;
+	char key[300];
+
+	snprintf(key, sizeof(key), "%s:%d", host, port);
+	LIST_FOREACH(s, &sessions, link) {
+		if (!strcmp(s->key, key))
+			return s;
+	}
+
+	s = calloc(1, sizeof(*s) + strlen(key) + 1);
+	if (!s)
+		return NULL;
+
+	strcpy(s->key, key);
+	LIST_INSERT_HEAD(&sessions, s, link);
+
+	/* First connection to this server since start, check disk */
+	if (ssl_session_cache)
+		session_read(s);
+
+	return s;
+}
+
+/*
+ * Find a session to resume with @host:@port, returns non-zero if there
+ * is none.  The data is owned by the cache and valid until next save.
+ */
+int session_load(const char *host, int port, const unsigned char **data, size_t *len)
+{
+	struct session *s;
+
+	s = session_find(host, port);
+	if (!s || !s->len)
+		return 1;
+
+	*data = s->data;
+	*len  = s->len;
+
+	return 0;
+}
+
+void session_save(const char *host, int port, const unsigned char *data, size_t len)
+{
+	struct session *s;
+	unsigned char *ptr;
+
+	if (!len || len > SESSION_MAX_LEN)
+		return;
+
+	s = session_find(host, port);
+	if (!s)
+		return;
+
+	if (s->len == len && !memcmp(s->data, data, len))
+		return;
+
+	ptr = realloc(s->data, len);
+	if (!ptr)
+		return;
+
+	memcpy(ptr, data, len);
+	s->data = ptr;
+	s->len  = len;
+
+	if (ssl_session_cache)
+		session_write(s);
+}
+
+/* Book keeping of handshakes, to see the resumption hit rate in the log */
+void session_stats(const char *host, int port, int reused)
+{
+	handshakes++;
+	if (reused)
+		resumed++;
+
+	logit(LOG_DEBUG, "%s TLS session with %s:%d, %u of %u handshakes resumed (%u%%)",
+	      reused ? "Resumed" : "New", host, port, resumed, handshakes, resumed * 100 / handshakes);
+}
+
+/* Trust store has changed, sessions verified against the old one are dropped */
+void session_flush(void)
+{
+	struct session *s;
+	char path[256];
+
+	while ((s = LIST_FIRST(&sessions))) {
+		if (ssl_session_cache && session_file(s, path, sizeof(path)))
+			remove(path);
+
+		LIST_REMOVE(s, link);
+		free(s->data);
+		free(s);
+	}
+}
+
+void session_exit(void)
+{
+	struct session *s;
+
+	while ((s = LIST_FIRST(&sessions))) {
+		LIST_REMOVE(s, link);
+		free(s->data);
+		free(s);
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
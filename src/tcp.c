@@ -21,6 +21,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,11 +30,10 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <arpa/nameser.h>
 #include <net/if.h>
 #include <netinet/in.h>
-#include <resolv.h>
 
+#include "event.h"
 #include "log.h"
 #include "tcp.h"
 
@@ -72,40 +72,259 @@ static int soerror(int sd)
 }
 
 /*
- * In the wonderful world of network programming the manual states that
- * EINPROGRESS is only a possible error on non-blocking sockets.  Real world
- * experience, however, suggests otherwise.  Simply poll() for completion and
- * then continue. --Joachim
+ * Happy Eyeballs, RFC 8305.  Instead of waiting for each address of the
+ * server to time out in turn, e.g. on a network with broken IPv6, a new
+ * connection attempt is started every TCP_ATTEMPT_DELAY msec, alternating
+ * between address families.  The first attempt to connect wins, and the
+ * ones still in flight are closed.
  */
-static int check_error(int sd, int msec)
+
+/* Alternate address families, starting with the preferred one */
+static void interleave(dns_result_t *res)
+{
+	dns_addr_t first[DNS_MAX_ADDRS], other[DNS_MAX_ADDRS];
+	int i, j = 0, k = 0, n = 0;
+
+	for (i = 0; i < res->count; i++) {
+		if (res->addr[i].sa.sa_family == res->addr[0].sa.sa_family)
+			first[j++] = res->addr[i];
+		else
+			other[k++] = res->addr[i];
+	}
+
+	for (i = 0; i < j || i < k; i++) {
+		if (i < j)
+			res->addr[n++] = first[i];
+		if (i < k)
+			res->addr[n++] = other[i];
+	}
+}
+
+static void attempt_close(tcp_sock_t *tcp, int i)
+{
+	if (tcp->sd[i] < 0)
+		return;
+
+	event_del(tcp->sd[i]);
+	close(tcp->sd[i]);
+	tcp->sd[i] = -1;
+}
+
+/* Keep connection of attempt @i, close all others */
+static void attempt_won(tcp_sock_t *tcp, int i)
+{
+	dns_addr_t *addr = &tcp->res.addr[i];
+	int j;
+
+	tcp->socket = tcp->sd[i];
+	tcp->sd[i] = -1;
+	event_del(tcp->socket);
+
+	for (j = 0; j < tcp->next; j++)
+		attempt_close(tcp, j);
+	event_timer_del(&tcp->timer);
+
+	logit(LOG_INFO, "Connected to %s over %s.", tcp->remote_host,
+	      addr->sa.sa_family == AF_INET6 ? "IPv6" : "IPv4");
+}
+
+/* Start connecting to address @i, returns 0 if connected at once */
+static int attempt_start(tcp_sock_t *tcp, int i)
+{
+	dns_addr_t *addr = &tcp->res.addr[i];
+	char host[NI_MAXHOST];
+	int sd;
+
+	tcp->sd[i] = -1;
+
+	dns_setport(addr, tcp->port);
+	if (getnameinfo(&addr->sa, dns_addrlen(addr), host, sizeof(host), NULL, 0, NI_NUMERICHOST))
+		return RC_TCP_CONNECT_FAILED;
+
+	sd = socket(addr->sa.sa_family, SOCK_STREAM, 0);
+	if (sd == -1) {
+		logit(LOG_ERR, "Error creating client socket: %s", strerror(errno));
+		return RC_TCP_SOCKET_CREATE_ERROR;
+	}
+	tcp->sd[i] = sd;
+
+	if (fcntl(sd, F_SETFD, FD_CLOEXEC) || fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK)) {
+		logit(LOG_ERR, "Failed setting client socket non-blocking: %s", strerror(errno));
+		attempt_close(tcp, i);
+		return RC_TCP_SOCKET_CREATE_ERROR;
+	}
+
+	logit(LOG_INFO, "%s, %sconnecting to %s([%s]:%d)", tcp->msg, tcp->tries++ ? "also " : "",
+	      tcp->remote_host, host, tcp->port);
+	if (!connect(sd, &addr->sa, dns_addrlen(addr)))
+		return 0;
+	if (errno == EINPROGRESS)
+		return RC_WANT_WRITE;
+
+	logit(LOG_INFO, "Failed connecting to that server: %s", strerror(errno));
+	attempt_close(tcp, i);
+
+	return RC_TCP_CONNECT_FAILED;
+}
+
+static void tcp_io(int sd, int revents, void *arg);
+
+static int attempts_in_flight(tcp_sock_t *tcp)
+{
+	int i;
+
+	for (i = 0; i < tcp->next; i++) {
+		if (tcp->sd[i] > -1)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Start next connection attempt, skipping addresses that fail at once,
+ * e.g. with no route to that address family.  Returns 0 when connected,
+ * or RC_WANT_WRITE while attempts are still in flight.
+ */
+static int race(tcp_sock_t *tcp)
 {
-	struct pollfd pfd = { sd, POLLOUT, 0 };
+	int rc;
 
-	if (EINPROGRESS == errno) {
-		logit(LOG_INFO, "Waiting (%d sec) for three-way handshake to complete ...", msec / 1000);
-		if (poll (&pfd, 1, msec) > 0 && !soerror(sd)) {
-			logit(LOG_INFO, "Connected.");
+	while (tcp->next < tcp->res.count) {
+		int i = tcp->next++;
+
+		rc = attempt_start(tcp, i);
+		if (!rc) {
+			attempt_won(tcp, i);
 			return 0;
 		}
+		if (rc != RC_WANT_WRITE)
+			continue;
+
+		if (tcp->cb && event_add(tcp->sd[i], POLLOUT, tcp_io, tcp)) {
+			attempt_close(tcp, i);
+			return RC_OUT_OF_MEMORY;
+		}
+
+		tcp->stagger = event_now() + TCP_ATTEMPT_DELAY;
+		if (tcp->cb && tcp->next < tcp->res.count)
+			event_timer_set(&tcp->timer, TCP_ATTEMPT_DELAY);
+
+		return RC_WANT_WRITE;
 	}
 
-	return 1;
+	if (attempts_in_flight(tcp))
+		return RC_WANT_WRITE;
+
+	logit(LOG_WARNING, "Failed connecting to %s: %s", tcp->remote_host, strerror(errno));
+
+	return RC_TCP_CONNECT_FAILED;
 }
 
-static void set_timeouts(int sd, int timeout)
+/* Attempt @i is writable, check outcome, on failure start next attempt at once */
+static int attempt_done(tcp_sock_t *tcp, int i)
 {
-	struct timeval sv;
-
-	memset(&sv, 0, sizeof(sv));
-	sv.tv_sec  =  timeout / 1000;
-	sv.tv_usec = (timeout % 1000) * 1000;
-	if (-1 == setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &sv, sizeof(sv)))
-		logit(LOG_INFO, "Failed setting receive timeout socket option: %s", strerror(errno));
-	if (-1 == setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &sv, sizeof(sv)))
-		logit(LOG_INFO, "Failed setting send timeout socket option: %s", strerror(errno));
+	if (!soerror(tcp->sd[i])) {
+		attempt_won(tcp, i);
+		return 0;
+	}
+
+	logit(LOG_INFO, "Failed connecting to that server: %s", strerror(errno));
+	attempt_close(tcp, i);
+
+	return race(tcp);
+}
+
+static void tcp_done(tcp_sock_t *tcp, int rc)
+{
+	if (rc == RC_WANT_WRITE)
+		return;
+
+	tcp->cb(rc, tcp->arg);
+}
+
+static void tcp_io(int sd, int revents, void *arg)
+{
+	tcp_sock_t *tcp = (tcp_sock_t *)arg;
+	int i;
+
+	for (i = 0; i < tcp->next; i++) {
+		if (tcp->sd[i] == sd) {
+			tcp_done(tcp, attempt_done(tcp, i));
+			return;
+		}
+	}
+}
+
+/* No reply yet from attempts in flight, time to start another one */
+static void tcp_stagger(event_timer_t *timer, void *arg)
+{
+	tcp_sock_t *tcp = (tcp_sock_t *)arg;
+
+	tcp_done(tcp, race(tcp));
 }
 
-int tcp_init(tcp_sock_t *tcp, char *msg)
+static int race_start(tcp_sock_t *tcp, char *msg, tcp_cb_t cb, void *arg)
+{
+	if (!tcp->res.count)
+		return RC_TCP_INVALID_REMOTE_ADDR;
+
+	interleave(&tcp->res);
+	tcp->next  = 0;
+	tcp->tries = 0;
+	tcp->msg   = msg;
+	tcp->cb    = cb;
+	tcp->arg   = arg;
+	event_timer_init(&tcp->timer, tcp_stagger, tcp);
+	tcp->initialized = 1;
+
+	return race(tcp);
+}
+
+/* Wait for attempts in flight, or until it is time to start another one */
+static int race_wait(tcp_sock_t *tcp, long long deadline)
+{
+	struct pollfd pfd[DNS_MAX_ADDRS];
+	int idx[DNS_MAX_ADDRS];
+	int i, num = 0, msec;
+
+	msec = event_msec(deadline);
+	if (!msec) {
+		logit(LOG_WARNING, "Timed out connecting to %s", tcp->remote_host);
+		return RC_TCP_CONNECT_FAILED;
+	}
+
+	if (tcp->next < tcp->res.count && event_msec(tcp->stagger) < msec)
+		msec = event_msec(tcp->stagger);
+
+	for (i = 0; i < tcp->next; i++) {
+		if (tcp->sd[i] < 0)
+			continue;
+
+		pfd[num].fd      = tcp->sd[i];
+		pfd[num].events  = POLLOUT;
+		pfd[num].revents = 0;
+		idx[num++] = i;
+	}
+
+	if (poll(pfd, num, msec) > 0) {
+		for (i = 0; i < num; i++) {
+			if (pfd[i].revents)
+				return attempt_done(tcp, idx[i]);
+		}
+	}
+
+	if (tcp->next < tcp->res.count && !event_msec(tcp->stagger))
+		return race(tcp);
+
+	return RC_WANT_WRITE;
+}
+
+/*
+ * Connect, bounded by @deadline, an event_now() time.  The socket is
+ * left non-blocking, callers poll() it with the same deadline.
+ */
+int tcp_init(tcp_sock_t *tcp, char *msg, long long deadline)
 {
 	int rc = 0;
 
@@ -115,78 +334,23 @@ int tcp_init(tcp_sock_t *tcp, char *msg)
 		return 0;
 
 	do {
-		int s, sd, tries = 0;
-		char port[10];
-		char host[NI_MAXHOST];
-		struct addrinfo hints, *servinfo, *ai;
-		struct sockaddr *sa;
-		socklen_t len;
-
 		/* remote address */
 		if (!tcp->remote_host)
 			break;
 
-		/* Clear DNS cache before calling getaddrinfo(). */
-		res_init();
-
-		/* Obtain address(es) matching host/port */
-		memset(&hints, 0, sizeof(struct addrinfo));
-		hints.ai_family = AF_UNSPEC;		/* Allow IPv4 or IPv6 */
-		hints.ai_socktype = SOCK_STREAM;	/* Stream socket */
-		hints.ai_flags = AI_NUMERICSERV;	/* No service name lookup */
-		snprintf(port, sizeof(port), "%d", tcp->port);
-
-		s = getaddrinfo(tcp->remote_host, port, &hints, &servinfo);
-		if (s != 0 || !servinfo) {
-			logit(LOG_WARNING, "Failed resolving hostname %s: %s", tcp->remote_host, gai_strerror(s));
-			rc = RC_TCP_INVALID_REMOTE_ADDR;
+		if (!event_msec(deadline)) {
+			rc = RC_TCP_CONNECT_FAILED;
 			break;
 		}
-		ai = servinfo;
-
-		while (1) {
-			sd = socket(ai->ai_family, SOCK_STREAM, 0);
-			if (sd == -1) {
-				logit(LOG_ERR, "Error creating client socket: %s", strerror(errno));
-				rc = RC_TCP_SOCKET_CREATE_ERROR;
-				break;
-			}
-
-			/* Now we try connecting to the server, on connect fail, try next DNS record */
-			sa  = ai->ai_addr;
-			len = ai->ai_addrlen;
-
-			if (getnameinfo(sa, len, host, sizeof(host), NULL, 0, NI_NUMERICHOST))
-				goto next;
-
-			set_timeouts(sd, tcp->timeout);
-
-			logit(LOG_INFO, "%s, %sconnecting to %s([%s]:%d)", msg, tries ? "re" : "",
-			      tcp->remote_host, host, tcp->port);
-			if (connect(sd, sa, len) && check_error(sd, tcp->timeout)) {
-			next:
-				tries++;
-
-				ai = ai->ai_next;
-				if (ai) {
-					logit(LOG_INFO, "Failed connecting to that server: %s",
-					      errno != EINPROGRESS ? strerror(errno) : "retrying ...");
-					close(sd);
-					continue;
-				}
-
-				logit(LOG_WARNING, "Failed connecting to %s: %s", tcp->remote_host, strerror(errno));
-				close(sd);
-				rc = RC_TCP_CONNECT_FAILED;
-			} else {
-				tcp->socket = sd;
-				tcp->initialized = 1;
-			}
 
+		/* Obtain address(es) of host, from cache or name server */
+		rc = dns_resolve(tcp->remote_host, AF_UNSPEC, &tcp->res, event_msec(deadline));
+		if (rc)
 			break;
-		}
 
-		freeaddrinfo(servinfo);
+		rc = race_start(tcp, msg, NULL, NULL);
+		while (rc == RC_WANT_WRITE)
+			rc = race_wait(tcp, deadline);
 	}
 	while (0);
 
@@ -200,11 +364,18 @@ int tcp_init(tcp_sock_t *tcp, char *msg)
 
 int tcp_exit(tcp_sock_t *tcp)
 {
+	int i;
+
 	ASSERT(tcp);
 
 	if (!tcp->initialized)
 		return 0;
 
+	for (i = 0; i < tcp->next; i++)
+		attempt_close(tcp, i);
+	tcp->next = 0;
+	event_timer_del(&tcp->timer);
+
 	if (tcp->socket > -1) {
 		close(tcp->socket);
 		tcp->socket = -1;
@@ -215,69 +386,98 @@ int tcp_exit(tcp_sock_t *tcp)
 	return 0;
 }
 
-int tcp_send(tcp_sock_t *tcp, const char *buf, int len)
+/*
+ * Non-blocking API, used when several updates are in flight at the
+ * same time.  Each function does as much as it can without blocking
+ * and returns RC_WANT_READ or RC_WANT_WRITE when the caller should
+ * poll() the socket and call again.
+ */
+/*
+ * Look up addresses of remote host.  Returns RC_WANT_RESOLVE if a name
+ * server must be asked, then @cb is called when done, see dns_lookup().
+ */
+int tcp_resolve(tcp_sock_t *tcp, dns_cb_t cb, void *arg)
 {
 	ASSERT(tcp);
 
+	if (!tcp->remote_host)
+		return RC_TCP_INVALID_REMOTE_ADDR;
+
+	return dns_lookup(tcp->remote_host, AF_UNSPEC, &tcp->res, cb, arg);
+}
+
+/*
+ * Start connecting to the addresses from tcp_resolve().  Returns 0 when
+ * connected at once, or RC_WANT_WRITE while attempts are in flight, then
+ * @cb is called from the event loop when done.
+ */
+int tcp_connect(tcp_sock_t *tcp, char *msg, tcp_cb_t cb, void *arg)
+{
+	int rc;
+
+	ASSERT(tcp);
+	ASSERT(cb);
+
+	if (tcp->initialized == 1)
+		return 0;
+
+	rc = race_start(tcp, msg, cb, arg);
+	if (rc && rc != RC_WANT_WRITE)
+		tcp_exit(tcp);
+
+	return rc;
+}
+
+int tcp_write(tcp_sock_t *tcp, const char *buf, int len, int *sent)
+{
+	ssize_t num;
+
+	ASSERT(tcp);
+	ASSERT(sent);
+
+	*sent = 0;
 	if (!tcp->initialized)
 		return RC_TCP_OBJECT_NOT_INITIALIZED;
-again:
-	if (send(tcp->socket, buf, len, 0) == -1) {
-		int err = errno;
-		if(err == EAGAIN || err == EWOULDBLOCK){
-			goto again;
-		}
+
+	num = send(tcp->socket, buf, len, 0);
+	if (num == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return RC_WANT_WRITE;
+
 		logit(LOG_WARNING, "Network error while sending query/update: %s", strerror(errno));
 		return RC_TCP_SEND_ERROR;
 	}
 
+	*sent = num;
+
 	return 0;
 }
 
-int tcp_recv(tcp_sock_t *tcp, char *buf, int len, int *recv_len)
+/* Reads what is available, @recv_len is 0 when the server has closed the connection */
+int tcp_read(tcp_sock_t *tcp, char *buf, int len, int *recv_len)
 {
-	int rc = 0;
-	int remaining_bytes = len;
-	int total_bytes = 0;
+	ssize_t num;
 
 	ASSERT(tcp);
 	ASSERT(buf);
 	ASSERT(recv_len);
 
+	*recv_len = 0;
 	if (!tcp->initialized)
 		return RC_TCP_OBJECT_NOT_INITIALIZED;
 
-	while (remaining_bytes > 0) {
-		int bytes;
-		int err = 0;
-		int chunk_size = remaining_bytes > TCP_DEFAULT_READ_CHUNK_SIZE
-			? TCP_DEFAULT_READ_CHUNK_SIZE
-			: remaining_bytes;
-
-		bytes = recv(tcp->socket, buf + total_bytes, chunk_size, 0);
-		err = errno;
-		if(bytes == -1 && (err == EAGAIN || err == EWOULDBLOCK)){
-			continue;
-		}
-		if (bytes < 0) {
-			logit(LOG_WARNING, "Network error while waiting for reply: %s", strerror(errno));
-			rc = RC_TCP_RECV_ERROR;
-			break;
-		}
-
-		if (bytes == 0) {
-			if (total_bytes == 0)
-				rc = RC_TCP_RECV_ERROR;
-			break;
-		}
+	num = recv(tcp->socket, buf, len, 0);
+	if (num == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return RC_WANT_READ;
 
-		total_bytes    += bytes;
-		remaining_bytes = len - total_bytes;
+		logit(LOG_WARNING, "Network error while waiting for reply: %s", strerror(errno));
+		return RC_TCP_RECV_ERROR;
 	}
 
-	*recv_len = total_bytes;
+	*recv_len = num;
 
-	return rc;
+	return 0;
 }
 
 int tcp_set_port(tcp_sock_t *tcp, int port)